@@ -9,6 +9,6 @@ case "$SERIES" in
         echo 3
         ;;
     *)
-        echo 4
+        echo 5
         ;;
 esac
@@ -34,8 +34,10 @@
 #include<cstring>
 #include<cerrno>
 #include<string>
+#include<algorithm>
 #include<map>
 #include<memory>
+#include<vector>
 
 #include <glib.h>
 #include <glib-unix.h>
@@ -44,6 +46,9 @@ using namespace std;
 
 namespace mediascanner {
 
+// Files extracted before they are written to the store in one batch.
+static const size_t INSERT_BATCH_SIZE = 100;
+
 struct SubtreeWatcherPrivate {
     MediaStore &store; // Hackhackhack, should be replaced with callback object or something.
     MetadataExtractor &extractor;
@@ -53,6 +58,7 @@ struct SubtreeWatcherPrivate {
     std::map<int, std::string> wd2str;
     std::map<std::string, int> str2wd;
     bool keep_going;
+    std::vector<MediaFile> pending;
 
     std::unique_ptr<GSource,void(*)(GSource*)> source;
 
@@ -62,6 +68,27 @@ struct SubtreeWatcherPrivate {
         source(g_unix_fd_source_new(inotifyid, G_IO_IN), g_source_unref) {
     }
 
+    void flush() {
+        if (pending.empty()) {
+            return;
+        }
+        try {
+            store.insertBatch(std::move(pending));
+        } catch(const exception &e) {
+            // One bad file fails the whole batch. Store the others on
+            // their own; insert() clears the broken file mark of each.
+            fprintf(stderr, "Error when adding new files, retrying one at a time: %s\n", e.what());
+            for (const auto &m : pending) {
+                try {
+                    store.insert(m);
+                } catch(const exception &e) {
+                    fprintf(stderr, "Error when adding %s: %s\n", m.getFileName().c_str(), e.what());
+                }
+            }
+        }
+        pending.clear();
+    }
+
     ~SubtreeWatcherPrivate() {
         for(auto &i : wd2str) {
             inotify_rm_watch(inotifyid, i.first);
@@ -140,9 +167,12 @@ void SubtreeWatcher::addDir(const string &root) {
             fileAdded(fullpath);
         }
     }
+    p->flush();
 }
 
 bool SubtreeWatcher::removeDir(const string &abspath) {
+    // Pending files may be under the removed directory.
+    p->flush();
     auto it = p->str2wd.find(abspath);
     if (it == p->str2wd.end()) {
         return false;
@@ -175,32 +205,51 @@ bool SubtreeWatcher::fileAdded(const string &abspath) {
         DetectedFile d = p->extractor.detect(abspath);
         if(p->store.is_broken_file(abspath, d.etag)) {
             fprintf(stderr, "Using fallback data for unscannable file %s.\n", abspath.c_str());
-            p->store.insert(p->extractor.fallback_extract(d));
+            p->pending.push_back(p->extractor.fallback_extract(d));
         } else if (d.etag != p->store.getETag(d.filename)) {
-            // Only extract and insert the file if the ETag has changed.
-            p->store.insert_broken_file(abspath, d.etag);
-            // If detection dies, insertion into broken files persists
-            // and the next time this file is encountered, it is skipped.
-            // Insert cleans broken status of the file.
-            MediaFile media;
+            // Only extract and insert the file if the ETag has changed,
+            // and only if it is not a copy of a file already known,
+            // such as one moved here from another directory.
             try {
-                media = p->extractor.extract(d);
+                d.fingerprint = fileFingerprint(abspath);
             } catch (const std::runtime_error &e) {
-                fprintf(stderr, "Error extracting from '%s': %s\n",
-                        d.filename.c_str(), e.what());
-                media = p->extractor.fallback_extract(d);
+                fprintf(stderr, "%s\n", e.what());
             }
-            p->store.insert(std::move(media));
+            const auto copies = p->store.lookupFingerprint(d.fingerprint);
+            auto copy = std::find_if(copies.begin(), copies.end(), [&d](const MediaFile &m) {
+                return m.getFileName() != d.filename && m.getType() == d.type;
+            });
+            MediaFile media;
+            if (copy != copies.end()) {
+                media = p->extractor.copy_extract(d, *copy);
+            } else {
+                p->store.insert_broken_file(abspath, d.etag);
+                // If detection dies, insertion into broken files persists
+                // and the next time this file is encountered, it is skipped.
+                // Insert cleans broken status of the file.
+                try {
+                    media = p->extractor.extract(d);
+                } catch (const std::runtime_error &e) {
+                    fprintf(stderr, "Error extracting from '%s': %s\n",
+                            d.filename.c_str(), e.what());
+                    media = p->extractor.fallback_extract(d);
+                }
+            }
+            p->pending.push_back(std::move(media));
             changed = true;
         }
     } catch(const exception &e) {
         fprintf(stderr, "Error when adding new file: %s\n", e.what());
     }
+    if (p->pending.size() >= INSERT_BATCH_SIZE) {
+        p->flush();
+    }
     return changed;
 }
 
 void SubtreeWatcher::fileDeleted(const string &abspath) {
     printf("File was deleted: %s\n", abspath.c_str());
+    p->flush();
     p->store.remove(abspath);
 }
 
@@ -277,6 +326,7 @@ void SubtreeWatcher::processEvents() {
         }
         d += sizeof(struct inotify_event) + event->len;
     }
+    p->flush();
     if (changed) {
         p->invalidator.invalidate();
     }
@@ -30,10 +30,12 @@
 
 #include <glib.h>
 
+#include <algorithm>
 #include <cassert>
 #include <cstdio>
 #include <map>
 #include <deque>
+#include <vector>
 
 using namespace std;
 
@@ -52,6 +54,27 @@ struct VolumeEvent {
         : type(type), path(path) {}
 };
 
+// Relaxes the durability of the store for the lifetime of a scan.
+// Must outlive the scan's transaction.
+class BulkLoad final {
+public:
+    explicit BulkLoad(mediascanner::MediaStore &store) : store(store) {
+        store.beginBulkLoad();
+    }
+    ~BulkLoad() {
+        try {
+            store.endBulkLoad();
+        } catch(const exception &e) {
+            fprintf(stderr, "Could not end bulk load: %s\n", e.what());
+        }
+    }
+    BulkLoad(const BulkLoad &other) = delete;
+    BulkLoad& operator=(const BulkLoad &other) = delete;
+
+private:
+    mediascanner::MediaStore &store;
+};
+
 }
 
 namespace mediascanner {
@@ -64,6 +87,7 @@ struct VolumeManagerPrivate {
     map<string, unique_ptr<SubtreeWatcher>> volumes;
     deque<VolumeEvent> pending;
     unsigned int idle_id = 0;
+    unsigned int maintenance_id = 0;
 
     VolumeManagerPrivate(MediaStore& store, MetadataExtractor& extractor,
                          InvalidationSender& invalidator);
@@ -71,6 +95,8 @@ struct VolumeManagerPrivate {
 
     void queueUpdate(VolumeEventType type, const string& path);
     static gboolean processEvent(void *user_data) noexcept;
+    void scheduleMaintenance();
+    static gboolean runMaintenance(void *user_data) noexcept;
 
     void addVolume(const string& path);
     void removeVolume(const string& path);
@@ -108,6 +134,9 @@ VolumeManagerPrivate::~VolumeManagerPrivate()
     if (idle_id != 0) {
         g_source_remove(idle_id);
     }
+    if (maintenance_id != 0) {
+        g_source_remove(maintenance_id);
+    }
 }
 
 void VolumeManagerPrivate::queueUpdate(VolumeEventType type,
@@ -143,6 +172,43 @@ gboolean VolumeManagerPrivate::processEvent(void *user_data) noexcept {
     }
     p->invalidator.invalidate();
     p->idle_id = 0;
+    p->scheduleMaintenance();
+    return G_SOURCE_REMOVE;
+}
+
+// Seconds without volume events before database maintenance starts,
+// and the time spent on it per main loop iteration after that.
+static const unsigned int MAINTENANCE_DELAY = 60;
+static const int MAINTENANCE_SLICE_MS = 50;
+
+void VolumeManagerPrivate::scheduleMaintenance() {
+    if (maintenance_id != 0) {
+        g_source_remove(maintenance_id);
+    }
+    maintenance_id = g_timeout_add_seconds_full(
+        G_PRIORITY_LOW, MAINTENANCE_DELAY,
+        &VolumeManagerPrivate::runMaintenance, this, nullptr);
+}
+
+gboolean VolumeManagerPrivate::runMaintenance(void *user_data) noexcept {
+    auto *p = reinterpret_cast<VolumeManagerPrivate*>(user_data);
+    p->maintenance_id = 0;
+    // A scan runs the main loop while it works. processEvent will
+    // schedule maintenance again once it is done.
+    if (p->idle_id != 0) {
+        return G_SOURCE_REMOVE;
+    }
+    bool more = false;
+    try {
+        more = p->store.runMaintenance(MAINTENANCE_SLICE_MS);
+    } catch (const exception &e) {
+        fprintf(stderr, "Error during database maintenance: %s\n", e.what());
+    }
+    if (more) {
+        // Carry on whenever there is nothing else to do.
+        p->maintenance_id = g_idle_add_full(
+            G_PRIORITY_LOW, &VolumeManagerPrivate::runMaintenance, p, nullptr);
+    }
     return G_SOURCE_REMOVE;
 }
 
@@ -169,6 +235,9 @@ void VolumeManagerPrivate::addVolume(const string& path) {
     store.pruneDeleted();
     readFiles(path, AllMedia);
     sw->addDir(path);
+    // The index loaded by readFiles also serves the watcher's first
+    // pass over the volume, so only drop it now.
+    store.dropETagIndex();
     volumes[path] = move(sw);
 }
 
@@ -182,7 +251,31 @@ void VolumeManagerPrivate::removeVolume(const string& path) {
 
 void VolumeManagerPrivate::readFiles(const string &subdir, const MediaType type) {
     Scanner s(&extractor, subdir, type);
+    store.loadETagIndex(subdir);
+    BulkLoad bulk(store);
     MediaStoreTransaction txn = store.beginTransaction();
+    std::vector<MediaFile> pending;
+    const size_t batch_size = 100; // Files written to the store at once.
+    auto flush = [&]() {
+        if (pending.empty()) {
+            return;
+        }
+        try {
+            store.insertBatch(std::move(pending));
+        } catch(const exception &e) {
+            // One bad file fails the whole batch. Store the others on
+            // their own; insert() clears the broken file mark of each.
+            fprintf(stderr, "Error when indexing, retrying files one at a time: %s\n", e.what());
+            for (const auto &m : pending) {
+                try {
+                    store.insert(m);
+                } catch(const exception &e) {
+                    fprintf(stderr, "Error when indexing %s: %s\n", m.getFileName().c_str(), e.what());
+                }
+            }
+        }
+        pending.clear();
+    };
     const int update_interval = 10; // How often to send invalidations.
     struct timespec previous_update, current_time;
     clock_gettime(CLOCK_MONOTONIC, &previous_update);
@@ -194,7 +287,11 @@ void VolumeManagerPrivate::readFiles(const string &subdir, const MediaType type)
             while(g_main_context_pending(g_main_context_default())) {
                 g_main_context_iteration(g_main_context_default(), FALSE);
             }
+            if(pending.size() >= batch_size) {
+                flush();
+            }
             if(current_time.tv_sec - previous_update.tv_sec >= update_interval) {
+                flush();
                 txn.commit();
                 invalidator.invalidate();
                 previous_update = current_time;
@@ -202,23 +299,38 @@ void VolumeManagerPrivate::readFiles(const string &subdir, const MediaType type)
             // If the file is broken or unchanged, use fallback.
             if (store.is_broken_file(d.filename, d.etag)) {
                 fprintf(stderr, "Using fallback data for unscannable file %s.\n", d.filename.c_str());
-                store.insert(extractor.fallback_extract(d));
+                pending.push_back(extractor.fallback_extract(d));
                 continue;
             }
             if(d.etag == store.getETag(d.filename))
                 continue;
 
             try {
-                store.insert_broken_file(d.filename, d.etag);
-                MediaFile media;
+                // A copy of a known file gets the metadata of the
+                // original without being extracted.
                 try {
-                    media = extractor.extract(d);
+                    d.fingerprint = fileFingerprint(d.filename);
                 } catch (const runtime_error &e) {
-                    fprintf(stderr, "Error extracting from '%s': %s\n",
-                            d.filename.c_str(), e.what());
-                    media = extractor.fallback_extract(d);
+                    fprintf(stderr, "%s\n", e.what());
+                }
+                const auto copies = store.lookupFingerprint(d.fingerprint);
+                auto copy = find_if(copies.begin(), copies.end(), [&d](const MediaFile &m) {
+                    return m.getFileName() != d.filename && m.getType() == d.type;
+                });
+                MediaFile media;
+                if (copy != copies.end()) {
+                    media = extractor.copy_extract(d, *copy);
+                } else {
+                    store.insert_broken_file(d.filename, d.etag);
+                    try {
+                        media = extractor.extract(d);
+                    } catch (const runtime_error &e) {
+                        fprintf(stderr, "Error extracting from '%s': %s\n",
+                                d.filename.c_str(), e.what());
+                        media = extractor.fallback_extract(d);
+                    }
                 }
-                store.insert(std::move(media));
+                pending.push_back(std::move(media));
             } catch(const exception &e) {
                 fprintf(stderr, "Error when indexing: %s\n", e.what());
             }
@@ -226,6 +338,7 @@ void VolumeManagerPrivate::readFiles(const string &subdir, const MediaType type)
             break;
         }
     }
+    flush();
     txn.commit();
 }
 
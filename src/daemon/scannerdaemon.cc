@@ -91,7 +91,24 @@ ScannerDaemon::ScannerDaemon() :
     main_loop(g_main_loop_new(nullptr, FALSE), g_main_loop_unref),
     session_bus(nullptr, g_object_unref) {
     setupBus();
-    store.reset(new MediaStore(MS_READ_WRITE, "/media/"));
+    MediaStoreOptions options;
+    // Let clients read while we hold long scan transactions.
+    options.setWriteAheadLog(true);
+    // In WAL mode NORMAL only risks the last commits on power loss,
+    // never corruption, and skips the sync on every commit, so scans
+    // use it too. OFF would never sync, not even at checkpoints, and
+    // could leave a corrupt database after a power loss.
+    options.setSynchronous(SyncLevel::Normal);
+    options.setBulkLoadSynchronous(SyncLevel::Normal);
+    options.setCacheSize(8192);
+    options.setTempStore(TempStore::Memory);
+    store.reset(new MediaStore(MS_READ_WRITE, options, "/media/"));
+    // Not part of idle time maintenance, as it can take long.
+    try {
+        store->enableIncrementalVacuum();
+    } catch (const exception &e) {
+        fprintf(stderr, "Could not rebuild database: %s\n", e.what());
+    }
     extractor.reset(new MetadataExtractor(session_bus.get()));
     volumes.reset(new VolumeManager(*store, *extractor, invalidator));
 
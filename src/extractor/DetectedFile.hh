@@ -40,6 +40,8 @@ struct DetectedFile {
     std::string content_type;
     uint64_t mtime;
     MediaType type;
+    // Not set by detection, see fileFingerprint().
+    std::string fingerprint;
 };
 
 }
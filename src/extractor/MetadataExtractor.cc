@@ -179,11 +179,43 @@ MediaFile MetadataExtractor::extract(const DetectedFile &d) {
     // Place variant in a unique_ptr so it is guaranteed to be unrefed.
     std::unique_ptr<GVariant,decltype(&g_variant_unref)> result(
         res, g_variant_unref);
-    return media_from_variant(result.get());
+    return MediaFileBuilder(media_from_variant(result.get()))
+        .setFingerprint(d.fingerprint);
 }
 
 MediaFile MetadataExtractor::fallback_extract(const DetectedFile &d) {
-    return MediaFileBuilder(d.filename).setType(d.type);
+    return MediaFileBuilder(d.filename).setType(d.type).setFingerprint(d.fingerprint);
+}
+
+MediaFile MetadataExtractor::copy_extract(const DetectedFile &d, const MediaFile &source) {
+    fprintf(stderr, "Copying metadata of %s from %s.\n",
+            d.filename.c_str(), source.getFileName().c_str());
+    // A title made up from the name of the source is made up again
+    // from the new name.
+    std::string title = source.getTitle();
+    if (title == filenameToTitle(source.getFileName())) {
+        title.clear();
+    }
+    return MediaFileBuilder(d.filename)
+        .setType(d.type)
+        .setETag(d.etag)
+        .setContentType(d.content_type)
+        .setModificationTime(d.mtime)
+        .setFingerprint(d.fingerprint)
+        .setTitle(title)
+        .setDate(source.getDate())
+        .setAuthor(source.getAuthor())
+        .setAlbum(source.getAlbum())
+        .setAlbumArtist(source.getAlbumArtist())
+        .setGenre(source.getGenre())
+        .setDiscNumber(source.getDiscNumber())
+        .setTrackNumber(source.getTrackNumber())
+        .setDuration(source.getDuration())
+        .setWidth(source.getWidth())
+        .setHeight(source.getHeight())
+        .setLatitude(source.getLatitude())
+        .setLongitude(source.getLongitude())
+        .setHasThumbnail(source.getHasThumbnail());
 }
 
 }
@@ -47,6 +47,10 @@ public:
     // use this to generate fallback data.
     MediaFile fallback_extract(const DetectedFile &d);
 
+    // The metadata of d taken from source, a file with the same
+    // fingerprint, instead of extracting it again.
+    MediaFile copy_extract(const DetectedFile &d, const MediaFile &source);
+
 private:
     std::unique_ptr<MetadataExtractorPrivate> p;
 };
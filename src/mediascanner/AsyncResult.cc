@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AsyncResult.hh"
+
+using namespace std;
+
+namespace mediascanner {
+
+QueryCancelled::QueryCancelled() : runtime_error("Query was cancelled") {
+}
+
+void AsyncQuery::cancel() {
+    lock_guard<std::mutex> lock(mutex);
+    cancelled = true;
+    if (interrupt) {
+        interrupt();
+    }
+}
+
+bool AsyncQuery::isCancelled() const {
+    return cancelled;
+}
+
+void AsyncQuery::setInterrupt(function<void()> interrupt) {
+    lock_guard<std::mutex> lock(mutex);
+    this->interrupt = move(interrupt);
+    if (cancelled) {
+        this->interrupt();
+    }
+}
+
+void AsyncQuery::clearInterrupt() {
+    lock_guard<std::mutex> lock(mutex);
+    interrupt = nullptr;
+}
+
+}
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ASYNCRESULT_HH
+#define ASYNCRESULT_HH
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+
+namespace mediascanner {
+
+// Thrown by AsyncResult::get() once the query has been cancelled.
+class QueryCancelled : public std::runtime_error {
+public:
+    QueryCancelled();
+};
+
+/**
+ * The cancellation state of a query running in the background,
+ * shared between the query and the AsyncResult waiting for it.
+ */
+class AsyncQuery final {
+public:
+    AsyncQuery() = default;
+    AsyncQuery(const AsyncQuery &other) = delete;
+    AsyncQuery& operator=(const AsyncQuery &other) = delete;
+
+    // Safe to call from any thread, any number of times.
+    void cancel();
+    bool isCancelled() const;
+
+    // For implementations of the asynchronous calls: interrupt is run
+    // by cancel() while set, or at once if already cancelled, to stop
+    // the work in progress. clearInterrupt() waits for a running
+    // interrupt to return.
+    void setInterrupt(std::function<void()> interrupt);
+    void clearInterrupt();
+
+private:
+    std::mutex mutex;
+    std::atomic<bool> cancelled{false};
+    std::function<void()> interrupt;
+};
+
+/**
+ * The result of a query running in the background. Destroying the
+ * result of an unfinished query waits for the query to stop, so
+ * cancel it first if it is no longer wanted.
+ */
+template <typename T>
+class AsyncResult final {
+public:
+    AsyncResult(std::future<T> &&future, const std::shared_ptr<AsyncQuery> &query)
+        : future(std::move(future)), query(query) {}
+    AsyncResult(AsyncResult &&other) = default;
+    AsyncResult& operator=(AsyncResult &&other) = default;
+    AsyncResult(const AsyncResult &other) = delete;
+    AsyncResult& operator=(const AsyncResult &other) = delete;
+
+    // Waits for the result. Throws QueryCancelled after cancel(), even
+    // if the query had already finished, and otherwise whatever the
+    // query threw.
+    T get() {
+        T value = future.get();
+        if (query->isCancelled()) {
+            throw QueryCancelled();
+        }
+        return value;
+    }
+
+    void wait() const {
+        future.wait();
+    }
+
+    // Whether the result is ready within timeout.
+    bool waitFor(std::chrono::milliseconds timeout) const {
+        return future.wait_for(timeout) == std::future_status::ready;
+    }
+
+    void cancel() {
+        query->cancel();
+    }
+
+    const std::shared_ptr<AsyncQuery> &getQuery() const {
+        return query;
+    }
+
+private:
+    std::future<T> future;
+    std::shared_ptr<AsyncQuery> query;
+};
+
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BOUNDINGBOX_HH
+#define BOUNDINGBOX_HH
+
+namespace mediascanner {
+
+// A region of the map for MediaStoreBase::queryRegion(), in degrees,
+// edges included. A box whose west edge lies east of its east edge
+// crosses the 180th meridian.
+struct BoundingBox {
+    BoundingBox() = default;
+    BoundingBox(double south, double west, double north, double east)
+        : south(south), west(west), north(north), east(east) {}
+
+    double south = 0.0;
+    double west = 0.0;
+    double north = 0.0;
+    double east = 0.0;
+
+    bool operator==(const BoundingBox &other) const {
+        return south == other.south && west == other.west &&
+            north == other.north && east == other.east;
+    }
+    bool operator!=(const BoundingBox &other) const {
+        return !(*this == other);
+    }
+};
+
+}
+
+#endif
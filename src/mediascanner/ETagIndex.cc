@@ -0,0 +1,139 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "internal/ETagIndex.hh"
+#include "internal/sqliteutils.hh"
+
+using namespace std;
+
+namespace mediascanner {
+
+void ETagIndex::load(sqlite3 *db, const string &prefix) {
+    clear();
+    prefix_ = prefix;
+    if (prefix_.empty() || prefix_[prefix_.size() - 1] != '/') {
+        prefix_ += '/';
+    }
+
+    Statement media(db, ("SELECT filename, etag FROM media WHERE " + prefix_range(prefix_)).c_str());
+    bind_prefix(media, prefix_);
+    while (media.step()) {
+        entries_[media.getText(0).substr(prefix_.size())].etag = media.getText(1);
+    }
+
+    Statement broken(db, ("SELECT filename, etag FROM broken_files WHERE " + prefix_range(prefix_)).c_str());
+    bind_prefix(broken, prefix_);
+    while (broken.step()) {
+        entries_[broken.getText(0).substr(prefix_.size())].broken_etag = broken.getText(1);
+    }
+    loaded_ = true;
+}
+
+void ETagIndex::clear() {
+    loaded_ = false;
+    prefix_.clear();
+    // Release the memory rather than just emptying the buckets.
+    unordered_map<string, Entry>().swap(entries_);
+}
+
+bool ETagIndex::covers(const string &filename) const {
+    return loaded_ && filename.compare(0, prefix_.size(), prefix_) == 0;
+}
+
+string ETagIndex::getETag(const string &filename) const {
+    const auto it = entries_.find(filename.substr(prefix_.size()));
+    return it != entries_.end() ? it->second.etag : "";
+}
+
+bool ETagIndex::isBroken(const string &filename, const string &etag) const {
+    const auto it = entries_.find(filename.substr(prefix_.size()));
+    return it != entries_.end() && !it->second.broken_etag.empty() &&
+        it->second.broken_etag == etag;
+}
+
+void ETagIndex::setETag(const string &filename, const string &etag) {
+    if (covers(filename)) {
+        entries_[filename.substr(prefix_.size())].etag = etag;
+    }
+}
+
+void ETagIndex::setBroken(const string &filename, const string &etag) {
+    if (covers(filename)) {
+        entries_[filename.substr(prefix_.size())].broken_etag = etag;
+    }
+}
+
+void ETagIndex::clearBroken(const string &filename) {
+    if (!covers(filename)) {
+        return;
+    }
+    const auto it = entries_.find(filename.substr(prefix_.size()));
+    if (it == entries_.end()) {
+        return;
+    }
+    if (it->second.etag.empty()) {
+        entries_.erase(it);
+    } else {
+        it->second.broken_etag.clear();
+    }
+}
+
+void ETagIndex::remove(const string &filename) {
+    if (!covers(filename)) {
+        return;
+    }
+    const auto it = entries_.find(filename.substr(prefix_.size()));
+    if (it == entries_.end()) {
+        return;
+    }
+    if (it->second.broken_etag.empty()) {
+        entries_.erase(it);
+    } else {
+        it->second.etag.clear();
+    }
+}
+
+void ETagIndex::removeSubtree(const string &directory) {
+    if (!loaded_) {
+        return;
+    }
+    string dir = directory;
+    if (dir.empty() || dir[dir.size() - 1] != '/') {
+        dir += '/';
+    }
+    // Removing a parent of the indexed prefix removes everything.
+    string relative;
+    if (prefix_.compare(0, dir.size(), dir) != 0) {
+        if (!covers(dir)) {
+            return;
+        }
+        relative = dir.substr(prefix_.size());
+    }
+    // The broken_files rows stay, and so does their state, as in
+    // remove().
+    for (auto it = entries_.begin(); it != entries_.end(); ) {
+        if (it->first.compare(0, relative.size(), relative) != 0) {
+            ++it;
+        } else if (it->second.broken_etag.empty()) {
+            it = entries_.erase(it);
+        } else {
+            it->second.etag.clear();
+            ++it;
+        }
+    }
+}
+
+}
@@ -0,0 +1,165 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "internal/FTS5Tokenizer.hh"
+#include "mozilla/fts3_tokenizer.h"
+
+#include <cctype>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+extern "C" void sqlite3Fts3PorterTokenizerModule(
+    sqlite3_tokenizer_module const**ppModule);
+
+namespace mediascanner {
+
+// sqlite3_bind_pointer(), needed to get at the FTS5 API, is new in 3.20.
+#if SQLITE_VERSION_NUMBER >= 3020000
+
+namespace {
+
+// The FTS5 tokenizer is a thin wrapper around the FTS3 tokenizer
+// module, so both backends produce exactly the same tokens.
+struct PorterTokenizer {
+    const sqlite3_tokenizer_module *module;
+    sqlite3_tokenizer *tokenizer;
+};
+
+int porter_create(void *, const char **, int, Fts5Tokenizer **out) {
+    const sqlite3_tokenizer_module *module = nullptr;
+    sqlite3Fts3PorterTokenizerModule(&module);
+    sqlite3_tokenizer *tokenizer = nullptr;
+    int rc = module->xCreate(0, nullptr, &tokenizer);
+    if (rc != SQLITE_OK) {
+        return rc;
+    }
+    tokenizer->pModule = module;
+    PorterTokenizer *t = new(nothrow) PorterTokenizer{module, tokenizer};
+    if (t == nullptr) {
+        module->xDestroy(tokenizer);
+        return SQLITE_NOMEM;
+    }
+    *out = reinterpret_cast<Fts5Tokenizer*>(t);
+    return SQLITE_OK;
+}
+
+void porter_delete(Fts5Tokenizer *tokenizer) {
+    PorterTokenizer *t = reinterpret_cast<PorterTokenizer*>(tokenizer);
+    t->module->xDestroy(t->tokenizer);
+    delete t;
+}
+
+int porter_tokenize(Fts5Tokenizer *tokenizer, void *ctx, int flags,
+                    const char *text, int length,
+                    int (*token)(void*, int, const char*, int, int, int)) {
+    PorterTokenizer *t = reinterpret_cast<PorterTokenizer*>(tokenizer);
+
+    // The FTS4 query parser leaves the "*" of a prefix term in the text
+    // it tokenizes, which makes mozporter keep a short last word rather
+    // than dropping it as a stop word. FTS5 only sets a flag, so put
+    // the "*" back.
+    char *prefix = nullptr;
+    if (flags & FTS5_TOKENIZE_PREFIX) {
+        prefix = static_cast<char*>(sqlite3_malloc(length + 1));
+        if (prefix == nullptr) {
+            return SQLITE_NOMEM;
+        }
+        memcpy(prefix, text, length);
+        prefix[length] = '*';
+    }
+
+    sqlite3_tokenizer_cursor *cursor = nullptr;
+    int rc = t->module->xOpen(t->tokenizer, prefix ? prefix : text,
+                              prefix ? length + 1 : length, &cursor);
+    if (rc == SQLITE_OK) {
+        cursor->pTokenizer = t->tokenizer;
+        const char *word;
+        int bytes, start, end, position;
+        while ((rc = t->module->xNext(cursor, &word, &bytes, &start, &end, &position)) == SQLITE_OK) {
+            rc = token(ctx, 0, word, bytes, start, end < length ? end : length);
+            if (rc != SQLITE_OK) {
+                break;
+            }
+        }
+        t->module->xClose(cursor);
+    }
+    sqlite3_free(prefix);
+    return rc == SQLITE_DONE ? SQLITE_OK : rc;
+}
+
+}
+
+void registerFts5Tokenizer(sqlite3 *db) {
+    fts5_api *api = nullptr;
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT fts5(?1)", -1, &stmt, nullptr) != SQLITE_OK) {
+        throw runtime_error("SQLite was built without FTS5 support");
+    }
+    sqlite3_bind_pointer(stmt, 1, &api, "fts5_api_ptr", nullptr);
+    sqlite3_step(stmt);
+    sqlite3_finalize(stmt);
+    if (api == nullptr) {
+        throw runtime_error("Could not get the FTS5 API");
+    }
+
+    fts5_tokenizer tokenizer = {porter_create, porter_delete, porter_tokenize};
+    if (api->xCreateTokenizer(api, "mozporter", nullptr, &tokenizer, nullptr) != SQLITE_OK) {
+        throw runtime_error(sqlite3_errmsg(db));
+    }
+}
+
+#else
+
+void registerFts5Tokenizer(sqlite3 *) {
+    throw runtime_error("FTS5 support needs SQLite 3.20 or later");
+}
+
+#endif
+
+string fts5Query(const string &term) {
+    string query;
+    string::size_type pos = 0;
+    while (true) {
+        while (pos < term.size() && isspace(static_cast<unsigned char>(term[pos]))) {
+            pos++;
+        }
+        if (pos >= term.size()) {
+            break;
+        }
+        if (!query.empty()) {
+            query += ' ';
+        }
+        query += '"';
+        while (pos < term.size() && !isspace(static_cast<unsigned char>(term[pos]))) {
+            if (term[pos] == '"') {
+                query += '"';
+            }
+            query += term[pos++];
+        }
+        query += '"';
+    }
+    if (query.empty()) {
+        return "\"\"";
+    }
+    query += '*';
+    return query;
+}
+
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIAFACETS_HH
+#define MEDIAFACETS_HH
+
+#include <cstddef>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace mediascanner {
+
+// Names with the number of matching songs for each, ordered by name.
+typedef std::vector<std::pair<std::string, size_t>> FacetCounts;
+
+// The genres, artists and album artists of the songs matching a
+// filter, as returned by MediaStoreBase::facets().
+struct Facets {
+    FacetCounts genres;
+    FacetCounts artists;
+    FacetCounts album_artists;
+
+    bool operator==(const Facets &other) const {
+        return genres == other.genres && artists == other.artists &&
+            album_artists == other.album_artists;
+    }
+    bool operator!=(const Facets &other) const {
+        return !(*this == other);
+    }
+};
+
+}
+
+#endif
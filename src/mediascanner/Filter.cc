@@ -18,6 +18,11 @@
  */
 
 #include "Filter.hh"
+#include "Album.hh"
+#include "MediaFile.hh"
+#include "internal/utils.hh"
+
+#include <vector>
 
 using std::string;
 
@@ -28,17 +33,20 @@ struct Filter::Private {
     string album;
     string album_artist;
     string genre;
+    string cursor;
 
     int offset = 0;
     int limit = -1;
 
     MediaOrder order = MediaOrder::Default;
     bool reverse = false;
+    unsigned fields = AllFields;
 
     bool have_artist = false;
     bool have_album = false;
     bool have_album_artist = false;
     bool have_genre = false;
+    bool have_cursor = false;
 
     Private() {}
 };
@@ -64,14 +72,17 @@ bool Filter::operator==(const Filter &other) const {
         p->have_album == other.p->have_album &&
         p->have_album_artist == other.p->have_album_artist &&
         p->have_genre == other.p->have_genre &&
+        p->have_cursor == other.p->have_cursor &&
         p->artist == other.p->artist &&
         p->album == other.p->album &&
         p->album_artist == other.p->album_artist &&
         p->genre == other.p->genre &&
+        p->cursor == other.p->cursor &&
         p->offset == other.p->offset &&
         p->limit == other.p->limit &&
         p->order == other.p->order &&
-        p->reverse == other.p->reverse;
+        p->reverse == other.p->reverse &&
+        p->fields == other.p->fields;
 }
 
 bool Filter::operator!=(const Filter &other) const {
@@ -97,10 +108,12 @@ void Filter::clear() {
     unsetAlbum();
     unsetAlbumArtist();
     unsetGenre();
+    unsetCursor();
     p->offset = 0;
     p->limit = -1;
     p->order = MediaOrder::Default;
     p->reverse = false;
+    p->fields = AllFields;
 }
 
 void Filter::setArtist(const std::string &artist) {
@@ -191,6 +204,44 @@ int Filter::getLimit() const {
     return p->limit;
 }
 
+void Filter::setCursor(const std::string &cursor) {
+    p->cursor = cursor;
+    p->have_cursor = true;
+}
+
+void Filter::unsetCursor() {
+    p->cursor = "";
+    p->have_cursor = false;
+}
+
+bool Filter::hasCursor() const {
+    return p->have_cursor;
+}
+
+const std::string &Filter::getCursor() const {
+    return p->cursor;
+}
+
+void Filter::setCursorAfter(const MediaFile &last) {
+    setCursor(encodeCursor('m', {
+                last.getAlbumArtist(),
+                last.getAlbum(),
+                std::to_string(last.getDiscNumber()),
+                std::to_string(last.getTrackNumber()),
+                last.getTitle(),
+                std::to_string(dateToEpoch(last.getDate())),
+                std::to_string(last.getModificationTime()),
+                last.getFileName()}));
+}
+
+void Filter::setCursorAfter(const Album &last) {
+    setCursor(encodeCursor('a', {last.getArtist(), last.getTitle()}));
+}
+
+void Filter::setCursorAfter(const std::string &last) {
+    setCursor(encodeCursor('s', {last}));
+}
+
 void Filter::setOrder(MediaOrder order) {
     p->order = order;
 }
@@ -207,4 +258,12 @@ bool Filter::getReverse() const {
     return p->reverse;
 }
 
+void Filter::setFields(unsigned fields) {
+    p->fields = fields;
+}
+
+unsigned Filter::getFields() const {
+    return p->fields;
+}
+
 }
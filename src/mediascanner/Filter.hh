@@ -25,6 +25,9 @@
 
 namespace mediascanner {
 
+class Album;
+class MediaFile;
+
 class Filter final {
 public:
     Filter();
@@ -64,11 +67,30 @@ public:
     void setLimit(int limit);
     int getLimit() const;
 
+    // An opaque continuation token. When set, results start after
+    // the item the cursor was made from rather than at the offset,
+    // so each page costs the same no matter how deep it is.
+    void setCursor(const std::string &cursor);
+    void unsetCursor();
+    bool hasCursor() const;
+    const std::string &getCursor() const;
+    // Continue after the last item of the previous page.
+    void setCursorAfter(const MediaFile &last);
+    void setCursorAfter(const Album &last);
+    void setCursorAfter(const std::string &last);
+
     void setOrder(MediaOrder order);
     MediaOrder getOrder() const;
     void setReverse(bool reverse);
     bool getReverse() const;
 
+    // The MediaField values the files of a result need. Others are
+    // left empty or zero, which saves reading and copying them. The
+    // file name and type are always filled in, as are the fields the
+    // results are ordered by, so setCursorAfter() keeps working.
+    void setFields(unsigned fields);
+    unsigned getFields() const;
+
 private:
     struct Private;
     Private *p;
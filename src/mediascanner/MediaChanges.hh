@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIACHANGES_HH
+#define MEDIACHANGES_HH
+
+#include"scannercore.hh"
+#include<cstdint>
+#include<string>
+#include<vector>
+
+namespace mediascanner {
+
+// Stored in the change journal, so the values must not change.
+enum class ChangeType {
+    Added = 0,
+    Modified = 1,
+    Removed = 2,
+};
+
+// The latest change to a file. Only the latest one is kept, so a
+// client can get Modified for a file it has never seen, or Removed
+// for one it never had: Added and Modified both mean the file should
+// be looked up again.
+struct MediaChange {
+    uint64_t sequence = 0;
+    ChangeType change = ChangeType::Added;
+    MediaType type = UnknownMedia;
+    std::string filename;
+
+    bool operator==(const MediaChange &other) const {
+        return sequence == other.sequence && change == other.change &&
+            type == other.type && filename == other.filename;
+    }
+    bool operator!=(const MediaChange &other) const {
+        return !(*this == other);
+    }
+};
+
+// The files changed after a sequence number, as returned by
+// MediaStoreBase::changesSince(), ordered by sequence number.
+struct MediaChanges {
+    // The latest sequence number, to ask for the next changes with.
+    uint64_t sequence = 0;
+    // False if changes since the sequence number asked for are no
+    // longer known, or it belongs to another database. changes is
+    // then empty and the client has to load everything again.
+    bool complete = true;
+    std::vector<MediaChange> changes;
+
+    bool operator==(const MediaChanges &other) const {
+        return sequence == other.sequence && complete == other.complete &&
+            changes == other.changes;
+    }
+    bool operator!=(const MediaChanges &other) const {
+        return !(*this == other);
+    }
+};
+
+}
+
+#endif
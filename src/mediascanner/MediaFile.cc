@@ -35,7 +35,7 @@ MediaFile::MediaFile(const MediaFile &other) :
     p(new MediaFilePrivate(*other.p)) {
 }
 
-MediaFile::MediaFile(MediaFile &&other) : p(nullptr) {
+MediaFile::MediaFile(MediaFile &&other) noexcept : p(nullptr) {
     *this = std::move(other);
 }
 
@@ -65,7 +65,7 @@ MediaFile &MediaFile::operator=(const MediaFile &other) {
     return *this;
 }
 
-MediaFile &MediaFile::operator=(MediaFile &&other) {
+MediaFile &MediaFile::operator=(MediaFile &&other) noexcept {
     if (this != &other) {
         delete p;
         p = other.p;
@@ -79,7 +79,7 @@ const std::string& MediaFile::getFileName() const noexcept {
 }
 
 const std::string& MediaFile::getContentType() const noexcept {
-    return p->content_type;
+    return p->content_type.str();
 }
 
 const std::string& MediaFile::getETag() const noexcept {
@@ -91,15 +91,15 @@ const std::string& MediaFile::getTitle() const noexcept {
 }
 
 const std::string& MediaFile::getAuthor() const noexcept {
-    return p->author;
+    return p->author.str();
 }
 
 const std::string& MediaFile::getAlbum() const noexcept {
-    return p->album;
+    return p->album.str();
 }
 
 const std::string& MediaFile::getAlbumArtist() const noexcept {
-    return p->album_artist;
+    return p->album_artist.str();
 }
 
 const std::string& MediaFile::getDate() const noexcept {
@@ -107,7 +107,7 @@ const std::string& MediaFile::getDate() const noexcept {
 }
 
 const std::string& MediaFile::getGenre() const noexcept {
-    return p->genre;
+    return p->genre.str();
 }
 
 int MediaFile::getDiscNumber() const noexcept {
@@ -146,6 +146,10 @@ uint64_t MediaFile::getModificationTime() const noexcept {
     return p->modification_time;
 }
 
+const std::string& MediaFile::getFingerprint() const noexcept {
+    return p->fingerprint;
+}
+
 MediaType MediaFile::getType() const noexcept {
     return p->type;
 }
@@ -35,7 +35,7 @@ public:
 
     MediaFile();
     MediaFile(const MediaFile &other);
-    MediaFile(MediaFile &&other);
+    MediaFile(MediaFile &&other) noexcept;
     MediaFile(const MediaFileBuilder &builder);
     MediaFile(MediaFileBuilder &&builder);
     ~MediaFile();
@@ -61,12 +61,16 @@ public:
     double getLongitude() const noexcept;
     bool getHasThumbnail() const noexcept;
     uint64_t getModificationTime() const noexcept;
+    // A digest of the size and the start and end of the file's
+    // content, shared by copies of the file. Empty if not known. Only
+    // kept by the local store and not sent over D-Bus.
+    const std::string& getFingerprint() const noexcept;
 
     MediaType getType() const noexcept;
     bool operator==(const MediaFile &other) const;
     bool operator!=(const MediaFile &other) const;
     MediaFile &operator=(const MediaFile &other);
-    MediaFile &operator=(MediaFile &&other);
+    MediaFile &operator=(MediaFile &&other) noexcept;
 
     // There are no setters. MediaFiles are immutable.
     // For piecewise construction use MediaFileBuilder.
@@ -129,4 +129,9 @@ MediaFileBuilder & MediaFileBuilder::setModificationTime(uint64_t t) {
     return *this;
 }
 
+MediaFileBuilder & MediaFileBuilder::setFingerprint(const std::string &f) {
+    p->fingerprint = f;
+    return *this;
+}
+
 }
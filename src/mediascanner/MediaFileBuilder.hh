@@ -39,6 +39,7 @@ struct MediaFilePrivate;
 
 class MediaFileBuilder final {
     friend class MediaFile;
+    friend class MediaFileView;
 public:
     explicit MediaFileBuilder(const std::string &filename);
     MediaFileBuilder(const MediaFile &mf);
@@ -66,6 +67,7 @@ public:
     MediaFileBuilder &setLongitude(double l);
     MediaFileBuilder &setHasThumbnail(bool t);
     MediaFileBuilder &setModificationTime(uint64_t t);
+    MediaFileBuilder &setFingerprint(const std::string &f);
 
 private:
     MediaFilePrivate *p;
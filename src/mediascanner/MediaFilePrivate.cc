@@ -54,6 +54,7 @@ bool MediaFilePrivate::operator==(const MediaFilePrivate &other) const {
         longitude == other.longitude &&
         has_thumbnail == other.has_thumbnail &&
         modification_time == other.modification_time &&
+        fingerprint == other.fingerprint &&
         type == other.type;
 }
 
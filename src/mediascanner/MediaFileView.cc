@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MediaFileView.hh"
+#include "MediaFile.hh"
+#include "MediaFileBuilder.hh"
+#include "internal/MediaFilePrivate.hh"
+#include "internal/StringPool.hh"
+#include "internal/sqliteutils.hh"
+
+namespace mediascanner {
+
+// Column order of the media queries in MediaStore.cc:
+// SELECT filename, content_type, etag, title, date, artist, album,
+//   album_artist, genre, disc_number, track_number, duration, width,
+//   height, latitude, longitude, has_thumbnail, mtime, type, fingerprint
+enum MediaColumn {
+    COL_FILENAME,
+    COL_CONTENT_TYPE,
+    COL_ETAG,
+    COL_TITLE,
+    COL_DATE,
+    COL_ARTIST,
+    COL_ALBUM,
+    COL_ALBUM_ARTIST,
+    COL_GENRE,
+    COL_DISC_NUMBER,
+    COL_TRACK_NUMBER,
+    COL_DURATION,
+    COL_WIDTH,
+    COL_HEIGHT,
+    COL_LATITUDE,
+    COL_LONGITUDE,
+    COL_HAS_THUMBNAIL,
+    COL_MTIME,
+    COL_TYPE,
+    COL_FINGERPRINT,
+};
+
+const char *MediaFileView::getFileName() const {
+    return row.getRawText(COL_FILENAME);
+}
+
+const char *MediaFileView::getContentType() const {
+    return row.getRawText(COL_CONTENT_TYPE);
+}
+
+const char *MediaFileView::getETag() const {
+    return row.getRawText(COL_ETAG);
+}
+
+const char *MediaFileView::getTitle() const {
+    return row.getRawText(COL_TITLE);
+}
+
+const char *MediaFileView::getDate() const {
+    return row.getRawText(COL_DATE);
+}
+
+const char *MediaFileView::getAuthor() const {
+    return row.getRawText(COL_ARTIST);
+}
+
+const char *MediaFileView::getAlbum() const {
+    return row.getRawText(COL_ALBUM);
+}
+
+const char *MediaFileView::getAlbumArtist() const {
+    return row.getRawText(COL_ALBUM_ARTIST);
+}
+
+const char *MediaFileView::getGenre() const {
+    return row.getRawText(COL_GENRE);
+}
+
+int MediaFileView::getDiscNumber() const {
+    return row.getInt(COL_DISC_NUMBER);
+}
+
+int MediaFileView::getTrackNumber() const {
+    return row.getInt(COL_TRACK_NUMBER);
+}
+
+int MediaFileView::getDuration() const {
+    return row.getInt(COL_DURATION);
+}
+
+int MediaFileView::getWidth() const {
+    return row.getInt(COL_WIDTH);
+}
+
+int MediaFileView::getHeight() const {
+    return row.getInt(COL_HEIGHT);
+}
+
+double MediaFileView::getLatitude() const {
+    return row.getDouble(COL_LATITUDE);
+}
+
+double MediaFileView::getLongitude() const {
+    return row.getDouble(COL_LONGITUDE);
+}
+
+bool MediaFileView::getHasThumbnail() const {
+    return row.getInt(COL_HAS_THUMBNAIL);
+}
+
+uint64_t MediaFileView::getModificationTime() const {
+    return row.getInt64(COL_MTIME);
+}
+
+MediaType MediaFileView::getType() const {
+    return (MediaType)row.getInt(COL_TYPE);
+}
+
+const char *MediaFileView::getFingerprint() const {
+    return row.getRawText(COL_FINGERPRINT);
+}
+
+MediaFile MediaFileView::toMediaFile() const {
+    return MediaFileBuilder(getFileName())
+        .setContentType(getContentType())
+        .setETag(getETag())
+        .setTitle(getTitle())
+        .setDate(getDate())
+        .setAuthor(getAuthor())
+        .setAlbum(getAlbum())
+        .setAlbumArtist(getAlbumArtist())
+        .setGenre(getGenre())
+        .setDiscNumber(getDiscNumber())
+        .setTrackNumber(getTrackNumber())
+        .setDuration(getDuration())
+        .setWidth(getWidth())
+        .setHeight(getHeight())
+        .setLatitude(getLatitude())
+        .setLongitude(getLongitude())
+        .setHasThumbnail(getHasThumbnail())
+        .setModificationTime(getModificationTime())
+        .setFingerprint(getFingerprint())
+        .setType(getType());
+}
+
+MediaFile MediaFileView::toMediaFile(StringPool &pool) const {
+    MediaFileBuilder builder(getFileName());
+    builder.setETag(getETag())
+        .setTitle(getTitle())
+        .setDate(getDate())
+        .setDiscNumber(getDiscNumber())
+        .setTrackNumber(getTrackNumber())
+        .setDuration(getDuration())
+        .setWidth(getWidth())
+        .setHeight(getHeight())
+        .setLatitude(getLatitude())
+        .setLongitude(getLongitude())
+        .setHasThumbnail(getHasThumbnail())
+        .setModificationTime(getModificationTime())
+        .setFingerprint(getFingerprint())
+        .setType(getType());
+    builder.p->content_type = pool.get(getContentType());
+    builder.p->author = pool.get(getAuthor());
+    builder.p->album = pool.get(getAlbum());
+    builder.p->album_artist = pool.get(getAlbumArtist());
+    builder.p->genre = pool.get(getGenre());
+    return MediaFile(std::move(builder));
+}
+
+}
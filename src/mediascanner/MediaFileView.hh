@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIAFILEVIEW_HH
+#define MEDIAFILEVIEW_HH
+
+#include "scannercore.hh"
+#include <cstdint>
+#include <functional>
+
+namespace mediascanner {
+
+class MediaFile;
+class Statement;
+class StringPool;
+
+/**
+ * A media file as a row of a query result, read without copying it.
+ * Strings point into the buffers of the database library and, like
+ * the view itself, are only valid until the visitor it was passed to
+ * returns. Use toMediaFile() to keep a file.
+ */
+class MediaFileView final {
+public:
+    explicit MediaFileView(Statement &row) : row(row) {}
+
+    MediaFileView(const MediaFileView &other) = delete;
+    MediaFileView& operator=(const MediaFileView &other) = delete;
+
+    const char *getFileName() const;
+    const char *getContentType() const;
+    const char *getETag() const;
+    const char *getTitle() const;
+    const char *getDate() const;
+    const char *getAuthor() const;
+    const char *getAlbum() const;
+    const char *getAlbumArtist() const;
+    const char *getGenre() const;
+
+    int getDiscNumber() const;
+    int getTrackNumber() const;
+    int getDuration() const;
+    int getWidth() const;
+    int getHeight() const;
+    double getLatitude() const;
+    double getLongitude() const;
+    bool getHasThumbnail() const;
+    uint64_t getModificationTime() const;
+    MediaType getType() const;
+    const char *getFingerprint() const;
+
+    MediaFile toMediaFile() const;
+    // As above, but artist, album, genre and content type strings
+    // equal to those of earlier files from the same pool are shared.
+    MediaFile toMediaFile(StringPool &pool) const;
+
+private:
+    Statement &row;
+};
+
+// Called for each file of a result. Returning false stops the query.
+typedef std::function<bool(const MediaFileView &file)> MediaVisitor;
+
+}
+
+#endif
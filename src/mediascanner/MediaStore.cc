@@ -19,15 +19,26 @@
 
 #include "MediaStore.hh"
 
+#include <dirent.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <cassert>
 #include <cerrno>
 #include <cstdint>
+#include <cstdio>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <iterator>
+#include <memory>
 #include <stdexcept>
 #include <mutex>
-#include <sstream>
 #include <map>
+#include <thread>
+#include <unordered_set>
 
 #include <glib.h>
 #include <sqlite3.h>
@@ -35,8 +46,13 @@
 #include "mozilla/fts3_tokenizer.h"
 #include "MediaFile.hh"
 #include "MediaFileBuilder.hh"
+#include "MediaFileView.hh"
 #include "Album.hh"
 #include "Filter.hh"
+#include "internal/ETagIndex.hh"
+#include "internal/FTS5Tokenizer.hh"
+#include "internal/ResultCache.hh"
+#include "internal/StringPool.hh"
 #include "internal/sqliteutils.hh"
 #include "internal/utils.hh"
 
@@ -44,45 +60,333 @@ using namespace std;
 
 namespace mediascanner {
 
-// Increment this whenever changing db schema.
-// It will cause dbstore to rebuild its tables.
-static const int schemaVersion = 10;
+// Increment this whenever changing db schema, and add a step to
+// migrations below. Without one, opening an older database rebuilds
+// its tables and all media has to be scanned again.
+static const int schemaVersion = 18;
+
+// A database connection and the queries that only read from it.
+// Used both for the main connection and for pooled read connections.
+struct MediaStoreConnection {
+    sqlite3 *db = nullptr;
+    // Prepared statements are reused rather than being prepared
+    // for every call.
+    mutable StatementCache stmt_cache;
+    // Whether media_fts is an FTS5 rather than an FTS4 table.
+    bool fts5 = false;
+    // Whether media_location indexes the located media. It is left
+    // out when SQLite was built without the R*Tree module.
+    bool spatial = false;
+    // Whether any volume was offline when online_filter() last looked,
+    // and the store's MediaStorePrivate::volumes count at the time.
+    const std::atomic<uint64_t> *volumes_generation = nullptr;
+    mutable uint64_t volumes_checked = 0;
+    mutable bool any_offline = false;
+
+    MediaStoreConnection() = default;
+    MediaStoreConnection(const MediaStoreConnection &other) = delete;
+    MediaStoreConnection& operator=(const MediaStoreConnection &other) = delete;
+    ~MediaStoreConnection();
+
+    std::string match_term(const std::string &term) const;
+    const char *rank_expression() const;
+    const char *online_filter() const;
 
-struct MediaStorePrivate {
-    sqlite3 *db;
-    // https://www.sqlite.org/cvstrac/wiki?p=DatabaseIsLocked
-    // http://sqlite.com/faq.html#q6
-    std::mutex dbMutex;
-
-    void insert(const MediaFile &m) const;
-    void remove(const std::string &fname) const;
-    void insert_broken_file(const std::string &fname, const std::string &etag) const;
-    void remove_broken_file(const std::string &fname) const;
     bool is_broken_file(const std::string &fname, const std::string &etag) const;
     MediaFile lookup(const std::string &filename) const;
     std::vector<MediaFile> query(const std::string &q, MediaType type, const Filter &filter) const;
+    void query(const std::string &q, MediaType type, const Filter &filter, const MediaVisitor &visit) const;
+    std::vector<MediaFile> queryRegion(const BoundingBox &region, MediaType type, const Filter &filter) const;
+    void select_media(const std::string &core_term, const BoundingBox *region, MediaType type, const Filter &filter, const MediaVisitor &visit) const;
     std::vector<Album> queryAlbums(const std::string &core_term, const Filter &filter) const;
     std::vector<string> queryArtists(const std::string &q, const Filter &filter) const;
     std::vector<MediaFile> getAlbumSongs(const Album& album) const;
     std::string getETag(const std::string &filename) const;
     std::vector<MediaFile> listSongs(const Filter &filter) const;
+    void listSongs(const Filter &filter, const MediaVisitor &visit) const;
     std::vector<Album> listAlbums(const Filter &filter) const;
     std::vector<std::string> listArtists(const Filter &filter) const;
     std::vector<std::string> listAlbumArtists(const Filter &filter) const;
     std::vector<std::string> listGenres(const Filter &filter) const;
     bool hasMedia(MediaType type) const;
-
+    size_t count(MediaType type, const Filter &filter) const;
+    Facets facets(const Filter &filter) const;
+    std::vector<MediaFile> listDateRange(MediaType type, int64_t start, int64_t end, const Filter &filter) const;
+    std::vector<DateCount> countByDate(MediaType type, DateBucket bucket, int64_t start, int64_t end) const;
+    std::vector<std::vector<MediaFile>> listDuplicates(MediaType type, const Filter &filter) const;
+    std::vector<MediaFile> lookupFingerprint(const std::string &fingerprint) const;
+    MediaChanges changesSince(MediaType type, uint64_t sequence) const;
     size_t size() const;
+};
+
+class ReadLease;
+
+struct MediaStorePrivate : public MediaStoreConnection {
+    // https://www.sqlite.org/cvstrac/wiki?p=DatabaseIsLocked
+    // http://sqlite.com/faq.html#q6
+    std::mutex dbMutex;
+    // Set while a MediaStoreTransaction is open. Reads then go through
+    // the main connection so they see the uncommitted changes.
+    std::atomic<bool> in_transaction{false};
+    // While set, the triggers leave media_fts alone. Protected by dbMutex.
+    bool fts_deferred = false;
+
+    // Etags and broken file state of the files below one directory,
+    // kept in step with every write. Protected by indexMutex.
+    mutable ETagIndex etag_index;
+    mutable std::mutex indexMutex;
+
+    // Read only connections, so that queries can run in parallel
+    // with each other and with the writer.
+    std::vector<std::unique_ptr<MediaStoreConnection>> readers;
+    std::vector<MediaStoreConnection*> idle_readers;
+    std::mutex readerMutex;
+    std::condition_variable readerAvailable;
+
+    // Results of recent queries, or null if disabled. Entries are
+    // stamped with the write generation, which every change made
+    // through this store bumps once it is visible to readers. Read
+    // only stores also bump it when PRAGMA data_version shows a
+    // commit by another process; data_version is protected by dbMutex.
+    std::unique_ptr<ResultCache> result_cache;
+    mutable std::atomic<uint64_t> write_generation{0};
+    bool read_only = false;
+    int64_t data_version = -1;
+    // Bumped whenever offline_volumes may have changed, so connections
+    // look at it again. Starts above volumes_checked.
+    std::atomic<uint64_t> volumes{1};
+
+    // sqlite3_total_changes() when the open transaction began, to tell
+    // whether rolling it back undoes anything.
+    int changes_at_begin = 0;
+
+    // Durability of commits normally and during a bulk load.
+    SyncLevel synchronous = SyncLevel::Full;
+    SyncLevel bulk_synchronous = SyncLevel::Full;
+
+    // Queries started by runAsync() that have not finished. Their
+    // results may outlive the store, so it cancels them and waits for
+    // them before going away. Protected by asyncMutex.
+    std::unordered_set<std::shared_ptr<AsyncQuery>> async_queries;
+    std::mutex asyncMutex;
+    std::condition_variable asyncFinished;
+
+    ~MediaStorePrivate();
+
+    ReadLease reader();
+    ReadLease lease();
+    void releaseReader(MediaStoreConnection *conn);
+
+    void changed() const { write_generation++; }
+    void volumesChanged() { volumes++; }
+    uint64_t generation();
+    template <typename T, typename Query>
+    std::vector<T> cached(char method, const std::string &term, MediaType type,
+                          const Filter &filter, Query run);
+    template <typename T, typename Query>
+    AsyncResult<T> runAsync(Query run);
+
+    int64_t intern(const char *table, const std::string &name) const;
+    void bind_media(Statement &query, int offset, const MediaFile &m) const;
+    void pruneDictionaries() const;
+    void pruneChanges() const;
+
+    void insert(const MediaFile &m) const;
+    void insertBatch(std::vector<MediaFile> &&files);
+    void remove(const std::string &fname) const;
+    void insert_broken_file(const std::string &fname, const std::string &etag) const;
+    void remove_broken_file(const std::string &fname) const;
+
     void pruneDeleted();
     void archiveItems(const std::string &prefix);
     void restoreItems(const std::string &prefix);
     void removeSubtree(const std::string &directory);
+    bool runMaintenance(int milliseconds);
+    bool enableIncrementalVacuum();
+    int64_t pragma(const char *name) const;
+    void loadETagIndex(const std::string &prefix);
+    void dropETagIndex();
 
     void begin();
     void commit();
     void rollback();
 };
 
+// A connection checked out for a read query: either a pooled read
+// connection, or the main connection with the store lock held.
+class ReadLease final {
+public:
+    ReadLease(MediaStorePrivate *p, std::unique_lock<std::mutex> &&lock)
+        : p(p), conn(p), lock(std::move(lock)) {}
+    ReadLease(MediaStorePrivate *p, MediaStoreConnection *conn)
+        : p(p), conn(conn) {}
+    ReadLease(ReadLease &&other)
+        : p(other.p), conn(other.conn), lock(std::move(other.lock)) {
+        other.conn = nullptr;
+    }
+    ~ReadLease() {
+        if (conn != nullptr && !lock.owns_lock()) {
+            p->releaseReader(conn);
+        }
+    }
+    ReadLease(const ReadLease &other) = delete;
+    ReadLease& operator=(const ReadLease &other) = delete;
+
+    const MediaStoreConnection *operator->() const { return conn; }
+    const MediaStoreConnection &operator*() const { return *conn; }
+
+private:
+    MediaStorePrivate *p;
+    MediaStoreConnection *conn;
+    std::unique_lock<std::mutex> lock;
+};
+
+// Read only stores first check for commits by other processes, as
+// they may have taken volumes offline.
+ReadLease MediaStorePrivate::reader() {
+    if (read_only) {
+        generation();
+    }
+    return lease();
+}
+
+ReadLease MediaStorePrivate::lease() {
+    if (readers.empty() || in_transaction) {
+        return ReadLease(this, std::unique_lock<std::mutex>(dbMutex));
+    }
+    std::unique_lock<std::mutex> lock(readerMutex);
+    readerAvailable.wait(lock, [this]() { return !idle_readers.empty(); });
+    MediaStoreConnection *conn = idle_readers.back();
+    idle_readers.pop_back();
+    return ReadLease(this, conn);
+}
+
+void MediaStorePrivate::releaseReader(MediaStoreConnection *conn) {
+    {
+        std::lock_guard<std::mutex> lock(readerMutex);
+        idle_readers.push_back(conn);
+    }
+    readerAvailable.notify_one();
+}
+
+uint64_t MediaStorePrivate::generation() {
+    if (read_only) {
+        std::lock_guard<std::mutex> lock(dbMutex);
+        Statement query(db, stmt_cache, "PRAGMA data_version");
+        query.step();
+        const int64_t version = query.getInt64(0);
+        if (version != data_version) {
+            data_version = version;
+            changed();
+            volumesChanged();
+        }
+    }
+    return write_generation;
+}
+
+// Runs a query, or returns its result from the cache if the store has
+// not changed since it last ran with the same arguments.
+template <typename T, typename Query>
+std::vector<T> MediaStorePrivate::cached(char method, const std::string &term, MediaType type,
+                                         const Filter &filter, Query run) {
+    if (!result_cache) {
+        return run(*reader());
+    }
+    auto optional = [](bool has, const std::string &value) {
+        return has ? "+" + value : std::string("-");
+    };
+    const std::string key = encodeCursor(method, {
+        term, std::to_string((int)type),
+        optional(filter.hasArtist(), filter.getArtist()),
+        optional(filter.hasAlbum(), filter.getAlbum()),
+        optional(filter.hasAlbumArtist(), filter.getAlbumArtist()),
+        optional(filter.hasGenre(), filter.getGenre()),
+        optional(filter.hasCursor(), filter.getCursor()),
+        std::to_string(filter.getOffset()), std::to_string(filter.getLimit()),
+        std::to_string((int)filter.getOrder()), filter.getReverse() ? "1" : "0",
+        std::to_string(filter.getFields())});
+    // Read before running the query, so a change made meanwhile
+    // leaves the result stamped as out of date.
+    const uint64_t gen = generation();
+    std::vector<T> result;
+    if (result_cache->get(key, gen, result)) {
+        return result;
+    }
+    result = run(*lease());
+    result_cache->put(key, gen, result);
+    return result;
+}
+
+// SQLite virtual machine instructions between checks for a cancelled
+// query, a fraction of a millisecond's work.
+static const int CANCEL_CHECK_STEPS = 1000;
+
+static int check_cancelled(void *arg) {
+    return static_cast<AsyncQuery*>(arg)->isCancelled() ? 1 : 0;
+}
+
+// Runs a query on a reader connection in the background. Cancelling
+// interrupts the statement at once, and the progress handler stops
+// any statement that starts after that.
+template <typename T, typename Query>
+AsyncResult<T> MediaStorePrivate::runAsync(Query run) {
+    auto state = std::make_shared<AsyncQuery>();
+    {
+        std::lock_guard<std::mutex> lock(asyncMutex);
+        async_queries.insert(state);
+    }
+    auto future = std::async(std::launch::async, [this, state, run]() -> T {
+        // Declared first so that it runs last, once the connection is
+        // back in the pool.
+        struct Finished {
+            MediaStorePrivate *p;
+            const std::shared_ptr<AsyncQuery> &state;
+            ~Finished() {
+                std::lock_guard<std::mutex> lock(p->asyncMutex);
+                p->async_queries.erase(state);
+                p->asyncFinished.notify_all();
+            }
+        } finished{this, state};
+        if (state->isCancelled()) {
+            throw QueryCancelled();
+        }
+        ReadLease conn = reader();
+        sqlite3 *db = conn->db;
+        sqlite3_progress_handler(db, CANCEL_CHECK_STEPS, check_cancelled, state.get());
+        state->setInterrupt([db]() { sqlite3_interrupt(db); });
+        auto done = [state, db]() {
+            state->clearInterrupt();
+            sqlite3_progress_handler(db, 0, nullptr, nullptr);
+        };
+        try {
+            T result = run(*conn);
+            done();
+            return result;
+        } catch (...) {
+            done();
+            if (state->isCancelled()) {
+                throw QueryCancelled();
+            }
+            throw;
+        }
+    });
+    return AsyncResult<T>(std::move(future), state);
+}
+
+MediaStorePrivate::~MediaStorePrivate() {
+    std::unique_lock<std::mutex> lock(asyncMutex);
+    for (const auto &query : async_queries) {
+        query->cancel();
+    }
+    asyncFinished.wait(lock, [this]() { return async_queries.empty(); });
+}
+
+MediaStoreConnection::~MediaStoreConnection() {
+    // All statements must be finalized before the db can be closed.
+    stmt_cache.clear();
+    sqlite3_close(db);
+}
+
 extern "C" void sqlite3Fts3PorterTokenizerModule(
     sqlite3_tokenizer_module const**ppModule);
 
@@ -149,116 +453,34 @@ wrong_number_args:
     sqlite3_result_error(pCtx, "wrong number of arguments to function rank()", -1);
 }
 
-struct FirstContext {
-    int type;
-    union {
-        int i;
-        double f;
-        struct {
-            void *blob;
-            int length;
-        } b;
-    } data;
-};
-
-static void first_step(sqlite3_context *ctx, int /*argc*/, sqlite3_value **argv) {
-    FirstContext *d = static_cast<FirstContext*>(sqlite3_aggregate_context(ctx, sizeof(FirstContext*)));
-    if (d->type != 0) {
-        return;
-    }
-    sqlite3_value *arg = argv[0];
-    d->type = sqlite3_value_type(arg);
-    switch (d->type) {
-    case SQLITE_INTEGER:
-        d->data.i = sqlite3_value_int(arg);
-        break;
-    case SQLITE_FLOAT:
-        d->data.f = sqlite3_value_double(arg);
-        break;
-    case SQLITE_NULL:
-        break;
-    case SQLITE_TEXT:
-        d->data.b.length = sqlite3_value_bytes(arg);
-        d->data.b.blob = malloc(d->data.b.length);
-        memcpy(d->data.b.blob, sqlite3_value_text(arg), d->data.b.length);
-        break;
-    case SQLITE_BLOB:
-        d->data.b.length = sqlite3_value_bytes(arg);
-        d->data.b.blob = malloc(d->data.b.length);
-        memcpy(d->data.b.blob, sqlite3_value_blob(arg), d->data.b.length);
-        break;
-    default:
-        sqlite3_result_error(ctx, "Unhandled data type", -1);
-        sqlite3_result_error_code(ctx, SQLITE_MISMATCH);
-    }
+static void to_epoch_func(sqlite3_context *context, int, sqlite3_value **argv) {
+    const char *date = reinterpret_cast<const char*>(sqlite3_value_text(argv[0]));
+    sqlite3_result_int64(context, dateToEpoch(date ? date : ""));
 }
 
-static void first_finalize(sqlite3_context *ctx) {
-    FirstContext *d = static_cast<FirstContext*>(sqlite3_aggregate_context(ctx, 0));
-    if (d == nullptr) {
-        sqlite3_result_null(ctx);
-        return;
-    }
-    switch (d->type) {
-    case SQLITE_INTEGER:
-        sqlite3_result_int(ctx, d->data.i);
-        break;
-    case SQLITE_FLOAT:
-        sqlite3_result_double(ctx, d->data.f);
-        break;
-    case SQLITE_NULL:
-        sqlite3_result_null(ctx);
-        break;
-    case SQLITE_TEXT:
-        sqlite3_result_text(ctx, reinterpret_cast<char*>(d->data.b.blob),
-                            d->data.b.length, free);
-        d->data.b.blob = nullptr;
-        break;
-    case SQLITE_BLOB:
-        sqlite3_result_blob(ctx, d->data.b.blob, d->data.b.length, free);
-        d->data.b.blob = nullptr;
-        break;
-    default:
-        sqlite3_result_error(ctx, "Unhandled data type", -1);
-        sqlite3_result_error_code(ctx, SQLITE_MISMATCH);
-    }
-}
-
-static bool has_block_in_path(std::map<std::string, bool> &cache, const std::string &filename) {
-    std::vector<std::string> path_segments;
-    std::istringstream f(filename);
-    std::string s;
-    while (std::getline(f, s, '/')) {
-        path_segments.push_back(s);
-    }
-    path_segments.pop_back();
-    std::string trial_path;
-    for(const auto &seg : path_segments) {
-        if(trial_path != "/")
-            trial_path += "/";
-        trial_path += seg;
-        auto r = cache.find(trial_path);
-        if(r != cache.end() && r->second) {
-            return true;
-        }
-        if(has_scanblock(trial_path)) {
-            cache[trial_path] = true;
-            return true;
-        } else {
-            cache[trial_path] = false;
-        }
-    }
-    return false;
+static void fts_deferred_func(sqlite3_context *context, int, sqlite3_value **) {
+    const bool *deferred = static_cast<const bool*>(sqlite3_user_data(context));
+    sqlite3_result_int(context, deferred != nullptr && *deferred);
 }
 
-static void register_functions(sqlite3 *db) {
+// fts_deferred() tells the FTS triggers to skip their work because
+// the caller will update media_fts itself. It returns the value
+// pointed to by deferred, or false if it is null. to_epoch(date)
+// fills in date_epoch where rows are copied in SQL.
+static void register_functions(sqlite3 *db, const bool *deferred=nullptr) {
     if (sqlite3_create_function(db, "rank", -1, SQLITE_ANY, nullptr,
                                 rankfunc, nullptr, nullptr) != SQLITE_OK) {
         throw runtime_error(sqlite3_errmsg(db));
     }
 
-    if (sqlite3_create_function(db, "first", 1, SQLITE_ANY, nullptr,
-                                nullptr, first_step, first_finalize) != SQLITE_OK) {
+    if (sqlite3_create_function(db, "to_epoch", 1, SQLITE_UTF8 | SQLITE_DETERMINISTIC, nullptr,
+                                to_epoch_func, nullptr, nullptr) != SQLITE_OK) {
+        throw runtime_error(sqlite3_errmsg(db));
+    }
+
+    if (sqlite3_create_function(db, "fts_deferred", 0, SQLITE_ANY,
+                                const_cast<bool*>(deferred),
+                                fts_deferred_func, nullptr, nullptr) != SQLITE_OK) {
         throw runtime_error(sqlite3_errmsg(db));
     }
 }
@@ -287,27 +509,115 @@ void deleteTables(sqlite3 *db) {
 DROP TABLE IF EXISTS media;
 DROP TABLE IF EXISTS media_fts;
 DROP TABLE IF EXISTS media_attic;
+DROP TABLE IF EXISTS offline_volumes;
 DROP TABLE IF EXISTS schemaVersion;
 DROP TABLE IF EXISTS broken_files;
+DROP TABLE IF EXISTS albums;
+DROP TABLE IF EXISTS artists;
+DROP TABLE IF EXISTS genres;
+DROP TABLE IF EXISTS media_changes;
+DROP TABLE IF EXISTS media_changes_pruned;
+DROP TABLE IF EXISTS media_location;
 )");
     execute_sql(db, deleteCmd);
 }
 
-void createTables(sqlite3 *db) {
-    string schema(R"(
-CREATE TABLE schemaVersion (version INTEGER);
+// Trigger statements that add the song in row ("new" or "old") to
+// its album. The date, genre and art of an album come from its song
+// with the lowest file name.
+static string album_add_sql(const string &row) {
+    const string album = "album = " + row + ".album AND album_artist = " + row + ".album_artist";
+    // No INSERT OR IGNORE here: the conflict clause of the statement
+    // firing the trigger (INSERT OR REPLACE) would override it.
+    return R"(
+  INSERT INTO albums (album, album_artist, filename, song_count, mtime)
+    SELECT )" + row + ".album, " + row + ".album_artist, " + row + ".filename, 0, " + row + R"(.mtime
+    WHERE NOT EXISTS (SELECT 1 FROM albums WHERE )" + album + R"();
+  UPDATE albums SET song_count = song_count + 1, mtime = max(mtime, )" + row + R"(.mtime)
+    WHERE )" + album + R"(;
+  UPDATE albums SET date = )" + row + ".date, genre = " + row + ".genre, filename = " + row + ".filename, has_thumbnail = " + row + R"(.has_thumbnail
+    WHERE )" + album + " AND filename >= " + row + R"(.filename;
+)";
+}
 
-CREATE TABLE media (
+// Trigger statements that remove the song in row from its album.
+static string album_remove_sql(const string &row) {
+    const string album = "album = " + row + ".album AND album_artist = " + row + ".album_artist";
+    const string songs = "FROM media WHERE type = 1 AND " + album;
+    return R"(
+  UPDATE albums SET song_count = song_count - 1 WHERE )" + album + R"(;
+  DELETE FROM albums WHERE )" + album + R"( AND song_count <= 0;
+  UPDATE albums SET
+      mtime = (SELECT max(mtime) )" + songs + R"(),
+      filename = (SELECT min(filename) )" + songs + R"()
+    WHERE )" + album + R"(;
+  UPDATE albums SET
+      date = (SELECT date FROM media WHERE filename = albums.filename),
+      genre = (SELECT genre FROM media WHERE filename = albums.filename),
+      has_thumbnail = (SELECT has_thumbnail FROM media WHERE filename = albums.filename)
+    WHERE )" + album + " AND filename > " + row + R"(.filename;
+)";
+}
+
+// One row per album of the songs in media, kept up to date by
+// triggers so that listing albums doesn't need to group all songs.
+static string albums_schema() {
+    return R"(
+CREATE TABLE albums (
+    album TEXT NOT NULL,
+    album_artist TEXT NOT NULL,
+    date TEXT,
+    genre TEXT,
+    filename TEXT,       -- Song the album art is taken from
+    has_thumbnail INTEGER,
+    song_count INTEGER NOT NULL,
+    mtime INTEGER,       -- Latest modification time of the songs
+    PRIMARY KEY (album_artist, album)
+) WITHOUT ROWID;
+
+CREATE INDEX albums_album_idx ON albums(album, album_artist);
+CREATE INDEX albums_mtime_idx ON albums(mtime);
+
+CREATE TRIGGER albums_ai AFTER INSERT ON media WHEN new.type = 1 BEGIN)" + album_add_sql("new") + R"(END;
+
+CREATE TRIGGER albums_ad AFTER DELETE ON media WHEN old.type = 1 BEGIN)" + album_remove_sql("old") + R"(END;
+
+CREATE TRIGGER albums_au_old AFTER UPDATE ON media WHEN old.type = 1 BEGIN)" + album_remove_sql("old") + R"(END;
+
+CREATE TRIGGER albums_au_new AFTER UPDATE ON media WHEN new.type = 1 BEGIN)" + album_add_sql("new") + R"(END;
+)";
+}
+
+// Distinct artist names (of both songs and albums) and genres,
+// referenced by id from media and media_attic. Listing artists and
+// genres walks these instead of grouping the media table by name.
+static const char *dictionary_schema = R"(
+CREATE TABLE artists (
     id INTEGER PRIMARY KEY,
-    filename TEXT UNIQUE NOT NULL CHECK (filename LIKE '/%'),
+    name TEXT UNIQUE NOT NULL
+);
+
+CREATE TABLE genres (
+    id INTEGER PRIMARY KEY,
+    name TEXT UNIQUE NOT NULL
+);
+
+CREATE INDEX media_artist_idx ON media(artist_id, type, genre_id);
+CREATE INDEX media_album_artist_idx ON media(album_artist_id, type, genre_id);
+CREATE INDEX media_genre_idx ON media(genre_id, type);
+)";
+
+// Files of unmounted volumes, as archived by versions before
+// offline_volumes. restoreItems() still moves them back into media.
+// Artists and genre are only kept as dictionary ids.
+static const char *attic_schema = R"(
+CREATE TABLE media_attic (
+    filename TEXT UNIQUE NOT NULL,
     content_type TEXT,
     etag TEXT,
     title TEXT,
     date TEXT,
-    artist TEXT,          -- Only relevant to audio
     album TEXT,           -- Only relevant to audio
-    album_artist TEXT,    -- Only relevant to audio
-    genre TEXT,           -- Only relevant to audio
     disc_number INTEGER,  -- Only relevant to audio
     track_number INTEGER, -- Only relevant to audio
     duration INTEGER,
@@ -315,19 +625,311 @@ CREATE TABLE media (
     height INTEGER,       -- Only relevant to video/images
     latitude DOUBLE,
     longitude DOUBLE,
-    has_thumbnail INTEGER CHECK (has_thumbnail IN (0, 1)),
+    has_thumbnail INTEGER,
     mtime INTEGER,
-    type INTEGER CHECK (type IN (1, 2, 3)) -- MediaType enum
+    type INTEGER,         -- 0=Audio, 1=Video
+    artist_id INTEGER,
+    album_artist_id INTEGER,
+    genre_id INTEGER
 );
+)";
 
-CREATE INDEX media_type_idx ON media(type);
-CREATE INDEX media_song_info_idx ON media(type, album_artist, album, disc_number, track_number, title) WHERE type = 1;
-CREATE INDEX media_artist_idx ON media(type, artist) WHERE type = 1;
-CREATE INDEX media_genre_idx ON media(type, genre) WHERE type = 1;
-CREATE INDEX media_mtime_idx ON media(type, mtime);
+// Volumes that are not mounted, as ranges of file names. Their files
+// stay in media, so unmounting and remounting a volume only adds or
+// removes a row here, but queries leave them out.
+static const char *offline_schema = R"(
+CREATE TABLE offline_volumes (
+    prefix TEXT PRIMARY KEY NOT NULL,
+    prefix_end TEXT       -- prefixEnd(prefix) unless split by restoreItems(), NULL if unbounded
+) WITHOUT ROWID;
+)";
 
-CREATE TABLE media_attic (
+// The change journal: the latest change to each file, numbered in
+// the order they were made, for clients to sync incrementally. A
+// replaced row fires the delete trigger first, so an insert right
+// after a removal of the same file records a modification. Entries
+// of removed files get pruned; media_changes_pruned holds the highest
+// sequence number dropped that way.
+static const char *changes_schema = R"(
+CREATE TABLE media_changes (
+    seq INTEGER PRIMARY KEY AUTOINCREMENT,
     filename TEXT UNIQUE NOT NULL,
+    change INTEGER NOT NULL, -- ChangeType enum
+    type INTEGER             -- MediaType enum
+);
+
+CREATE TABLE media_changes_pruned (seq INTEGER NOT NULL);
+INSERT INTO media_changes_pruned (seq) VALUES (0);
+)";
+
+// The triggers filling in media_changes. Schema upgrades run without
+// them, so backfilling a new column does not journal every file as
+// modified.
+static const char *changes_triggers = R"(
+CREATE TRIGGER media_changes_ai AFTER INSERT ON media BEGIN
+  INSERT OR REPLACE INTO media_changes (filename, change, type)
+    SELECT new.filename,
+        CASE WHEN EXISTS (SELECT 1 FROM media_changes WHERE filename = new.filename AND change = 2
+                            AND seq = (SELECT max(seq) FROM media_changes))
+          THEN 1 ELSE 0 END,
+        new.type;
+END;
+
+CREATE TRIGGER media_changes_au AFTER UPDATE ON media BEGIN
+  INSERT OR REPLACE INTO media_changes (filename, change, type) VALUES (new.filename, 1, new.type);
+END;
+
+CREATE TRIGGER media_changes_ad AFTER DELETE ON media BEGIN
+  INSERT OR REPLACE INTO media_changes (filename, change, type) VALUES (old.filename, 2, old.type);
+END;
+)";
+
+// Spatial index of the geotagged media, by media.id, for queryRegion().
+// Files at exactly 0, 0 are taken to have no location, as that is
+// what the extractors store for them.
+static string has_location(const string &row) {
+    return row + ".latitude IS NOT NULL AND " + row + ".longitude IS NOT NULL AND (" +
+        row + ".latitude <> 0 OR " + row + ".longitude <> 0)";
+}
+
+// Whether SQLite has the R*Tree module that media_location needs.
+static bool has_rtree(sqlite3 *db) {
+    if (sqlite3_exec(db, "CREATE VIRTUAL TABLE temp.rtree_probe USING rtree(id, min, max)",
+                     nullptr, nullptr, nullptr) != SQLITE_OK) {
+        return false;
+    }
+    execute_sql(db, "DROP TABLE temp.rtree_probe");
+    return true;
+}
+
+static bool uses_rtree(sqlite3 *db) {
+    Statement query(db, "SELECT 1 FROM sqlite_master WHERE name = 'media_location'");
+    return query.step();
+}
+
+static string location_schema() {
+    return R"(
+CREATE VIRTUAL TABLE media_location USING rtree(id, min_lat, max_lat, min_lon, max_lon);
+
+CREATE TRIGGER media_location_ai AFTER INSERT ON media WHEN )" + has_location("new") + R"( BEGIN
+  INSERT INTO media_location VALUES (new.id, new.latitude, new.latitude, new.longitude, new.longitude);
+END;
+
+CREATE TRIGGER media_location_au AFTER UPDATE OF id, latitude, longitude ON media BEGIN
+  DELETE FROM media_location WHERE id = old.id;
+  INSERT INTO media_location SELECT new.id, new.latitude, new.latitude, new.longitude, new.longitude
+    WHERE )" + has_location("new") + R"(;
+END;
+
+CREATE TRIGGER media_location_ad AFTER DELETE ON media BEGIN
+  DELETE FROM media_location WHERE id = old.id;
+END;
+)";
+}
+
+// Keep media_fts in step with media, unless insertBatch() has
+// deferred that to rebuilding the index at the end.
+static const char *fts_triggers = R"(
+CREATE TRIGGER media_bu BEFORE UPDATE ON media WHEN NOT fts_deferred() BEGIN
+  DELETE FROM media_fts WHERE rowid=old.id;
+END;
+
+CREATE TRIGGER media_au AFTER UPDATE ON media WHEN NOT fts_deferred() BEGIN
+  INSERT INTO media_fts(rowid, title, artist, album) VALUES (new.id, new.title, new.artist, new.album);
+END;
+
+CREATE TRIGGER media_bd BEFORE DELETE ON media WHEN NOT fts_deferred() BEGIN
+  DELETE FROM media_fts WHERE rowid=old.id;
+END;
+
+CREATE TRIGGER media_ai AFTER INSERT ON media WHEN NOT fts_deferred() BEGIN
+  INSERT INTO media_fts(rowid, title, artist, album) VALUES (new.id, new.title, new.artist, new.album);
+END;
+)";
+
+static void upgrade_to_11(sqlite3 *db) {
+    execute_sql(db, R"(
+DROP TRIGGER media_bu;
+DROP TRIGGER media_au;
+DROP TRIGGER media_bd;
+DROP TRIGGER media_ai;
+)");
+    execute_sql(db, fts_triggers);
+}
+
+static void upgrade_to_12(sqlite3 *db) {
+    execute_sql(db, albums_schema());
+    execute_sql(db, R"(
+INSERT INTO albums (album, album_artist, filename, song_count, mtime)
+  SELECT album, album_artist, min(filename), count(*), max(mtime) FROM media
+    WHERE type = 1 GROUP BY album, album_artist;
+UPDATE albums SET
+    date = (SELECT date FROM media WHERE filename = albums.filename),
+    genre = (SELECT genre FROM media WHERE filename = albums.filename),
+    has_thumbnail = (SELECT has_thumbnail FROM media WHERE filename = albums.filename);
+)");
+}
+
+static void upgrade_to_13(sqlite3 *db) {
+    execute_sql(db, R"(
+DROP INDEX media_artist_idx;
+DROP INDEX media_genre_idx;
+ALTER TABLE media ADD COLUMN artist_id INTEGER;
+ALTER TABLE media ADD COLUMN album_artist_id INTEGER;
+ALTER TABLE media ADD COLUMN genre_id INTEGER;
+ALTER TABLE media_attic RENAME TO media_attic_old;
+)");
+    execute_sql(db, dictionary_schema);
+    execute_sql(db, attic_schema);
+    execute_sql(db, R"(
+INSERT INTO artists (name)
+  SELECT name FROM (
+    SELECT artist AS name FROM media UNION SELECT album_artist FROM media UNION
+    SELECT artist FROM media_attic_old UNION SELECT album_artist FROM media_attic_old)
+  WHERE name IS NOT NULL;
+INSERT INTO genres (name)
+  SELECT name FROM (SELECT genre AS name FROM media UNION SELECT genre FROM media_attic_old)
+  WHERE name IS NOT NULL;
+UPDATE media SET
+    artist_id = (SELECT id FROM artists WHERE name = media.artist),
+    album_artist_id = (SELECT id FROM artists WHERE name = media.album_artist),
+    genre_id = (SELECT id FROM genres WHERE name = media.genre);
+INSERT INTO media_attic (filename, content_type, etag, title, date, album, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type, artist_id, album_artist_id, genre_id)
+  SELECT filename, content_type, etag, title, date, album, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type,
+      (SELECT id FROM artists WHERE name = attic.artist),
+      (SELECT id FROM artists WHERE name = attic.album_artist),
+      (SELECT id FROM genres WHERE name = attic.genre)
+    FROM media_attic_old AS attic;
+DROP TABLE media_attic_old;
+)");
+}
+
+static void upgrade_to_14(sqlite3 *db) {
+    execute_sql(db, offline_schema);
+}
+
+static void upgrade_to_15(sqlite3 *db) {
+    execute_sql(db, changes_schema);
+}
+
+static void upgrade_to_16(sqlite3 *db) {
+    if (!has_rtree(db)) {
+        return;
+    }
+    execute_sql(db, location_schema());
+    execute_sql(db, R"(
+INSERT INTO media_location
+  SELECT id, latitude, latitude, longitude, longitude FROM media
+    WHERE )" + has_location("media") + ";");
+}
+
+static void upgrade_to_17(sqlite3 *db) {
+    execute_sql(db, R"(
+ALTER TABLE media ADD COLUMN date_epoch INTEGER;
+UPDATE media SET date_epoch = to_epoch(date);
+CREATE INDEX media_date_idx ON media(type, date_epoch);
+)");
+}
+
+static void upgrade_to_18(sqlite3 *db) {
+    execute_sql(db, R"(
+ALTER TABLE media ADD COLUMN fingerprint TEXT;
+CREATE INDEX media_fingerprint_idx ON media(fingerprint) WHERE fingerprint IS NOT NULL;
+)");
+}
+
+// A step turning a database of schema version into version + 1,
+// preferably by altering tables in place so the media needs no
+// rescan.
+struct Migration {
+    int version;
+    void (*upgrade)(sqlite3 *db);
+};
+
+// Ordered by version, without gaps, the last one upgrading to
+// schemaVersion. Databases older than the first step get rebuilt.
+static constexpr Migration migrations[] = {
+    {10, upgrade_to_11},
+    {11, upgrade_to_12},
+    {12, upgrade_to_13},
+    {13, upgrade_to_14},
+    {14, upgrade_to_15},
+    {15, upgrade_to_16},
+    {16, upgrade_to_17},
+    {17, upgrade_to_18},
+};
+static_assert(migrations[sizeof(migrations) / sizeof(migrations[0]) - 1].version + 1 == schemaVersion,
+              "schemaVersion changed without a migration");
+
+// Applies the migrations from version on in a single transaction,
+// with the change journal triggers set aside.
+// Returns false if there is no upgrade path or a step fails, in which
+// case the database is left as it was, to be rebuilt by the caller.
+static bool upgradeSchema(sqlite3 *db, int version) {
+    const Migration *begin = std::begin(migrations);
+    const Migration *end = std::end(migrations);
+    const Migration *step = std::find_if(begin, end, [version](const Migration &m) {
+        return m.version == version;
+    });
+    if (step == end) {
+        return false;
+    }
+    execute_sql(db, "BEGIN TRANSACTION");
+    try {
+        execute_sql(db, R"(
+DROP TRIGGER IF EXISTS media_changes_ai;
+DROP TRIGGER IF EXISTS media_changes_au;
+DROP TRIGGER IF EXISTS media_changes_ad;
+)");
+        for (; step != end; step++) {
+            step->upgrade(db);
+        }
+        execute_sql(db, changes_triggers);
+        execute_sql(db, "UPDATE schemaVersion SET version = " + std::to_string(schemaVersion));
+        execute_sql(db, "COMMIT TRANSACTION");
+    } catch (const exception &e) {
+        sqlite3_exec(db, "ROLLBACK TRANSACTION", nullptr, nullptr, nullptr);
+        fprintf(stderr, "Could not upgrade database from schema version %d: %s\n",
+                version, e.what());
+        return false;
+    }
+    printf("Upgraded database from schema version %d to %d.\n", version, schemaVersion);
+    return true;
+}
+
+// The full text index of title, artist and album, and the triggers
+// keeping it in step with media. Both FTS versions accept rowid for
+// the document id and read removed rows back from media.
+static string fts_schema(bool fts5) {
+    string schema;
+    if (fts5) {
+        // Prefix indexes let short search terms, which match a lot of
+        // words, be looked up without scanning every term.
+        schema = R"(
+CREATE VIRTUAL TABLE media_fts
+USING fts5(title, artist, album, content='media', content_rowid='id', tokenize='mozporter', prefix='1 2 3');
+)";
+    } else {
+        schema = R"(
+CREATE VIRTUAL TABLE media_fts
+USING fts4(content='media', title, artist, album, tokenize=mozporter);
+)";
+    }
+    return schema + fts_triggers;
+}
+
+static bool uses_fts5(sqlite3 *db) {
+    Statement query(db, "SELECT sql FROM sqlite_master WHERE name = 'media_fts'");
+    return query.step() && query.getText(0).find("USING fts5") != string::npos;
+}
+
+void createTables(sqlite3 *db, bool fts5) {
+    string schema(R"(
+CREATE TABLE schemaVersion (version INTEGER);
+
+CREATE TABLE media (
+    id INTEGER PRIMARY KEY,
+    filename TEXT UNIQUE NOT NULL CHECK (filename LIKE '/%'),
     content_type TEXT,
     etag TEXT,
     title TEXT,
@@ -343,29 +945,21 @@ CREATE TABLE media_attic (
     height INTEGER,       -- Only relevant to video/images
     latitude DOUBLE,
     longitude DOUBLE,
-    has_thumbnail INTEGER,
+    has_thumbnail INTEGER CHECK (has_thumbnail IN (0, 1)),
     mtime INTEGER,
-    type INTEGER   -- 0=Audio, 1=Video
+    type INTEGER CHECK (type IN (1, 2, 3)), -- MediaType enum
+    artist_id INTEGER,       -- artists.id of artist
+    album_artist_id INTEGER, -- artists.id of album_artist
+    genre_id INTEGER,        -- genres.id of genre
+    date_epoch INTEGER,      -- date in seconds since the epoch, see dateToEpoch()
+    fingerprint TEXT         -- see MediaFile::getFingerprint(), NULL if not known
 );
 
-CREATE VIRTUAL TABLE media_fts
-USING fts4(content='media', title, artist, album, tokenize=mozporter);
-
-CREATE TRIGGER media_bu BEFORE UPDATE ON media BEGIN
-  DELETE FROM media_fts WHERE docid=old.id;
-END;
-
-CREATE TRIGGER media_au AFTER UPDATE ON media BEGIN
-  INSERT INTO media_fts(docid, title, artist, album) VALUES (new.id, new.title, new.artist, new.album);
-END;
-
-CREATE TRIGGER media_bd BEFORE DELETE ON media BEGIN
-  DELETE FROM media_fts WHERE docid=old.id;
-END;
-
-CREATE TRIGGER media_ai AFTER INSERT ON media BEGIN
-  INSERT INTO media_fts(docid, title, artist, album) VALUES (new.id, new.title, new.artist, new.album);
-END;
+CREATE INDEX media_type_idx ON media(type);
+CREATE INDEX media_song_info_idx ON media(type, album_artist, album, disc_number, track_number, title) WHERE type = 1;
+CREATE INDEX media_mtime_idx ON media(type, mtime);
+CREATE INDEX media_date_idx ON media(type, date_epoch);
+CREATE INDEX media_fingerprint_idx ON media(fingerprint) WHERE fingerprint IS NOT NULL;
 
 CREATE TABLE broken_files (
     filename TEXT PRIMARY KEY NOT NULL,
@@ -373,6 +967,16 @@ CREATE TABLE broken_files (
 );
 )");
     execute_sql(db, schema);
+    execute_sql(db, fts_schema(fts5));
+    execute_sql(db, dictionary_schema);
+    execute_sql(db, attic_schema);
+    execute_sql(db, offline_schema);
+    execute_sql(db, albums_schema());
+    execute_sql(db, changes_schema);
+    execute_sql(db, changes_triggers);
+    if (has_rtree(db)) {
+        execute_sql(db, location_schema());
+    }
 
     Statement version(db, "INSERT INTO schemaVersion (version) VALUES (?)");
     version.bind(1, schemaVersion);
@@ -397,71 +1001,283 @@ static std::string get_default_database() {
     return cachedir + "/mediastore.db";
 }
 
-MediaStore::MediaStore(OpenType access, const std::string &retireprefix)
-    : MediaStore(get_default_database(), access, retireprefix)
-{
+static sqlite3 *open_db(const std::string &filename, int flags) {
+    sqlite3 *db = nullptr;
+    if(sqlite3_open_v2(filename.c_str(), &db, flags, nullptr) != SQLITE_OK) {
+        string msg(sqlite3_errmsg(db));
+        sqlite3_close(db);
+        throw runtime_error(msg);
+    }
+    return db;
 }
 
-MediaStore::MediaStore(const std::string &filename, OpenType access, const std::string &retireprefix) {
-    int sqliteFlags = access == MS_READ_WRITE ? SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE : SQLITE_OPEN_READONLY;
-    p = new MediaStorePrivate();
-    if(sqlite3_open_v2(filename.c_str(), &p->db, sqliteFlags, nullptr) != SQLITE_OK) {
-        throw runtime_error(sqlite3_errmsg(p->db));
+static void set_synchronous(sqlite3 *db, SyncLevel level) {
+    switch (level) {
+    case SyncLevel::Off:
+        execute_sql(db, "PRAGMA synchronous = OFF");
+        break;
+    case SyncLevel::Normal:
+        execute_sql(db, "PRAGMA synchronous = NORMAL");
+        break;
+    case SyncLevel::Full:
+        execute_sql(db, "PRAGMA synchronous = FULL");
+        break;
     }
-    register_tokenizer(p->db);
-    register_functions(p->db);
-    int detectedSchemaVersion = getSchemaVersion(p->db);
-    if(access == MS_READ_WRITE) {
-        if(detectedSchemaVersion != schemaVersion) {
-            deleteTables(p->db);
-            createTables(p->db);
-        }
-        if(!retireprefix.empty())
-            archiveItems(retireprefix);
-    } else {
-        if(detectedSchemaVersion != schemaVersion) {
-            std::string msg("Tried to open a db with schema version ");
-            msg += std::to_string(detectedSchemaVersion);
-            msg += ", while supported version is ";
-            msg += std::to_string(schemaVersion) + ".";
-            throw runtime_error(msg);
-        }
+}
+
+// Applies the tunables that every connection, reader or writer, sets
+// for itself.
+static void set_connection_options(sqlite3 *db, const MediaStoreOptions &options) {
+    if (options.getMmapSize() > 0) {
+        execute_sql(db, "PRAGMA mmap_size = " + std::to_string(options.getMmapSize()));
+    }
+    if (options.getCacheSize() > 0) {
+        // Negative values are in KiB rather than pages.
+        execute_sql(db, "PRAGMA cache_size = -" + std::to_string(options.getCacheSize()));
+    }
+    switch (options.getTempStore()) {
+    case TempStore::Default:
+        break;
+    case TempStore::File:
+        execute_sql(db, "PRAGMA temp_store = FILE");
+        break;
+    case TempStore::Memory:
+        execute_sql(db, "PRAGMA temp_store = MEMORY");
+        break;
     }
 }
 
-MediaStore::~MediaStore() {
-    sqlite3_close(p->db);
+static bool enable_wal(sqlite3 *db, const std::string &filename) {
+    // Keep the -wal and -shm files around after the writer closes the
+    // database. Readers that can not create them (e.g. confined apps
+    // with read only access to the cache dir) can then still open it.
+    int persist = 1;
+    sqlite3_file_control(db, "main", SQLITE_FCNTL_PERSIST_WAL, &persist);
+
+    Statement mode(db, "PRAGMA journal_mode=WAL");
+    if (!mode.step() || mode.getText(0) != "wal") {
+        fprintf(stderr, "Could not switch %s to WAL mode, using rollback journal.\n",
+                filename.c_str());
+        return false;
+    }
+    mode.finalize();
+
+    // Readers only need read access to the WAL files, so give them
+    // the same permissions as the database itself.
+    struct stat dbstat;
+    if (stat(filename.c_str(), &dbstat) == 0) {
+        for (const char *suffix : {"-wal", "-shm"}) {
+            const std::string fname = filename + suffix;
+            if (chmod(fname.c_str(), dbstat.st_mode & 0777) != 0 && errno != ENOENT) {
+                fprintf(stderr, "Could not set permissions of %s: %s\n",
+                        fname.c_str(), strerror(errno));
+            }
+        }
+    }
+    return true;
+}
+
+static sqlite3 *open_reader(const std::string &filename) {
+    sqlite3 *db = open_db(filename, SQLITE_OPEN_READONLY);
+    if (filename == ":memory:") {
+        return db;
+    }
+    // Reading a WAL database needs its -wal and -shm files, which the
+    // writer leaves in place. Reading the main file alone could miss
+    // or tear on what the daemon writes meanwhile, so fail instead.
+    if (sqlite3_exec(db, "SELECT COUNT(*) FROM sqlite_master", nullptr, nullptr, nullptr) == SQLITE_OK) {
+        return db;
+    }
+    const int err = sqlite3_errcode(db);
+    string msg(sqlite3_errmsg(db));
+    sqlite3_close(db);
+    if (err == SQLITE_CANTOPEN || err == SQLITE_READONLY) {
+        msg = "Could not open the WAL files of " + filename + " for reading: " + msg;
+    }
+    throw runtime_error(msg);
+}
+
+MediaStore::MediaStore(OpenType access, const std::string &retireprefix)
+    : MediaStore(get_default_database(), access, MediaStoreOptions(), retireprefix)
+{
+}
+
+MediaStore::MediaStore(OpenType access, const MediaStoreOptions &options, const std::string &retireprefix)
+    : MediaStore(get_default_database(), access, options, retireprefix)
+{
+}
+
+MediaStore::MediaStore(const std::string &filename, OpenType access, const std::string &retireprefix)
+    : MediaStore(filename, access, MediaStoreOptions(), retireprefix)
+{
+}
+
+MediaStore::MediaStore(const std::string &filename, OpenType access, const MediaStoreOptions &options, const std::string &retireprefix) {
+    p = new MediaStorePrivate();
+    p->volumes_generation = &p->volumes;
+    p->read_only = access != MS_READ_WRITE;
+    if (options.getResultCacheSize() > 0) {
+        p->result_cache.reset(new ResultCache(options.getResultCacheSize()));
+    }
+    bool wal = false;
+    if(access == MS_READ_WRITE) {
+        p->db = open_db(filename, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE);
+        // Only has an effect before the first table is created, and
+        // can not be changed at all once in WAL mode.
+        if(options.getPageSize() > 0) {
+            execute_sql(p->db, "PRAGMA page_size = " + std::to_string(options.getPageSize()));
+        }
+        // Likewise, so that runMaintenance() can give the space of
+        // deleted rows back a few pages at a time.
+        execute_sql(p->db, "PRAGMA auto_vacuum = INCREMENTAL");
+        // Switching an existing database back to a rollback journal
+        // needs exclusive access, so WAL mode is only ever turned on.
+        if(options.getWriteAheadLog()) {
+            wal = enable_wal(p->db, filename);
+        }
+        p->synchronous = options.getSynchronous();
+        p->bulk_synchronous = options.getBulkLoadSynchronous();
+        set_synchronous(p->db, p->synchronous);
+    } else {
+        p->db = open_reader(filename);
+    }
+    set_connection_options(p->db, options);
+    register_tokenizer(p->db);
+    register_functions(p->db, &p->fts_deferred);
+    int detectedSchemaVersion = getSchemaVersion(p->db);
+    const bool want_fts5 = options.getFullTextBackend() == FullTextBackend::FTS5;
+    // The FTS5 tokenizer is only registered when needed, so that
+    // FTS4 databases keep working with SQLite builds lacking FTS5.
+    if(uses_fts5(p->db) || (access == MS_READ_WRITE && want_fts5 &&
+                            detectedSchemaVersion != schemaVersion)) {
+        registerFts5Tokenizer(p->db);
+    }
+    if(access == MS_READ_WRITE) {
+        // Let replacing a row fire the delete triggers, so the full
+        // text index and albums table drop the old version of it.
+        execute_sql(p->db, "PRAGMA recursive_triggers = ON");
+        if(detectedSchemaVersion != schemaVersion &&
+           !upgradeSchema(p->db, detectedSchemaVersion)) {
+            deleteTables(p->db);
+            createTables(p->db, want_fts5);
+        }
+        if(!retireprefix.empty())
+            archiveItems(retireprefix);
+    } else {
+        if(detectedSchemaVersion != schemaVersion) {
+            std::string msg("Tried to open a db with schema version ");
+            msg += std::to_string(detectedSchemaVersion);
+            msg += ", while supported version is ";
+            msg += std::to_string(schemaVersion) + ".";
+            throw runtime_error(msg);
+        }
+    }
+    p->fts5 = uses_fts5(p->db);
+    p->spatial = uses_rtree(p->db);
+
+    // Without WAL a reader would block the writer (and vice versa),
+    // and every connection to an in-memory database is a new database.
+    // In both cases all queries go through the main connection.
+    const bool can_pool = access == MS_READ_ONLY || wal;
+    if (can_pool && filename != ":memory:" && !filename.empty()) {
+        for (int i = 0; i < options.getReadConnections(); i++) {
+            std::unique_ptr<MediaStoreConnection> conn(new MediaStoreConnection());
+            conn->db = open_reader(filename);
+            set_connection_options(conn->db, options);
+            register_tokenizer(conn->db);
+            if (p->fts5) {
+                registerFts5Tokenizer(conn->db);
+            }
+            register_functions(conn->db);
+            conn->fts5 = p->fts5;
+            conn->spatial = p->spatial;
+            conn->volumes_generation = &p->volumes;
+            p->idle_readers.push_back(conn.get());
+            p->readers.push_back(std::move(conn));
+        }
+    }
+}
+
+MediaStore::~MediaStore() {
     delete p;
 }
 
-size_t MediaStorePrivate::size() const {
-    Statement count(db, "SELECT COUNT(*) FROM media");
+size_t MediaStoreConnection::size() const {
+    Statement count(db, stmt_cache, (std::string("SELECT COUNT(*) FROM media WHERE 1") + online_filter()).c_str());
     count.step();
     return count.getInt(0);
 }
 
+static const char *INSERT_MEDIA = "INSERT OR REPLACE INTO media (filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type, artist_id, album_artist_id, genre_id, date_epoch, fingerprint)  VALUES ";
+static const int MEDIA_COLUMNS = 24;
+
+// Rows written per statement by insertBatch. Keeps the number of
+// parameters below SQLite's default limit of 999.
+static const size_t BATCH_ROWS = 32;
+
+// Returns the id of name in the artists or genres table, adding it
+// if it is not there yet.
+int64_t MediaStorePrivate::intern(const char *table, const std::string &name) const {
+    const std::string t(table);
+    Statement lookup(db, stmt_cache, ("SELECT id FROM " + t + " WHERE name = ?").c_str());
+    lookup.bind(1, name);
+    if (lookup.step()) {
+        return lookup.getInt64(0);
+    }
+    lookup.finalize();
+    Statement add(db, stmt_cache, ("INSERT INTO " + t + " (name) VALUES (?)").c_str());
+    add.bind(1, name);
+    add.step();
+    return sqlite3_last_insert_rowid(db);
+}
+
+// Binds the columns of INSERT_MEDIA for m, starting after parameter offset.
+void MediaStorePrivate::bind_media(Statement &query, int offset, const MediaFile &m) const {
+    query.bind(offset + 1, m.getFileName());
+    query.bind(offset + 2, m.getContentType());
+    query.bind(offset + 3, m.getETag());
+    query.bind(offset + 4, m.getTitle());
+    query.bind(offset + 5, m.getDate());
+    query.bind(offset + 6, m.getAuthor());
+    query.bind(offset + 7, m.getAlbum());
+    query.bind(offset + 8, m.getAlbumArtist());
+    query.bind(offset + 9, m.getGenre());
+    query.bind(offset + 10, m.getDiscNumber());
+    query.bind(offset + 11, m.getTrackNumber());
+    query.bind(offset + 12, m.getDuration());
+    query.bind(offset + 13, m.getWidth());
+    query.bind(offset + 14, m.getHeight());
+    query.bind(offset + 15, m.getLatitude());
+    query.bind(offset + 16, m.getLongitude());
+    query.bind(offset + 17, (int)m.getHasThumbnail());
+    query.bind(offset + 18, (int64_t)m.getModificationTime());
+    query.bind(offset + 19, (int)m.getType());
+    query.bind(offset + 20, intern("artists", m.getAuthor()));
+    query.bind(offset + 21, intern("artists", m.getAlbumArtist()));
+    query.bind(offset + 22, intern("genres", m.getGenre()));
+    query.bind(offset + 23, dateToEpoch(m.getDate()));
+    if (m.getFingerprint().empty()) {
+        query.bindNull(offset + 24);
+    } else {
+        query.bind(offset + 24, m.getFingerprint());
+    }
+}
+
+// Returns "(?, ?, ...)" with count parameters.
+static std::string placeholders(int count) {
+    std::string result("(");
+    for (int i = 0; i < count; i++) {
+        result += i == 0 ? "?" : ", ?";
+    }
+    result += ")";
+    return result;
+}
+
 void MediaStorePrivate::insert(const MediaFile &m) const {
-    Statement query(db, "INSERT OR REPLACE INTO media (filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type)  VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
-    query.bind(1, m.getFileName());
-    query.bind(2, m.getContentType());
-    query.bind(3, m.getETag());
-    query.bind(4, m.getTitle());
-    query.bind(5, m.getDate());
-    query.bind(6, m.getAuthor());
-    query.bind(7, m.getAlbum());
-    query.bind(8, m.getAlbumArtist());
-    query.bind(9, m.getGenre());
-    query.bind(10, m.getDiscNumber());
-    query.bind(11, m.getTrackNumber());
-    query.bind(12, m.getDuration());
-    query.bind(13, m.getWidth());
-    query.bind(14, m.getHeight());
-    query.bind(15, m.getLatitude());
-    query.bind(16, m.getLongitude());
-    query.bind(17, (int)m.getHasThumbnail());
-    query.bind(18, (int64_t)m.getModificationTime());
-    query.bind(19, (int)m.getType());
+    Statement query(db, stmt_cache, (std::string(INSERT_MEDIA) + placeholders(MEDIA_COLUMNS)).c_str());
+    bind_media(query, 0, m);
     query.step();
+    changed();
 
     const char *typestr = m.getType() == AudioMedia ? "song" : "video";
     printf("Added %s to backing store: %s\n", typestr, m.getFileName().c_str());
@@ -474,70 +1290,315 @@ void MediaStorePrivate::insert(const MediaFile &m) const {
     // Even if it does, only one residual line remains and that will be cleaned up
     // on the next scan.
     remove_broken_file(m.getFileName());
+
+    std::lock_guard<std::mutex> lock(indexMutex);
+    etag_index.setETag(m.getFileName(), m.getETag());
+}
+
+void MediaStorePrivate::insertBatch(std::vector<MediaFile> &&files) {
+    if (files.empty()) {
+        return;
+    }
+    execute_sql(db, "SAVEPOINT insert_batch");
+    fts_deferred = true;
+    try {
+        for (size_t start = 0; start < files.size(); start += BATCH_ROWS) {
+            const size_t rows = std::min(BATCH_ROWS, files.size() - start);
+            const std::string names = placeholders(rows);
+
+            // Drop the index entries of rows about to be replaced while
+            // their content is still in the media table.
+            Statement fts_del(db, stmt_cache, ("DELETE FROM media_fts WHERE rowid IN (SELECT id FROM media WHERE filename IN " + names + ")").c_str());
+            for (size_t i = 0; i < rows; i++) {
+                fts_del.bind(i + 1, files[start + i].getFileName());
+            }
+            fts_del.step();
+            fts_del.finalize();
+
+            std::string sql(INSERT_MEDIA);
+            const std::string row = placeholders(MEDIA_COLUMNS);
+            for (size_t i = 0; i < rows; i++) {
+                if (i != 0) {
+                    sql += ", ";
+                }
+                sql += row;
+            }
+            Statement query(db, stmt_cache, sql.c_str());
+            for (size_t i = 0; i < rows; i++) {
+                bind_media(query, i * MEDIA_COLUMNS, files[start + i]);
+            }
+            query.step();
+            query.finalize();
+
+            Statement broken(db, stmt_cache, ("DELETE FROM broken_files WHERE filename IN " + names).c_str());
+            for (size_t i = 0; i < rows; i++) {
+                broken.bind(i + 1, files[start + i].getFileName());
+            }
+            broken.step();
+        }
+
+        // Index the new rows in one go now that they are all in place.
+        for (size_t start = 0; start < files.size(); start += BATCH_ROWS) {
+            const size_t rows = std::min(BATCH_ROWS, files.size() - start);
+            Statement fts_add(db, stmt_cache, ("INSERT INTO media_fts(rowid, title, artist, album) SELECT id, title, artist, album FROM media WHERE filename IN " + placeholders(rows)).c_str());
+            for (size_t i = 0; i < rows; i++) {
+                fts_add.bind(i + 1, files[start + i].getFileName());
+            }
+            fts_add.step();
+        }
+    } catch (...) {
+        fts_deferred = false;
+        execute_sql(db, "ROLLBACK TO insert_batch; RELEASE insert_batch");
+        throw;
+    }
+    fts_deferred = false;
+    execute_sql(db, "RELEASE insert_batch");
+    changed();
+
+    {
+        std::lock_guard<std::mutex> lock(indexMutex);
+        for (const auto &m : files) {
+            etag_index.clearBroken(m.getFileName());
+            etag_index.setETag(m.getFileName(), m.getETag());
+        }
+    }
+
+    printf("Added %zu files to backing store.\n", files.size());
+    files.clear();
 }
 
 void MediaStorePrivate::remove(const string &fname) const {
-    Statement del(db, "DELETE FROM media WHERE filename = ?");
+    Statement del(db, stmt_cache, "DELETE FROM media WHERE filename = ?");
     del.bind(1, fname);
     del.step();
+    changed();
+
+    std::lock_guard<std::mutex> lock(indexMutex);
+    etag_index.remove(fname);
 }
 
 void MediaStorePrivate::insert_broken_file(const std::string &fname, const std::string &etag) const {
-    Statement del(db, "INSERT OR REPLACE INTO broken_files (filename, etag) VALUES (?, ?)");
+    Statement del(db, stmt_cache, "INSERT OR REPLACE INTO broken_files (filename, etag) VALUES (?, ?)");
     del.bind(1, fname);
     del.bind(2, etag);
     del.step();
+
+    std::lock_guard<std::mutex> lock(indexMutex);
+    etag_index.setBroken(fname, etag);
 }
 
 void MediaStorePrivate::remove_broken_file(const std::string &fname) const {
-    Statement del(db, "DELETE FROM broken_files WHERE filename = ?");
+    Statement del(db, stmt_cache, "DELETE FROM broken_files WHERE filename = ?");
     del.bind(1, fname);
     del.step();
+
+    std::lock_guard<std::mutex> lock(indexMutex);
+    etag_index.clearBroken(fname);
 }
 
-bool MediaStorePrivate::is_broken_file(const std::string &fname, const std::string &etag) const {
-    Statement query(db, "SELECT * FROM broken_files WHERE filename = ? AND etag = ?");
+bool MediaStoreConnection::is_broken_file(const std::string &fname, const std::string &etag) const {
+    Statement query(db, stmt_cache, "SELECT * FROM broken_files WHERE filename = ? AND etag = ?");
     query.bind(1, fname);
     query.bind(2, etag);
     return query.step();
 }
 
+// Fields of a cursor made from a MediaFile, see Filter::setCursorAfter.
+enum MediaCursorField {
+    CURSOR_ALBUM_ARTIST,
+    CURSOR_ALBUM,
+    CURSOR_DISC_NUMBER,
+    CURSOR_TRACK_NUMBER,
+    CURSOR_TITLE,
+    CURSOR_DATE,
+    CURSOR_MTIME,
+    CURSOR_FILENAME,
+    MEDIA_CURSOR_FIELDS
+};
+
+// Selects the rows that sort after a cursor position, given the
+// columns of the ORDER BY clause. For columns (a, b) the condition is
+//   a >= ? AND (a > ? OR (a = ? AND b > ?))
+// The leading range on the first column lets SQLite seek in an index
+// instead of scanning the rows before the cursor.
+class Keyset final {
+public:
+    struct Column {
+        const char *name;
+        bool integer;
+    };
+
+    Keyset() = default;
+    Keyset(std::vector<Column> &&columns, std::vector<std::string> &&values, bool descending)
+        : columns(std::move(columns)), values(std::move(values)), descending(descending) {
+        assert(this->columns.size() == this->values.size());
+    }
+
+    bool empty() const { return columns.empty(); }
+
+    std::string condition() const {
+        if (empty()) {
+            return "";
+        }
+        const char *after = descending ? " < ?" : " > ?";
+        std::string cond(" AND ");
+        cond += columns[0].name;
+        cond += descending ? " <= ?" : " >= ?";
+        cond += " AND (";
+        for (size_t i = 0; i < columns.size(); i++) {
+            if (i != 0) {
+                cond += " OR ";
+            }
+            cond += "(";
+            for (size_t j = 0; j < i; j++) {
+                cond += columns[j].name;
+                cond += " = ? AND ";
+            }
+            cond += columns[i].name;
+            cond += after;
+            cond += ")";
+        }
+        cond += ")";
+        return cond;
+    }
+
+    int bind(Statement &query, int param) const {
+        if (empty()) {
+            return param;
+        }
+        bindValue(query, param++, 0);
+        for (size_t i = 0; i < columns.size(); i++) {
+            for (size_t j = 0; j <= i; j++) {
+                bindValue(query, param++, j);
+            }
+        }
+        return param;
+    }
+
+private:
+    void bindValue(Statement &query, int param, size_t i) const {
+        if (columns[i].integer) {
+            query.bind(param, (int64_t)std::stoll(values[i]));
+        } else {
+            query.bind(param, values[i]);
+        }
+    }
+
+    std::vector<Column> columns;
+    std::vector<std::string> values;
+    bool descending = false;
+};
+
+// Picks the fields of a MediaFile cursor that match columns.
+static Keyset media_keyset(const Filter &filter, std::vector<Keyset::Column> &&columns,
+                           const std::vector<MediaCursorField> &fields, bool descending) {
+    if (!filter.hasCursor()) {
+        return Keyset();
+    }
+    const auto decoded = decodeCursor(filter.getCursor(), 'm', MEDIA_CURSOR_FIELDS);
+    std::vector<std::string> values;
+    for (const auto f : fields) {
+        values.push_back(decoded[f]);
+    }
+    return Keyset(std::move(columns), std::move(values), descending);
+}
+
+static Keyset album_keyset(const Filter &filter, bool artist_first, bool descending) {
+    if (!filter.hasCursor()) {
+        return Keyset();
+    }
+    auto values = decodeCursor(filter.getCursor(), 'a', 2);
+    std::vector<Keyset::Column> columns {{"album_artist", false}, {"album", false}};
+    if (!artist_first) {
+        std::swap(columns[0], columns[1]);
+        std::swap(values[0], values[1]);
+    }
+    return Keyset(std::move(columns), std::move(values), descending);
+}
+
+static Keyset string_keyset(const Filter &filter, const char *column, bool descending) {
+    if (!filter.hasCursor()) {
+        return Keyset();
+    }
+    return Keyset({{column, false}}, decodeCursor(filter.getCursor(), 's', 1), descending);
+}
+
+// With a cursor the offset is relative to the cursor position, which
+// callers never want, so it is ignored.
+static int effective_offset(const Filter &filter) {
+    return filter.hasCursor() ? 0 : filter.getOffset();
+}
+
+// The select list of a media query, in the column order MediaFileView
+// reads. Fields left out of the mask are selected as NULL, which reads
+// back as empty or zero without the row values being decoded.
+static std::string media_columns(unsigned fields) {
+    static const struct {
+        unsigned field;
+        const char *column;
+    } columns[] = {
+        {FileNameField, "filename"},
+        {ContentTypeField, "content_type"},
+        {ETagField, "etag"},
+        {TitleField, "title"},
+        {DateField, "date"},
+        {AuthorField, "artist"},
+        {AlbumField, "album"},
+        {AlbumArtistField, "album_artist"},
+        {GenreField, "genre"},
+        {DiscNumberField, "disc_number"},
+        {TrackNumberField, "track_number"},
+        {DurationField, "duration"},
+        {WidthField, "width"},
+        {HeightField, "height"},
+        {LatitudeField, "latitude"},
+        {LongitudeField, "longitude"},
+        {HasThumbnailField, "has_thumbnail"},
+        {ModificationTimeField, "mtime"},
+        {TypeField, "type"},
+        {FingerprintField, "fingerprint"},
+    };
+    fields |= FileNameField | TypeField;
+    std::string result;
+    for (const auto &c : columns) {
+        if (!result.empty()) {
+            result += ", ";
+        }
+        result += (fields & c.field) ? c.column : "NULL";
+    }
+    return result;
+}
+
 static MediaFile make_media(Statement &query) {
-    return MediaFileBuilder(query.getText(0))
-        .setContentType(query.getText(1))
-        .setETag(query.getText(2))
-        .setTitle(query.getText(3))
-        .setDate(query.getText(4))
-        .setAuthor(query.getText(5))
-        .setAlbum(query.getText(6))
-        .setAlbumArtist(query.getText(7))
-        .setGenre(query.getText(8))
-        .setDiscNumber(query.getInt(9))
-        .setTrackNumber(query.getInt(10))
-        .setDuration(query.getInt(11))
-        .setWidth(query.getInt(12))
-        .setHeight(query.getInt(13))
-        .setLatitude(query.getDouble(14))
-        .setLongitude(query.getDouble(15))
-        .setHasThumbnail(query.getInt(16))
-        .setModificationTime(query.getInt64(17))
-        .setType((MediaType)query.getInt(18));
+    return MediaFileView(query).toMediaFile();
 }
 
+// The files of a result share one copy of each distinct artist,
+// album, genre and content type, which repeat heavily across songs.
 static vector<MediaFile> collect_media(Statement &query) {
     vector<MediaFile> result;
+    StringPool pool;
     while (query.step()) {
-        result.push_back(make_media(query));
+        result.push_back(MediaFileView(query).toMediaFile(pool));
     }
     return result;
 }
 
-MediaFile MediaStorePrivate::lookup(const std::string &filename) const {
-    Statement query(db, R"(
-SELECT filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type
+// Hands the rows to visit until it returns false. The statement goes
+// back to the cache, reset, as soon as the caller drops it.
+static void visit_media(Statement &query, const MediaVisitor &visit) {
+    while (query.step()) {
+        if (!visit(MediaFileView(query))) {
+            break;
+        }
+    }
+}
+
+MediaFile MediaStoreConnection::lookup(const std::string &filename) const {
+    Statement query(db, stmt_cache, (std::string(R"(
+SELECT filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type, fingerprint
   FROM media
-  WHERE filename = ?
-)");
+  WHERE filename = ?)") + online_filter()).c_str());
     query.bind(1, filename);
     if (!query.step()) {
         throw runtime_error("Could not find media " + filename);
@@ -545,61 +1606,189 @@ SELECT filename, content_type, etag, title, date, artist, album, album_artist, g
     return make_media(query);
 }
 
-vector<MediaFile> MediaStorePrivate::query(const std::string &core_term, MediaType type, const Filter &filter) const {
-    string qs(R"(
-SELECT filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type
-  FROM media
-)");
+// The MATCH argument for a search: all words, the last one a prefix.
+std::string MediaStoreConnection::match_term(const std::string &term) const {
+    return fts5 ? fts5Query(term) : term + "*";
+}
+
+// Relevance of a media_fts row, higher being better, weighing matches
+// in the title over the album over the artist.
+const char *MediaStoreConnection::rank_expression() const {
+    return fts5 ? "-bm25(media_fts, 1.0, 0.5, 0.75)"
+                : "rank(matchinfo(media_fts), 1.0, 0.5, 0.75)";
+}
+
+// A condition leaving out the media rows of offline volumes, to add to
+// the WHERE clause of queries on media. Empty while all volumes are
+// mounted. Whether any are offline is only looked up again once the
+// store says offline_volumes may have changed.
+const char *MediaStoreConnection::online_filter() const {
+    // Read first, so a change made while looking gets looked at again.
+    const uint64_t generation = volumes_generation ? volumes_generation->load() : 0;
+    if (generation == 0 || generation != volumes_checked) {
+        Statement query(db, stmt_cache, "SELECT 1 FROM offline_volumes LIMIT 1");
+        any_offline = query.step();
+        volumes_checked = generation;
+    }
+    if (!any_offline) {
+        return "";
+    }
+    return " AND NOT EXISTS (SELECT 1 FROM offline_volumes"
+        " WHERE prefix <= media.filename AND (prefix_end IS NULL OR media.filename < prefix_end))";
+}
+
+vector<MediaFile> MediaStoreConnection::query(const std::string &core_term, MediaType type, const Filter &filter) const {
+    vector<MediaFile> result;
+    StringPool pool;
+    query(core_term, type, filter, [&result, &pool](const MediaFileView &m) {
+        result.push_back(m.toMediaFile(pool));
+        return true;
+    });
+    return result;
+}
+
+void MediaStoreConnection::query(const std::string &core_term, MediaType type, const Filter &filter, const MediaVisitor &visit) const {
+    select_media(core_term, nullptr, type, filter, visit);
+}
+
+vector<MediaFile> MediaStoreConnection::queryRegion(const BoundingBox &region, MediaType type, const Filter &filter) const {
+    if (!(region.south <= region.north)) {
+        throw runtime_error("Bounding box has its south edge north of its north edge");
+    }
+    vector<MediaFile> result;
+    StringPool pool;
+    select_media("", &region, type, filter, [&result, &pool](const MediaFileView &m) {
+        result.push_back(m.toMediaFile(pool));
+        return true;
+    });
+    return result;
+}
+
+// Limits the media rows to those located in region, looking them up
+// in media_location. The R*Tree stores coordinates with single
+// precision, rounded outwards, so the rows found are checked against
+// the exact ones. Boxes crossing the 180th meridian only narrow down
+// the search by latitude. Without media_location every row of the type
+// is checked, leaving out those at 0, 0 as the index does.
+static std::string region_condition(const BoundingBox &region, bool spatial) {
+    const bool wraps = region.west > region.east;
+    std::string condition;
+    if (spatial) {
+        condition = R"(
+  AND media.id IN (SELECT id FROM media_location
+    WHERE max_lat >= ? AND min_lat <= ? AND )";
+        condition += wraps ? "(max_lon >= ? OR min_lon <= ?)" : "max_lon >= ? AND min_lon <= ?";
+        condition += ")";
+    } else {
+        condition = "\n  AND (latitude <> 0 OR longitude <> 0)";
+    }
+    condition += "\n  AND latitude BETWEEN ? AND ? AND ";
+    condition += wraps ? "(longitude >= ? OR longitude <= ?)" : "longitude BETWEEN ? AND ?";
+    return condition;
+}
+
+static int bind_region(Statement &query, int param, const BoundingBox &region, bool spatial) {
+    for (int i = spatial ? 0 : 1; i < 2; i++) {
+        query.bind(param++, region.south);
+        query.bind(param++, region.north);
+        query.bind(param++, region.west);
+        query.bind(param++, region.east);
+    }
+    return param;
+}
+
+void MediaStoreConnection::select_media(const std::string &core_term, const BoundingBox *region, MediaType type, const Filter &filter, const MediaVisitor &visit) const {
+    // Cursors are made from the fields results are ordered by.
+    unsigned fields = filter.getFields();
+    switch (filter.getOrder()) {
+    case MediaOrder::Title:
+        fields |= TitleField;
+        break;
+    case MediaOrder::Date:
+        fields |= DateField;
+        break;
+    case MediaOrder::Modified:
+        fields |= ModificationTimeField;
+        break;
+    default:
+        break;
+    }
+    string qs = "SELECT " + media_columns(fields) + " FROM media\n";
     if (!core_term.empty()) {
+        // Ranking every match is the most expensive part of a search
+        // with a short term, so skip it when the results are sorted
+        // by something else.
+        const bool by_rank = filter.getOrder() == MediaOrder::Default ||
+            filter.getOrder() == MediaOrder::Rank;
         qs += R"(
   JOIN (
-    SELECT docid, rank(matchinfo(media_fts), 1.0, 0.5, 0.75) AS rank
+    SELECT rowid AS docid)";
+        if (by_rank) {
+            qs += ", ";
+            qs += rank_expression();
+            qs += " AS rank";
+        }
+        qs += R"(
       FROM media_fts WHERE media_fts MATCH ?
     ) AS ranktable ON (media.id = ranktable.docid)
 )";
     }
     qs += " WHERE type = ?";
+    if (region) {
+        qs += region_condition(*region, spatial);
+    }
+    qs += online_filter();
+    const bool reverse = filter.getReverse();
+    const char *dir = reverse ? " DESC" : "";
+    Keyset keyset;
+    std::string order;
     switch (filter.getOrder()) {
     case MediaOrder::Default:
     case MediaOrder::Rank:
+        if (filter.hasCursor()) {
+            throw std::runtime_error("Can not use a cursor when ordering by rank");
+        }
         // We can only sort by rank if there was a query term
         if (!core_term.empty()) {
-            qs += " ORDER BY ranktable.rank";
-            if (!filter.getReverse()) { // Normal order is descending
-                qs += " DESC";
+            order = " ORDER BY ranktable.rank";
+            if (!reverse) { // Normal order is descending
+                order += " DESC";
             }
         }
         break;
     case MediaOrder::Title:
-        qs += " ORDER BY title";
-        if (filter.getReverse()) {
-            qs += " DESC";
-        }
+        keyset = media_keyset(filter, {{"title", false}, {"filename", false}},
+                              {CURSOR_TITLE, CURSOR_FILENAME}, reverse);
+        order = std::string(" ORDER BY title") + dir + ", filename" + dir;
         break;
     case MediaOrder::Date:
-        qs += " ORDER BY date";
-        if (filter.getReverse()) {
-            qs += " DESC";
-        }
+        keyset = media_keyset(filter, {{"date_epoch", true}, {"filename", false}},
+                              {CURSOR_DATE, CURSOR_FILENAME}, reverse);
+        order = std::string(" ORDER BY date_epoch") + dir + ", filename" + dir;
         break;
     case MediaOrder::Modified:
-        qs += " ORDER BY mtime";
-        if (filter.getReverse()) {
-            qs += " DESC";
-        }
+        keyset = media_keyset(filter, {{"mtime", true}, {"filename", false}},
+                              {CURSOR_MTIME, CURSOR_FILENAME}, reverse);
+        order = std::string(" ORDER BY mtime") + dir + ", filename" + dir;
         break;
     }
+    qs += keyset.condition();
+    qs += order;
     qs += " LIMIT ? OFFSET ?";
 
-    Statement query(db, qs.c_str());
+    Statement query(db, stmt_cache, qs.c_str());
     int param = 1;
     if (!core_term.empty()) {
-        query.bind(param++, core_term + "*");
+        query.bind(param++, match_term(core_term));
     }
     query.bind(param++, (int)type);
+    if (region) {
+        param = bind_region(query, param, *region, spatial);
+    }
+    param = keyset.bind(query, param);
     query.bind(param++, filter.getLimit());
-    query.bind(param++, filter.getOffset());
-    return collect_media(query);
+    query.bind(param++, effective_offset(filter));
+    visit_media(query, visit);
 }
 
 static Album make_album(Statement &query) {
@@ -620,63 +1809,77 @@ static vector<Album> collect_albums(Statement &query) {
     return result;
 }
 
-vector<Album> MediaStorePrivate::queryAlbums(const std::string &core_term, const Filter &filter) const {
+vector<Album> MediaStoreConnection::queryAlbums(const std::string &core_term, const Filter &filter) const {
+    const string online = online_filter();
     string qs(R"(
-SELECT album, album_artist, first(date) as date, first(genre) as genre, first(filename) as filename, first(has_thumbnail) as has_thumbnail, first(mtime) as mtime FROM media
-WHERE type = ? AND album <> ''
+SELECT album, album_artist, date, genre, filename, has_thumbnail FROM albums
 )");
     if (!core_term.empty()) {
-        qs += " AND id IN (SELECT docid FROM media_fts WHERE media_fts MATCH ?)";
+        qs += R"(
+  JOIN (
+    SELECT DISTINCT album AS match_album, album_artist AS match_album_artist FROM media
+      WHERE type = ? AND id IN (SELECT rowid FROM media_fts WHERE media_fts MATCH ?))" + online + R"(
+    ) ON (album = match_album AND album_artist = match_album_artist)
+)";
     }
-    qs += " GROUP BY album, album_artist";
+    qs += " WHERE album <> ''";
+    // The albums table also counts the songs of offline volumes.
+    const bool check_songs = core_term.empty() && !online.empty();
+    if (check_songs) {
+        qs += " AND EXISTS (SELECT 1 FROM media WHERE type = ? AND media.album = albums.album AND media.album_artist = albums.album_artist" + online + ")";
+    }
+    const bool reverse = filter.getReverse();
+    const char *dir = reverse ? " DESC" : "";
+    Keyset keyset;
+    std::string order;
     switch (filter.getOrder()) {
     case MediaOrder::Default:
     case MediaOrder::Title:
-        qs += " ORDER BY album";
-        if (filter.getReverse()) {
-            qs += " DESC";
-        }
+        keyset = album_keyset(filter, false, reverse);
+        order = std::string(" ORDER BY album") + dir + ", album_artist" + dir;
         break;
     case MediaOrder::Rank:
         throw std::runtime_error("Can not query albums by rank");
     case MediaOrder::Date:
         throw std::runtime_error("Can not query albums by date");
     case MediaOrder::Modified:
-        qs += " ORDER BY mtime";
-        if (filter.getReverse()) {
-            qs += " DESC";
+        if (filter.hasCursor()) {
+            throw std::runtime_error("Can not use a cursor when ordering albums by modification date");
         }
+        order = std::string(" ORDER BY mtime") + dir;
         break;
     }
+    qs += keyset.condition();
+    qs += order;
     qs += " LIMIT ? OFFSET ?";
 
-    Statement query(db, qs.c_str());
+    Statement query(db, stmt_cache, qs.c_str());
     int param = 1;
-    query.bind(param++, (int)AudioMedia);
     if (!core_term.empty()) {
-        query.bind(param++, core_term + "*");
+        query.bind(param++, (int)AudioMedia);
+        query.bind(param++, match_term(core_term));
+    }
+    if (check_songs) {
+        query.bind(param++, (int)AudioMedia);
     }
+    param = keyset.bind(query, param);
     query.bind(param++, filter.getLimit());
-    query.bind(param++, filter.getOffset());
+    query.bind(param++, effective_offset(filter));
     return collect_albums(query);
 }
 
-vector<string> MediaStorePrivate::queryArtists(const string &q, const Filter &filter) const {
+vector<string> MediaStoreConnection::queryArtists(const string &q, const Filter &filter) const {
     string qs(R"(
 SELECT artist FROM media
 WHERE type = ? AND artist <> ''
 )");
     if (!q.empty()) {
-        qs += "AND id IN (SELECT docid FROM media_fts WHERE media_fts MATCH ?)";
+        qs += "AND id IN (SELECT rowid FROM media_fts WHERE media_fts MATCH ?)";
     }
-    qs += " GROUP BY artist";
+    qs += online_filter();
     switch (filter.getOrder()) {
     case MediaOrder::Default:
     case MediaOrder::Title:
-        qs += " ORDER BY artist";
-        if (filter.getReverse()) {
-            qs += " DESC";
-        }
         break;
     case MediaOrder::Rank:
         throw std::runtime_error("Can not query artists by rank");
@@ -685,16 +1888,23 @@ WHERE type = ? AND artist <> ''
     case MediaOrder::Modified:
         throw std::runtime_error("Can not query artists by modification date");
     }
+    const Keyset keyset = string_keyset(filter, "artist", filter.getReverse());
+    qs += keyset.condition();
+    qs += " GROUP BY artist ORDER BY artist";
+    if (filter.getReverse()) {
+        qs += " DESC";
+    }
     qs += " LIMIT ? OFFSET ?";
 
-    Statement query(db, qs.c_str());
+    Statement query(db, stmt_cache, qs.c_str());
     int param = 1;
     query.bind(param++, (int)AudioMedia);
     if (!q.empty()) {
-        query.bind(param++, q + "*");
+        query.bind(param++, match_term(q));
     }
+    param = keyset.bind(query, param);
     query.bind(param++, filter.getLimit());
-    query.bind(param++, filter.getOffset());
+    query.bind(param++, effective_offset(filter));
     vector<string> result;
     while (query.step()) {
         result.push_back(query.getText(0));
@@ -702,22 +1912,20 @@ WHERE type = ? AND artist <> ''
     return result;
 }
 
-vector<MediaFile> MediaStorePrivate::getAlbumSongs(const Album& album) const {
-    Statement query(db, R"(
-SELECT filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type FROM media
-WHERE album = ? AND album_artist = ? AND type = ?
+vector<MediaFile> MediaStoreConnection::getAlbumSongs(const Album& album) const {
+    Statement query(db, stmt_cache, (std::string(R"(
+SELECT filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type, fingerprint FROM media
+WHERE album = ? AND album_artist = ? AND type = ?)") + online_filter() + R"(
 ORDER BY disc_number, track_number
-)");
+)").c_str());
     query.bind(1, album.getTitle());
     query.bind(2, album.getArtist());
     query.bind(3, (int)AudioMedia);
     return collect_media(query);
 }
 
-std::string MediaStorePrivate::getETag(const std::string &filename) const {
-    Statement query(db, R"(
-SELECT etag FROM media WHERE filename = ?
-)");
+std::string MediaStoreConnection::getETag(const std::string &filename) const {
+    Statement query(db, stmt_cache, (std::string("SELECT etag FROM media WHERE filename = ?") + online_filter()).c_str());
     query.bind(1, filename);
     if (query.step()) {
         return query.getText(0);
@@ -726,31 +1934,26 @@ SELECT etag FROM media WHERE filename = ?
     }
 }
 
-std::vector<MediaFile> MediaStorePrivate::listSongs(const Filter &filter) const {
-    std::string qs(R"(
-SELECT filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type
-  FROM media
-  WHERE type = ?
-)");
+// Conditions on media for the artist, album, album artist and genre
+// a filter asks for, and the binding of their parameters.
+static std::string song_conditions(const Filter &filter) {
+    std::string conditions;
     if (filter.hasArtist()) {
-        qs += " AND artist = ?";
+        conditions += " AND artist_id = (SELECT id FROM artists WHERE name = ?)";
     }
     if (filter.hasAlbum()) {
-        qs += " AND album = ?";
+        conditions += " AND album = ?";
     }
     if (filter.hasAlbumArtist()) {
-        qs += " AND album_artist = ?";
+        conditions += " AND album_artist = ?";
     }
     if (filter.hasGenre()) {
-        qs += " AND genre = ?";
+        conditions += " AND genre_id = (SELECT id FROM genres WHERE name = ?)";
     }
-    qs += R"(
-ORDER BY album_artist, album, disc_number, track_number, title
-LIMIT ? OFFSET ?
-)";
-    Statement query(db, qs.c_str());
-    int param = 1;
-    query.bind(param++, (int)AudioMedia);
+    return conditions;
+}
+
+static int bind_song_conditions(Statement &query, int param, const Filter &filter) {
     if (filter.hasArtist()) {
         query.bind(param++, filter.getArtist());
     }
@@ -763,237 +1966,757 @@ LIMIT ? OFFSET ?
     if (filter.hasGenre()) {
         query.bind(param++, filter.getGenre());
     }
-    query.bind(param++, filter.getLimit());
-    query.bind(param++, filter.getOffset());
+    return param;
+}
 
-    return collect_media(query);
+std::vector<MediaFile> MediaStoreConnection::listSongs(const Filter &filter) const {
+    vector<MediaFile> result;
+    StringPool pool;
+    listSongs(filter, [&result, &pool](const MediaFileView &m) {
+        result.push_back(m.toMediaFile(pool));
+        return true;
+    });
+    return result;
+}
+
+void MediaStoreConnection::listSongs(const Filter &filter, const MediaVisitor &visit) const {
+    const unsigned fields = filter.getFields() | AlbumArtistField | AlbumField |
+        DiscNumberField | TrackNumberField | TitleField;
+    std::string qs = "SELECT " + media_columns(fields) + " FROM media WHERE type = ?\n";
+    qs += song_conditions(filter);
+    qs += online_filter();
+    const Keyset keyset = media_keyset(
+        filter,
+        {{"album_artist", false}, {"album", false}, {"disc_number", true},
+         {"track_number", true}, {"title", false}, {"filename", false}},
+        {CURSOR_ALBUM_ARTIST, CURSOR_ALBUM, CURSOR_DISC_NUMBER,
+         CURSOR_TRACK_NUMBER, CURSOR_TITLE, CURSOR_FILENAME}, false);
+    qs += keyset.condition();
+    qs += R"(
+ORDER BY album_artist, album, disc_number, track_number, title, filename
+LIMIT ? OFFSET ?
+)";
+    Statement query(db, stmt_cache, qs.c_str());
+    int param = 1;
+    query.bind(param++, (int)AudioMedia);
+    param = bind_song_conditions(query, param, filter);
+    param = keyset.bind(query, param);
+    query.bind(param++, filter.getLimit());
+    query.bind(param++, effective_offset(filter));
+    visit_media(query, visit);
 }
 
-std::vector<Album> MediaStorePrivate::listAlbums(const Filter &filter) const {
+std::vector<Album> MediaStoreConnection::listAlbums(const Filter &filter) const {
     std::string qs(R"(
-SELECT album, album_artist, first(date) as date, first(genre) as genre, first(filename) as filename, first(has_thumbnail) as has_thumbnail FROM media
-  WHERE type = ?
+SELECT album, album_artist, date, genre, filename, has_thumbnail FROM albums
+  WHERE 1
 )");
-    if (filter.hasArtist()) {
-        qs += " AND artist = ?";
+    // Albums with at least one matching song. The albums table also
+    // counts the songs of offline volumes.
+    const char *online = online_filter();
+    const bool check_songs = filter.hasArtist() || filter.hasGenre() || *online;
+    if (check_songs) {
+        qs += " AND EXISTS (SELECT 1 FROM media WHERE type = ? AND media.album = albums.album AND media.album_artist = albums.album_artist";
+        if (filter.hasArtist()) {
+            qs += " AND artist_id = (SELECT id FROM artists WHERE name = ?)";
+        }
+        if (filter.hasGenre()) {
+            qs += " AND genre_id = (SELECT id FROM genres WHERE name = ?)";
+        }
+        qs += online;
+        qs += ")";
     }
     if (filter.hasAlbumArtist()) {
         qs += " AND album_artist = ?";
     }
-    if (filter.hasGenre()) {
-        qs += "AND genre = ?";
-    }
+    const Keyset keyset = album_keyset(filter, true, false);
+    qs += keyset.condition();
     qs += R"(
-GROUP BY album, album_artist
 ORDER BY album_artist, album
 LIMIT ? OFFSET ?
 )";
-    Statement query(db, qs.c_str());
+    Statement query(db, stmt_cache, qs.c_str());
     int param = 1;
-    query.bind(param++, (int)AudioMedia);
+    if (check_songs) {
+        query.bind(param++, (int)AudioMedia);
+    }
     if (filter.hasArtist()) {
         query.bind(param++, filter.getArtist());
     }
-    if (filter.hasAlbumArtist()) {
-        query.bind(param++, filter.getAlbumArtist());
-    }
     if (filter.hasGenre()) {
         query.bind(param++, filter.getGenre());
     }
+    if (filter.hasAlbumArtist()) {
+        query.bind(param++, filter.getAlbumArtist());
+    }
+    param = keyset.bind(query, param);
     query.bind(param++, filter.getLimit());
-    query.bind(param++, filter.getOffset());
+    query.bind(param++, effective_offset(filter));
 
     return collect_albums(query);
 }
 
-vector<std::string> MediaStorePrivate::listArtists(const Filter &filter) const {
-    string qs(R"(
-SELECT artist FROM media
-  WHERE type = ?
-)");
-    if (filter.hasGenre()) {
-        qs += " AND genre = ?";
+// Names from the artists or genres dictionary used by at least one
+// song, optionally of the given genre.
+static vector<string> list_names(sqlite3 *db, StatementCache &stmt_cache,
+                                 const char *table, const char *id_column,
+                                 const Filter &filter, bool by_genre,
+                                 const char *online) {
+    string qs("SELECT name FROM ");
+    qs += table;
+    qs += " WHERE EXISTS (SELECT 1 FROM media WHERE ";
+    qs += id_column;
+    qs += " = ";
+    qs += table;
+    qs += ".id AND type = ?";
+    if (by_genre) {
+        qs += " AND genre_id = (SELECT id FROM genres WHERE name = ?)";
     }
+    qs += online;
+    qs += ")";
+    const Keyset keyset = string_keyset(filter, "name", false);
+    qs += keyset.condition();
     qs += R"(
-  GROUP BY artist
-  ORDER BY artist
+  ORDER BY name
   LIMIT ? OFFSET ?
 )";
-    Statement query(db, qs.c_str());
+    Statement query(db, stmt_cache, qs.c_str());
     int param = 1;
     query.bind(param++, (int)AudioMedia);
-    if (filter.hasGenre()) {
+    if (by_genre) {
         query.bind(param++, filter.getGenre());
     }
+    param = keyset.bind(query, param);
     query.bind(param++, filter.getLimit());
-    query.bind(param++, filter.getOffset());
+    query.bind(param++, effective_offset(filter));
 
-    vector<string> artists;
+    vector<string> names;
     while (query.step()) {
-        artists.push_back(query.getText(0));
+        names.push_back(query.getText(0));
     }
-    return artists;
+    return names;
 }
 
-vector<std::string> MediaStorePrivate::listAlbumArtists(const Filter &filter) const {
-    string qs(R"(
-SELECT album_artist FROM media
-  WHERE type = ?
-)");
-    if (filter.hasGenre()) {
-        qs += " AND genre = ?";
+vector<std::string> MediaStoreConnection::listArtists(const Filter &filter) const {
+    return list_names(db, stmt_cache, "artists", "artist_id", filter, filter.hasGenre(), online_filter());
+}
+
+vector<std::string> MediaStoreConnection::listAlbumArtists(const Filter &filter) const {
+    return list_names(db, stmt_cache, "artists", "album_artist_id", filter, filter.hasGenre(), online_filter());
+}
+
+vector<std::string> MediaStoreConnection::listGenres(const Filter &filter) const {
+    return list_names(db, stmt_cache, "genres", "genre_id", filter, false, online_filter());
+}
+
+bool MediaStoreConnection::hasMedia(MediaType type) const {
+    const std::string online = online_filter();
+    if (type == AllMedia) {
+        Statement query(db, stmt_cache, ("SELECT id FROM media WHERE 1" + online + " LIMIT 1").c_str());
+        return query.step();
+    } else {
+        Statement query(db, stmt_cache, ("SELECT id FROM media WHERE type = ?" + online + " LIMIT 1").c_str());
+        query.bind(1, (int)type);
+        return query.step();
     }
-    qs += R"(
-  GROUP BY album_artist
-  ORDER BY album_artist
-  LIMIT ? OFFSET ?
-)";
-    Statement query(db, qs.c_str());
+}
+
+size_t MediaStoreConnection::count(MediaType type, const Filter &filter) const {
+    std::string qs = "SELECT count(*) FROM media WHERE ";
+    qs += type == AllMedia ? "1" : "type = ?";
+    qs += song_conditions(filter);
+    qs += online_filter();
+    Statement query(db, stmt_cache, qs.c_str());
     int param = 1;
-    query.bind(param++, (int)AudioMedia);
-    if (filter.hasGenre()) {
-        query.bind(param++, filter.getGenre());
+    if (type != AllMedia) {
+        query.bind(param++, (int)type);
+    }
+    bind_song_conditions(query, param, filter);
+    query.step();
+    return query.getInt64(0);
+}
+
+// The songs are grouped by all three ids at once, so the matching rows
+// are read once, and only the groups are then added up per name.
+Facets MediaStoreConnection::facets(const Filter &filter) const {
+    std::string qs = R"(
+SELECT (SELECT name FROM genres WHERE id = genre_id),
+       (SELECT name FROM artists WHERE id = artist_id),
+       (SELECT name FROM artists WHERE id = album_artist_id), n
+  FROM (SELECT genre_id, artist_id, album_artist_id, count(*) AS n
+          FROM media WHERE type = ?)";
+    qs += song_conditions(filter);
+    qs += online_filter();
+    qs += " GROUP BY genre_id, artist_id, album_artist_id)";
+    Statement query(db, stmt_cache, qs.c_str());
+    query.bind(1, (int)AudioMedia);
+    bind_song_conditions(query, 2, filter);
+
+    std::map<std::string, size_t> genres, artists, album_artists;
+    auto add = [&query](std::map<std::string, size_t> &counts, int column) {
+        // Names are NULL for ids missing from the dictionary.
+        if (!query.isNull(column)) {
+            counts[query.getRawText(column)] += query.getInt64(3);
+        }
+    };
+    while (query.step()) {
+        add(genres, 0);
+        add(artists, 1);
+        add(album_artists, 2);
     }
+    Facets facets;
+    facets.genres.assign(genres.begin(), genres.end());
+    facets.artists.assign(artists.begin(), artists.end());
+    facets.album_artists.assign(album_artists.begin(), album_artists.end());
+    return facets;
+}
+
+// Both walk the (type, date_epoch) index over the range. Files without
+// a date sort before all others as NO_DATE, so a range never has them.
+vector<MediaFile> MediaStoreConnection::listDateRange(MediaType type, int64_t start, int64_t end, const Filter &filter) const {
+    const bool reverse = filter.getReverse();
+    const char *dir = reverse ? " DESC" : "";
+    const Keyset keyset = media_keyset(filter, {{"date_epoch", true}, {"filename", false}},
+                                       {CURSOR_DATE, CURSOR_FILENAME}, reverse);
+    std::string qs = "SELECT " + media_columns(filter.getFields() | DateField) + R"(
+  FROM media
+  WHERE type = ? AND date_epoch >= ? AND date_epoch < ?)";
+    qs += online_filter();
+    qs += keyset.condition();
+    qs += std::string(" ORDER BY date_epoch") + dir + ", filename" + dir;
+    qs += " LIMIT ? OFFSET ?";
+    Statement query(db, stmt_cache, qs.c_str());
+    int param = 1;
+    query.bind(param++, (int)type);
+    query.bind(param++, std::max(start, NO_DATE + 1));
+    query.bind(param++, end);
+    param = keyset.bind(query, param);
     query.bind(param++, filter.getLimit());
-    query.bind(param++, filter.getOffset());
+    query.bind(param++, effective_offset(filter));
+    return collect_media(query);
+}
 
-    vector<string> artists;
+vector<DateCount> MediaStoreConnection::countByDate(MediaType type, DateBucket bucket, int64_t start, int64_t end) const {
+    const char *period = "start of day";
+    switch (bucket) {
+    case DateBucket::Day:
+        break;
+    case DateBucket::Month:
+        period = "start of month";
+        break;
+    case DateBucket::Year:
+        period = "start of year";
+        break;
+    }
+    std::string qs = R"(
+SELECT CAST(strftime('%s', date_epoch, 'unixepoch', ')" + std::string(period) + R"(') AS INTEGER) AS bucket, count(*)
+  FROM media
+  WHERE type = ? AND date_epoch >= ? AND date_epoch < ?)";
+    qs += online_filter();
+    qs += " GROUP BY bucket ORDER BY bucket";
+    Statement query(db, stmt_cache, qs.c_str());
+    query.bind(1, (int)type);
+    query.bind(2, std::max(start, NO_DATE + 1));
+    query.bind(3, end);
+    vector<DateCount> result;
     while (query.step()) {
-        artists.push_back(query.getText(0));
+        result.emplace_back(query.getInt64(0), query.getInt64(1));
     }
-    return artists;
+    return result;
 }
 
-vector<std::string> MediaStorePrivate::listGenres(const Filter &filter) const {
-    Statement query(db, R"(
-SELECT genre FROM media
-  WHERE type = ?
-  GROUP BY genre
-  ORDER BY genre
-  LIMIT ? OFFSET ?
+// Groups are ordered by fingerprint, which the partial index on it
+// hands out in order.
+vector<vector<MediaFile>> MediaStoreConnection::listDuplicates(MediaType type, const Filter &filter) const {
+    std::string qs = "SELECT " + media_columns(filter.getFields() | FingerprintField) + R"(
+  FROM media
+  WHERE type = ? AND fingerprint IN (
+    SELECT fingerprint FROM media
+      WHERE type = ? AND fingerprint IS NOT NULL)";
+    qs += online_filter();
+    qs += R"(
+      GROUP BY fingerprint HAVING count(*) > 1
+      ORDER BY fingerprint LIMIT ? OFFSET ?))";
+    qs += online_filter();
+    qs += " ORDER BY fingerprint, filename";
+    Statement query(db, stmt_cache, qs.c_str());
+    query.bind(1, (int)type);
+    query.bind(2, (int)type);
+    query.bind(3, filter.getLimit());
+    query.bind(4, effective_offset(filter));
+    vector<vector<MediaFile>> result;
+    StringPool pool;
+    while (query.step()) {
+        MediaFile m = MediaFileView(query).toMediaFile(pool);
+        if (result.empty() || result.back()[0].getFingerprint() != m.getFingerprint()) {
+            result.emplace_back();
+        }
+        result.back().push_back(std::move(m));
+    }
+    return result;
+}
+
+vector<MediaFile> MediaStoreConnection::lookupFingerprint(const std::string &fingerprint) const {
+    Statement query(db, stmt_cache, ("SELECT " + media_columns(AllFields) + " FROM media WHERE fingerprint = ? ORDER BY filename").c_str());
+    query.bind(1, fingerprint);
+    return collect_media(query);
+}
+
+MediaChanges MediaStoreConnection::changesSince(MediaType type, uint64_t sequence) const {
+    MediaChanges result;
+    Statement latest(db, stmt_cache, R"(
+SELECT (SELECT seq FROM sqlite_sequence WHERE name = 'media_changes'),
+    (SELECT seq FROM media_changes_pruned)
 )");
-    query.bind(1, (int)AudioMedia);
-    query.bind(2, filter.getLimit());
-    query.bind(3, filter.getOffset());
+    latest.step();
+    result.sequence = latest.getInt64(0);
+    const uint64_t pruned = latest.getInt64(1);
+    latest.finalize();
+    if (sequence < pruned || sequence > result.sequence) {
+        result.complete = false;
+        return result;
+    }
 
-    vector<string> genres;
+    std::string qs = "SELECT seq, change, type, filename FROM media_changes WHERE seq > ?";
+    if (type != AllMedia) {
+        qs += " AND type = ?";
+    }
+    qs += " ORDER BY seq";
+    Statement query(db, stmt_cache, qs.c_str());
+    query.bind(1, (int64_t)sequence);
+    if (type != AllMedia) {
+        query.bind(2, (int)type);
+    }
     while (query.step()) {
-        genres.push_back(query.getText(0));
+        MediaChange c;
+        c.sequence = query.getInt64(0);
+        c.change = static_cast<ChangeType>(query.getInt(1));
+        c.type = static_cast<MediaType>(query.getInt(2));
+        c.filename = query.getText(3);
+        // Without a read transaction, changes committed in between
+        // show up here too.
+        result.sequence = std::max<uint64_t>(result.sequence, c.sequence);
+        result.changes.push_back(std::move(c));
     }
-    return genres;
+    return result;
 }
 
-bool MediaStorePrivate::hasMedia(MediaType type) const {
-    if (type == AllMedia) {
-        Statement query(db, R"(
-SELECT id FROM media
-  LIMIT 1
-)");
-        return query.step();
-    } else {
-        Statement query(db, R"(
-SELECT id FROM media
-  WHERE type = ?
-  LIMIT 1
-)");
-        query.bind(1, (int)type);
-        return query.step();
+// Threads listing directories in pruneDeleted, and the number of
+// rows removed per transaction.
+static const unsigned PRUNE_THREADS = 8;
+static const size_t PRUNE_BATCH = 256;
+
+namespace {
+
+// What the prune pass learns about one directory.
+struct PruneDir {
+    std::vector<std::string> files; // Full names of its files in media
+    bool scanblock = false;         // Has a .nomedia file
+    bool blocked = false;           // It or an ancestor has one
+    std::vector<std::string> gone;  // Files no longer on disk
+};
+
+}
+
+static std::string parent_dir(const std::string &path) {
+    const auto pos = path.rfind('/');
+    return pos == 0 ? "/" : path.substr(0, pos);
+}
+
+// Reads dir once to find which of its files are gone, rather than
+// checking each file on its own.
+static void check_directory(const std::string &dir, PruneDir &state) {
+    if (state.files.empty()) {
+        // An ancestor of directories with media.
+        state.scanblock = has_scanblock(dir);
+        return;
+    }
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr) {
+        if (errno == ENOENT || errno == ENOTDIR) {
+            state.gone = state.files;
+            return;
+        }
+        // Not readable, but its files might still be accessible.
+        for (const auto &f : state.files) {
+            if (access(f.c_str(), F_OK) != 0) {
+                state.gone.push_back(f);
+            }
+        }
+        state.scanblock = has_scanblock(dir);
+        return;
+    }
+    std::unordered_set<std::string> names;
+    while (struct dirent *entry = readdir(d)) {
+        names.insert(entry->d_name);
+    }
+    closedir(d);
+    state.scanblock = names.count(".nomedia") != 0 && has_scanblock(dir);
+    for (const auto &f : state.files) {
+        if (names.count(f.substr(f.rfind('/') + 1)) == 0) {
+            state.gone.push_back(f);
+        }
     }
 }
 
 void MediaStorePrivate::pruneDeleted() {
-    std::map<std::string, bool> path_cache;
+    const auto start = std::chrono::steady_clock::now();
+
+    // Group the files by directory, along with every ancestor
+    // directory, which may hold a scan block.
+    std::map<std::string, PruneDir> dirs;
+    {
+        ReadLease conn = reader();
+        // Files of offline volumes are expected to be missing.
+        Statement query(conn->db, conn->stmt_cache, (std::string("SELECT filename FROM media WHERE 1") + conn->online_filter()).c_str());
+        while (query.step()) {
+            const string filename = query.getText(0);
+            dirs[parent_dir(filename)].files.push_back(filename);
+        }
+    }
+    vector<string> media_dirs;
+    for (const auto &d : dirs) {
+        media_dirs.push_back(d.first);
+    }
+    for (auto dir : media_dirs) {
+        while (dir != "/") {
+            dir = parent_dir(dir);
+            if (!dirs.emplace(dir, PruneDir()).second) {
+                break;
+            }
+        }
+    }
+
+    // The file system checks run without holding the store lock.
+    vector<std::pair<const std::string, PruneDir>*> work;
+    for (auto &d : dirs) {
+        work.push_back(&d);
+    }
+    std::atomic<size_t> next(0);
+    auto worker = [&work, &next]() {
+        for (size_t i = next++; i < work.size(); i = next++) {
+            check_directory(work[i]->first, work[i]->second);
+        }
+    };
+    const unsigned threads = std::min<size_t>(
+        std::min(std::max(std::thread::hardware_concurrency(), 1u), PRUNE_THREADS),
+        work.size());
+    vector<std::thread> workers;
+    for (unsigned i = 1; i < threads; i++) {
+        workers.emplace_back(worker);
+    }
+    worker();
+    for (auto &t : workers) {
+        t.join();
+    }
+
+    // Parents sort before their children, so their state is known.
     vector<string> deleted;
-    Statement query(db, "SELECT filename FROM media");
-    while (query.step()) {
-        const string filename = query.getText(0);
-        if (access(filename.c_str(), F_OK) != 0 ||
-            has_block_in_path(path_cache, filename)) {
-            deleted.push_back(filename);
-            continue;
+    vector<string> blocked;
+    for (auto &d : dirs) {
+        PruneDir &state = d.second;
+        state.blocked = state.scanblock || (d.first != "/" && dirs[parent_dir(d.first)].blocked);
+        if (state.blocked) {
+            blocked.insert(blocked.end(), state.files.begin(), state.files.end());
+        } else {
+            deleted.insert(deleted.end(), state.gone.begin(), state.gone.end());
         }
     }
-    query.finalize();
-    printf("%d files deleted from disk or in scanblocked directories.\n", (int)deleted.size());
-    for(const auto &i : deleted) {
-        remove(i);
+    const size_t count = deleted.size() + blocked.size();
+
+    // Remove in batches, letting other writers in between.
+    deleted.insert(deleted.end(), blocked.begin(), blocked.end());
+    for (size_t first = 0; first < deleted.size(); first += PRUNE_BATCH) {
+        const size_t rows = std::min(PRUNE_BATCH, deleted.size() - first);
+        std::lock_guard<std::mutex> lock(dbMutex);
+        execute_sql(db, "SAVEPOINT prune");
+        try {
+            Statement del(db, stmt_cache, ("DELETE FROM media WHERE filename IN " + placeholders(rows)).c_str());
+            for (size_t i = 0; i < rows; i++) {
+                del.bind(i + 1, deleted[first + i]);
+            }
+            del.step();
+        } catch (...) {
+            execute_sql(db, "ROLLBACK TO prune; RELEASE prune");
+            throw;
+        }
+        execute_sql(db, "RELEASE prune");
+        changed();
+
+        std::lock_guard<std::mutex> index_lock(indexMutex);
+        for (size_t i = 0; i < rows; i++) {
+            etag_index.remove(deleted[first + i]);
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(dbMutex);
+        pruneDictionaries();
+        pruneChanges();
     }
+
+    const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    printf("%zu files deleted from disk or in scanblocked directories (%zu directories checked in %.3f s).\n",
+           count, dirs.size(), elapsed.count());
+}
+
+// Replacing or removing files leaves names behind that no file uses
+// any more. They are harmless to queries, so they only get dropped
+// after bulk removals.
+void MediaStorePrivate::pruneDictionaries() const {
+    execute_sql(db, R"(
+DELETE FROM artists
+  WHERE NOT EXISTS (SELECT 1 FROM media WHERE artist_id = artists.id)
+    AND NOT EXISTS (SELECT 1 FROM media WHERE album_artist_id = artists.id)
+    AND id NOT IN (SELECT artist_id FROM media_attic WHERE artist_id IS NOT NULL
+                   UNION SELECT album_artist_id FROM media_attic WHERE album_artist_id IS NOT NULL);
+DELETE FROM genres
+  WHERE NOT EXISTS (SELECT 1 FROM media WHERE genre_id = genres.id)
+    AND id NOT IN (SELECT genre_id FROM media_attic WHERE genre_id IS NOT NULL);
+)");
 }
 
-void MediaStorePrivate::archiveItems(const std::string &prefix) {
-    const char *templ = R"(BEGIN TRANSACTION;
-INSERT INTO media_attic (filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type)
-  SELECT filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type
-    FROM media WHERE filename LIKE %s;
-DELETE FROM media WHERE filename LIKE %s;
-COMMIT;
-)";
-    string cond = sqlQuote(prefix + "%");
-    const size_t bufsize = 1024;
-    char cmd[bufsize];
-    snprintf(cmd, bufsize, templ, cond.c_str(), cond.c_str());
-    char *errmsg;
-    if(sqlite3_exec(db, cmd, nullptr, nullptr, &errmsg) != SQLITE_OK) {
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        throw runtime_error(errmsg);
+// Removed files stay in the change journal for this many changes,
+// which is how far back clients can sync without a full reload.
+static const int64_t CHANGE_JOURNAL_SPAN = 100000;
+
+void MediaStorePrivate::pruneChanges() const {
+    Statement latest(db, stmt_cache, "SELECT seq FROM sqlite_sequence WHERE name = 'media_changes'");
+    if (!latest.step() || latest.getInt64(0) <= CHANGE_JOURNAL_SPAN) {
+        return;
     }
+    const int64_t cutoff = latest.getInt64(0) - CHANGE_JOURNAL_SPAN;
+    latest.finalize();
+    Statement horizon(db, stmt_cache, R"(
+UPDATE media_changes_pruned
+  SET seq = (SELECT max(seq) FROM media_changes WHERE change = 2 AND seq <= ?1)
+  WHERE EXISTS (SELECT 1 FROM media_changes WHERE change = 2 AND seq <= ?1)
+)");
+    horizon.bind(1, cutoff);
+    horizon.step();
+    horizon.finalize();
+    Statement del(db, stmt_cache, "DELETE FROM media_changes WHERE change = 2 AND seq <= ?");
+    del.bind(1, cutoff);
+    del.step();
 }
 
-void MediaStorePrivate::restoreItems(const std::string &prefix) {
-    const char *templ = R"(BEGIN TRANSACTION;
-INSERT INTO media (filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type)
-  SELECT filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type
-    FROM media_attic WHERE filename LIKE %s;
-DELETE FROM media_attic WHERE filename LIKE %s;
-COMMIT;
-)";
-    string cond = sqlQuote(prefix + "%");
-    const size_t bufsize = 1024;
-    char cmd[bufsize];
-    snprintf(cmd, bufsize, templ, cond.c_str(), cond.c_str());
-    char *errmsg;
-    if(sqlite3_exec(db, cmd, nullptr, nullptr, &errmsg) != SQLITE_OK) {
-        sqlite3_exec(db, "ROLLBACK;", nullptr, nullptr, nullptr);
-        throw runtime_error(errmsg);
+int64_t MediaStorePrivate::pragma(const char *name) const {
+    Statement query(db, (std::string("PRAGMA ") + name).c_str());
+    query.step();
+    return query.getInt64(0);
+}
+
+// Work done per step of runMaintenance(): free pages handed back to
+// the file system, and pages of full text index segments merged.
+static const int VACUUM_PAGES = 256;
+static const int FTS_MERGE_PAGES = 64;
+
+// Share of free pages from which enableIncrementalVacuum() thinks a
+// rebuild worth it.
+static const int REBUILD_FREE_PERCENT = 25;
+
+bool MediaStorePrivate::enableIncrementalVacuum() {
+    if (pragma("auto_vacuum") != 0) {
+        return false;
+    }
+    const int64_t free_pages = pragma("freelist_count");
+    if (free_pages * 100 < pragma("page_count") * REBUILD_FREE_PERCENT) {
+        return false;
     }
+    printf("Rebuilding database to reclaim %lld free pages.\n", (long long)free_pages);
+    execute_sql(db, "PRAGMA auto_vacuum = INCREMENTAL");
+    execute_sql(db, "VACUUM");
+    return true;
+}
+
+// Merges the full text index down towards a single segment, as the
+// optimize command would, then truncates the free pages off the
+// file, a step at a time until the time is up. Every step is a
+// transaction of its own, so queries get in between. Databases
+// without incremental auto-vacuum only get their index merged.
+bool MediaStorePrivate::runMaintenance(int milliseconds) {
+    if (in_transaction) {
+        return true;
+    }
+    const auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(milliseconds);
+    const std::string merge = fts5 ?
+        "INSERT INTO media_fts(media_fts, rank) VALUES('merge', -" + std::to_string(FTS_MERGE_PAGES) + ")" :
+        "INSERT INTO media_fts(media_fts) VALUES('merge=" + std::to_string(FTS_MERGE_PAGES) + ",2')";
+    bool merging = true;
+    bool vacuuming = pragma("auto_vacuum") == 2; // INCREMENTAL
+    while ((merging || vacuuming) && std::chrono::steady_clock::now() < deadline) {
+        if (merging) {
+            // A merge that found nothing to do counts as one change.
+            const int before = sqlite3_total_changes(db);
+            execute_sql(db, merge);
+            merging = sqlite3_total_changes(db) - before >= 2;
+        } else {
+            execute_sql(db, "PRAGMA incremental_vacuum(" + std::to_string(VACUUM_PAGES) + ")");
+            vacuuming = pragma("freelist_count") > 0;
+        }
+    }
+    return merging || vacuuming;
+}
+
+// Marks the file names from start up to but not including end (or
+// all following ones if end is empty) as offline. A range already
+// starting at start is widened rather than replaced.
+static void add_offline_range(sqlite3 *db, StatementCache &stmt_cache,
+                              const std::string &start, std::string end) {
+    Statement existing(db, stmt_cache, "SELECT prefix_end FROM offline_volumes WHERE prefix = ?");
+    existing.bind(1, start);
+    if (existing.step() && !end.empty()) {
+        if (existing.isNull(0)) {
+            end.clear();
+        } else {
+            end = std::max(end, existing.getText(0));
+        }
+    }
+    existing.finalize();
+    Statement query(db, stmt_cache, "INSERT OR REPLACE INTO offline_volumes (prefix, prefix_end) VALUES (?, NULLIF(?, ''))");
+    query.bind(1, start);
+    query.bind(2, end);
+    query.step();
+}
 
+void MediaStorePrivate::archiveItems(const std::string &prefix) {
+    dropETagIndex();
+    execute_sql(db, "SAVEPOINT archive");
+    try {
+        // The files stay in media, only hidden from queries, so no
+        // trigger tells the change journal about them.
+        Statement gone(db, stmt_cache, ("INSERT OR REPLACE INTO media_changes (filename, change, type) SELECT filename, 2, type FROM media WHERE " + prefix_range(prefix) + online_filter()).c_str());
+        bind_prefix(gone, prefix);
+        gone.step();
+
+        add_offline_range(db, stmt_cache, prefix, prefixEnd(prefix));
+    } catch (...) {
+        execute_sql(db, "ROLLBACK TO archive; RELEASE archive");
+        throw;
+    }
+    execute_sql(db, "RELEASE archive");
+    changed();
+    volumesChanged();
 }
 
-void MediaStorePrivate::removeSubtree(const std::string &directory) {
-    string escaped = directory;
-    string::size_type pos = 0;
-    // Escape instances of like expression special characters and the escape character.
-    while (true) {
-        pos = escaped.find_first_of("%_!", pos);
-        if (pos == string::npos) {
-            break;
+void MediaStorePrivate::restoreItems(const std::string &prefix) {
+    dropETagIndex();
+    const string range = prefix_range(prefix);
+    const string end = prefixEnd(prefix);
+    execute_sql(db, "SAVEPOINT restore");
+    try {
+        // Only the files that were hidden come back.
+        Statement back(db, stmt_cache, ("INSERT OR REPLACE INTO media_changes (filename, change, type) SELECT filename, 0, type FROM media WHERE " + range + R"(
+  AND EXISTS (SELECT 1 FROM offline_volumes
+    WHERE prefix <= media.filename AND (prefix_end IS NULL OR media.filename < prefix_end)))").c_str());
+        bind_prefix(back, prefix);
+        back.step();
+        back.finalize();
+
+        // Take the restored range out of every offline range that
+        // overlaps it. One that also covers names before or after it,
+        // such as /media/ when a volume below it gets mounted, is split
+        // into what remains on either side.
+        std::vector<std::pair<string, string>> overlapping;
+        Statement select(db, stmt_cache, end.empty()
+            ? "SELECT prefix, prefix_end FROM offline_volumes WHERE prefix_end IS NULL OR prefix_end > ?"
+            : "SELECT prefix, prefix_end FROM offline_volumes WHERE (prefix_end IS NULL OR prefix_end > ?) AND prefix < ?");
+        select.bind(1, prefix);
+        if (!end.empty()) {
+            select.bind(2, end);
         }
-        escaped.replace(pos, 0, "!");
-        pos += 2;
-    }
-    if (escaped.empty() || escaped[escaped.size() - 1] != '/') {
-        escaped += '/';
+        while (select.step()) {
+            overlapping.emplace_back(select.getText(0), select.isNull(1) ? string() : select.getText(1));
+        }
+        select.finalize();
+        for (const auto &r : overlapping) {
+            Statement del(db, stmt_cache, "DELETE FROM offline_volumes WHERE prefix = ?");
+            del.bind(1, r.first);
+            del.step();
+        }
+        for (const auto &r : overlapping) {
+            if (r.first < prefix) {
+                add_offline_range(db, stmt_cache, r.first, prefix);
+            }
+            if (!end.empty() && (r.second.empty() || r.second > end)) {
+                add_offline_range(db, stmt_cache, end, r.second);
+            }
+        }
+
+        // Files archived by older versions.
+        Statement copy(db, stmt_cache, (R"(
+INSERT INTO media (filename, content_type, etag, title, date, artist, album, album_artist, genre, disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type, artist_id, album_artist_id, genre_id, date_epoch)
+  SELECT filename, content_type, etag, title, date,
+      (SELECT name FROM artists WHERE id = media_attic.artist_id), album,
+      (SELECT name FROM artists WHERE id = media_attic.album_artist_id),
+      (SELECT name FROM genres WHERE id = media_attic.genre_id),
+      disc_number, track_number, duration, width, height, latitude, longitude, has_thumbnail, mtime, type, artist_id, album_artist_id, genre_id, to_epoch(date)
+    FROM media_attic WHERE )" + range).c_str());
+        bind_prefix(copy, prefix);
+        copy.step();
+        Statement del(db, stmt_cache, ("DELETE FROM media_attic WHERE " + range).c_str());
+        bind_prefix(del, prefix);
+        del.step();
+    } catch (...) {
+        execute_sql(db, "ROLLBACK TO restore; RELEASE restore");
+        throw;
     }
-    escaped += '%';
+    execute_sql(db, "RELEASE restore");
+    changed();
+    volumesChanged();
+}
 
-    Statement query(db, "DELETE FROM media WHERE filename LIKE ? ESCAPE '!'");
-    query.bind(1, escaped);
+void MediaStorePrivate::removeSubtree(const std::string &directory) {
+    string prefix = directory;
+    if (prefix.empty() || prefix[prefix.size() - 1] != '/') {
+        prefix += '/';
+    }
+    Statement query(db, stmt_cache, ("DELETE FROM media WHERE " + prefix_range(prefix)).c_str());
+    bind_prefix(query, prefix);
     query.step();
+    query.finalize();
+    changed();
+    pruneDictionaries();
+
+    std::lock_guard<std::mutex> lock(indexMutex);
+    etag_index.removeSubtree(directory);
+}
+
+void MediaStorePrivate::loadETagIndex(const std::string &prefix) {
+    std::lock_guard<std::mutex> lock(indexMutex);
+    etag_index.load(db, prefix);
+    printf("Loaded etags of %zu files below %s.\n", etag_index.size(), prefix.c_str());
+}
+
+void MediaStorePrivate::dropETagIndex() {
+    std::lock_guard<std::mutex> lock(indexMutex);
+    etag_index.clear();
 }
 
 void MediaStorePrivate::begin() {
-    Statement query(db, "BEGIN TRANSACTION");
+    Statement query(db, stmt_cache, "BEGIN TRANSACTION");
     query.step();
+    changes_at_begin = sqlite3_total_changes(db);
 }
 
 void MediaStorePrivate::commit() {
-    Statement query(db, "COMMIT TRANSACTION");
+    Statement query(db, stmt_cache, "COMMIT TRANSACTION");
     query.step();
+    // Pooled readers only see the changes from now on.
+    changed();
+    volumesChanged();
 }
 
 void MediaStorePrivate::rollback() {
-    Statement query(db, "ROLLBACK TRANSACTION");
+    // The index may hold changes that are being rolled back. A
+    // transaction ended without changes since its last commit, as
+    // MediaStoreTransaction's destructor does, keeps it.
+    if (sqlite3_total_changes(db) != changes_at_begin) {
+        dropETagIndex();
+    }
+    Statement query(db, stmt_cache, "ROLLBACK TRANSACTION");
     query.step();
+    changed();
+    volumesChanged();
 }
 
 void MediaStore::insert(const MediaFile &m) const {
@@ -1001,6 +2724,11 @@ void MediaStore::insert(const MediaFile &m) const {
     p->insert(m);
 }
 
+void MediaStore::insertBatch(std::vector<MediaFile> &&files) const {
+    std::lock_guard<std::mutex> lock(p->dbMutex);
+    p->insertBatch(std::move(files));
+}
+
 void MediaStore::remove(const std::string &fname) const {
     std::lock_guard<std::mutex> lock(p->dbMutex);
     p->remove(fname);
@@ -1017,77 +2745,176 @@ void MediaStore::remove_broken_file(const std::string &fname) const {
 }
 
 bool MediaStore::is_broken_file(const std::string &fname, const std::string &etag) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->is_broken_file(fname, etag);
+    {
+        std::lock_guard<std::mutex> lock(p->indexMutex);
+        if (p->etag_index.covers(fname)) {
+            return p->etag_index.isBroken(fname, etag);
+        }
+    }
+    return p->reader()->is_broken_file(fname, etag);
+}
+
+std::vector<MediaFile> MediaStore::lookupFingerprint(const std::string &fingerprint) const {
+    if (fingerprint.empty()) {
+        return std::vector<MediaFile>();
+    }
+    return p->reader()->lookupFingerprint(fingerprint);
 }
 
 MediaFile MediaStore::lookup(const std::string &filename) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->lookup(filename);
+    return p->reader()->lookup(filename);
 }
 
 std::vector<MediaFile> MediaStore::query(const std::string &q, MediaType type, const Filter &filter) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->query(q, type, filter);
+    return p->cached<MediaFile>('q', q, type, filter, [&](const MediaStoreConnection &conn) {
+        return conn.query(q, type, filter);
+    });
+}
+
+std::vector<MediaFile> MediaStore::queryRegion(const BoundingBox &region, MediaType type, const Filter &filter) const {
+    // Exact, so that close boxes don't share cached results.
+    char box[128];
+    snprintf(box, sizeof(box), "%a,%a,%a,%a", region.south, region.west, region.north, region.east);
+    return p->cached<MediaFile>('R', box, type, filter, [&](const MediaStoreConnection &conn) {
+        return conn.queryRegion(region, type, filter);
+    });
 }
 
 std::vector<Album> MediaStore::queryAlbums(const std::string &core_term, const Filter &filter) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->queryAlbums(core_term, filter);
+    return p->cached<Album>('Q', core_term, AudioMedia, filter, [&](const MediaStoreConnection &conn) {
+        return conn.queryAlbums(core_term, filter);
+    });
 }
 
 std::vector<string> MediaStore::queryArtists(const std::string &q, const Filter &filter) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->queryArtists(q, filter);
+    return p->cached<string>('r', q, AudioMedia, filter, [&](const MediaStoreConnection &conn) {
+        return conn.queryArtists(q, filter);
+    });
 }
 
 std::vector<MediaFile> MediaStore::getAlbumSongs(const Album& album) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->getAlbumSongs(album);
+    return p->reader()->getAlbumSongs(album);
 }
 
 std::string MediaStore::getETag(const std::string &filename) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->getETag(filename);
+    {
+        std::lock_guard<std::mutex> lock(p->indexMutex);
+        if (p->etag_index.covers(filename)) {
+            return p->etag_index.getETag(filename);
+        }
+    }
+    return p->reader()->getETag(filename);
 }
 
 std::vector<MediaFile> MediaStore::listSongs(const Filter &filter) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->listSongs(filter);
+    return p->cached<MediaFile>('s', "", AudioMedia, filter, [&](const MediaStoreConnection &conn) {
+        return conn.listSongs(filter);
+    });
+}
+
+void MediaStore::forEachMedia(const std::string &q, MediaType type, const Filter &filter, const MediaVisitor &visit) const {
+    p->reader()->query(q, type, filter, visit);
+}
+
+void MediaStore::forEachSong(const Filter &filter, const MediaVisitor &visit) const {
+    p->reader()->listSongs(filter, visit);
 }
 
 std::vector<Album> MediaStore::listAlbums(const Filter &filter) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->listAlbums(filter);
+    return p->cached<Album>('a', "", AudioMedia, filter, [&](const MediaStoreConnection &conn) {
+        return conn.listAlbums(filter);
+    });
 }
 
 std::vector<std::string> MediaStore::listArtists(const Filter &filter) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->listArtists(filter);
+    return p->cached<string>('A', "", AudioMedia, filter, [&](const MediaStoreConnection &conn) {
+        return conn.listArtists(filter);
+    });
 }
 
 std::vector<std::string> MediaStore::listAlbumArtists(const Filter &filter) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->listAlbumArtists(filter);
+    return p->cached<string>('b', "", AudioMedia, filter, [&](const MediaStoreConnection &conn) {
+        return conn.listAlbumArtists(filter);
+    });
 }
 
 std::vector<std::string> MediaStore::listGenres(const Filter &filter) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->listGenres(filter);
+    return p->cached<string>('g', "", AudioMedia, filter, [&](const MediaStoreConnection &conn) {
+        return conn.listGenres(filter);
+    });
 }
 
 bool MediaStore::hasMedia(MediaType type) const {
-    std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->hasMedia(type);
+    return p->reader()->hasMedia(type);
+}
+
+size_t MediaStore::count(MediaType type, const Filter &filter) const {
+    return p->reader()->count(type, filter);
+}
+
+Facets MediaStore::facets(const Filter &filter) const {
+    return p->reader()->facets(filter);
+}
+
+std::vector<MediaFile> MediaStore::listDateRange(MediaType type, int64_t start, int64_t end, const Filter &filter) const {
+    const std::string range = encodeCursor('t', {std::to_string(start), std::to_string(end)});
+    return p->cached<MediaFile>('d', range, type, filter, [&](const MediaStoreConnection &conn) {
+        return conn.listDateRange(type, start, end, filter);
+    });
+}
+
+std::vector<DateCount> MediaStore::countByDate(MediaType type, DateBucket bucket, int64_t start, int64_t end) const {
+    return p->reader()->countByDate(type, bucket, start, end);
+}
+
+std::vector<std::vector<MediaFile>> MediaStore::listDuplicates(MediaType type, const Filter &filter) const {
+    return p->reader()->listDuplicates(type, filter);
+}
+
+MediaChanges MediaStore::changesSince(MediaType type, uint64_t sequence) const {
+    return p->reader()->changesSince(type, sequence);
+}
+
+AsyncResult<vector<MediaFile>> MediaStore::queryAsync(const std::string &q, MediaType type, const Filter &filter) const {
+    return p->runAsync<vector<MediaFile>>([q, type, filter](const MediaStoreConnection &conn) {
+        return conn.query(q, type, filter);
+    });
+}
+
+AsyncResult<vector<MediaFile>> MediaStore::listSongsAsync(const Filter &filter) const {
+    return p->runAsync<vector<MediaFile>>([filter](const MediaStoreConnection &conn) {
+        return conn.listSongs(filter);
+    });
 }
 
 size_t MediaStore::size() const {
+    return p->reader()->size();
+}
+
+uint64_t MediaStore::statementCacheHits() const {
     std::lock_guard<std::mutex> lock(p->dbMutex);
-    return p->size();
+    return p->stmt_cache.getHits();
 }
 
-void MediaStore::pruneDeleted() {
+uint64_t MediaStore::statementCacheMisses() const {
     std::lock_guard<std::mutex> lock(p->dbMutex);
+    return p->stmt_cache.getMisses();
+}
+
+uint64_t MediaStore::resultCacheHits() const {
+    return p->result_cache ? p->result_cache->hits() : 0;
+}
+
+uint64_t MediaStore::resultCacheMisses() const {
+    return p->result_cache ? p->result_cache->misses() : 0;
+}
+
+size_t MediaStore::resultCacheMemory() const {
+    return p->result_cache ? p->result_cache->memoryUsage() : 0;
+}
+
+void MediaStore::pruneDeleted() {
+    // Takes the lock itself, only while reading and writing.
     p->pruneDeleted();
 }
 
@@ -1106,9 +2933,40 @@ void MediaStore::removeSubtree(const std::string &directory) {
     p->removeSubtree(directory);
 }
 
+bool MediaStore::runMaintenance(int milliseconds) {
+    std::lock_guard<std::mutex> lock(p->dbMutex);
+    return p->runMaintenance(milliseconds);
+}
+
+bool MediaStore::enableIncrementalVacuum() {
+    std::lock_guard<std::mutex> lock(p->dbMutex);
+    return p->enableIncrementalVacuum();
+}
+
+void MediaStore::loadETagIndex(const std::string &prefix) {
+    std::lock_guard<std::mutex> lock(p->dbMutex);
+    p->loadETagIndex(prefix);
+}
+
+void MediaStore::dropETagIndex() {
+    std::lock_guard<std::mutex> lock(p->dbMutex);
+    p->dropETagIndex();
+}
+
+void MediaStore::beginBulkLoad() {
+    std::lock_guard<std::mutex> lock(p->dbMutex);
+    set_synchronous(p->db, p->bulk_synchronous);
+}
+
+void MediaStore::endBulkLoad() {
+    std::lock_guard<std::mutex> lock(p->dbMutex);
+    set_synchronous(p->db, p->synchronous);
+}
+
 MediaStoreTransaction MediaStore::beginTransaction() {
     std::lock_guard<std::mutex> lock(p->dbMutex);
     p->begin();
+    p->in_transaction = true;
     return MediaStoreTransaction(p);
 }
 
@@ -1125,6 +2983,7 @@ MediaStoreTransaction::~MediaStoreTransaction() {
         return;
     }
     std::lock_guard<std::mutex> lock(p->dbMutex);
+    p->in_transaction = false;
     try {
         p->rollback();
     } catch (const std::exception &e) {
@@ -20,7 +20,10 @@
 #ifndef MEDIASTORE_HH_
 #define MEDIASTORE_HH_
 
+#include "MediaFileView.hh"
 #include "MediaStoreBase.hh"
+#include "MediaStoreOptions.hh"
+#include<cstdint>
 #include<vector>
 #include<string>
 
@@ -41,11 +44,19 @@ private:
 public:
     MediaStore(OpenType access, const std::string &retireprefix="");
     MediaStore(const std::string &filename, OpenType access, const std::string &retireprefix="");
+    MediaStore(OpenType access, const MediaStoreOptions &options, const std::string &retireprefix="");
+    MediaStore(const std::string &filename, OpenType access, const MediaStoreOptions &options, const std::string &retireprefix="");
     MediaStore(const MediaStore &other) = delete;
     MediaStore& operator=(const MediaStore &other) = delete;
     virtual ~MediaStore();
 
     void insert(const MediaFile &m) const;
+    // Insert many files at once. Faster than calling insert() for
+    // each of them, as rows are written several per statement and
+    // the full text index is updated once for the whole batch. If
+    // that fails, none of the files are stored and files is left as
+    // it was, so that the caller can insert() them one by one.
+    void insertBatch(std::vector<MediaFile> &&files) const;
     void remove(const std::string &fname) const;
 
     // Maintain a list of files known to crash GStreamer
@@ -53,8 +64,12 @@ public:
     void insert_broken_file(const std::string &fname, const std::string &etag) const;
     void remove_broken_file(const std::string &fname) const;
     bool is_broken_file(const std::string &fname, const std::string &etag) const;
+    // The files with a fingerprint, including those on volumes that
+    // are not mounted, so that a copy of one needs no extraction.
+    std::vector<MediaFile> lookupFingerprint(const std::string &fingerprint) const;
     virtual MediaFile lookup(const std::string &filename) const override;
     virtual std::vector<MediaFile> query(const std::string &q, MediaType type, const Filter &filter) const override;
+    virtual std::vector<MediaFile> queryRegion(const BoundingBox &region, MediaType type, const Filter &filter) const override;
     virtual std::vector<Album> queryAlbums(const std::string &core_term, const Filter &filter) const override;
     virtual std::vector<std::string> queryArtists(const std::string &q, const Filter &filter) const override;
     virtual std::vector<MediaFile> getAlbumSongs(const Album& album) const override;
@@ -65,12 +80,61 @@ public:
     virtual std::vector<std::string>listAlbumArtists(const Filter &filter) const override;
     virtual std::vector<std::string>listGenres(const Filter &filter) const override;
     virtual bool hasMedia(MediaType type) const override;
+    virtual size_t count(MediaType type, const Filter &filter) const override;
+    virtual Facets facets(const Filter &filter) const override;
+    virtual std::vector<MediaFile> listDateRange(MediaType type, int64_t start, int64_t end, const Filter &filter) const override;
+    virtual std::vector<DateCount> countByDate(MediaType type, DateBucket bucket, int64_t start, int64_t end) const override;
+    virtual std::vector<std::vector<MediaFile>> listDuplicates(MediaType type, const Filter &filter) const override;
+    virtual MediaChanges changesSince(MediaType type, uint64_t sequence) const override;
+    // Stopped within a few milliseconds when cancelled, by
+    // interrupting the SQLite statement. Not cached.
+    virtual AsyncResult<std::vector<MediaFile>> queryAsync(const std::string &q, MediaType type, const Filter &filter) const override;
+    virtual AsyncResult<std::vector<MediaFile>> listSongsAsync(const Filter &filter) const override;
+
+    // Pass the results of query() and listSongs() to visit one at a
+    // time, without building a vector of them, until visit returns
+    // false. Not cached. visit must not call back into the store.
+    void forEachMedia(const std::string &q, MediaType type, const Filter &filter, const MediaVisitor &visit) const;
+    void forEachSong(const Filter &filter, const MediaVisitor &visit) const;
 
     size_t size() const;
+    // Prepared statement reuse counters, for diagnostics.
+    uint64_t statementCacheHits() const;
+    uint64_t statementCacheMisses() const;
+    // Result cache counters and the memory held by cached results,
+    // see MediaStoreOptions::setResultCacheSize().
+    uint64_t resultCacheHits() const;
+    uint64_t resultCacheMisses() const;
+    size_t resultCacheMemory() const;
     void pruneDeleted();
     void archiveItems(const std::string &prefix);
     void restoreItems(const std::string &prefix);
     void removeSubtree(const std::string &directory);
+    // Tidies the database up for about the given time: merges the
+    // full text index and shrinks the file by the pages that deleted
+    // rows left free. Returns true if there is more to do, to be done
+    // by further calls. Meant to be called when the store is idle.
+    // Databases created by older versions are only shrunk once
+    // enableIncrementalVacuum() has switched them over.
+    bool runMaintenance(int milliseconds);
+    // Rebuilds a database created without incremental auto-vacuum so
+    // that runMaintenance() can shrink it, if at least a quarter of
+    // its pages are free. The rebuild takes time in proportion to the
+    // size of the database and up to twice its disk space, so call it
+    // at startup rather than from an idle handler. Returns true if the
+    // database was rebuilt.
+    bool enableIncrementalVacuum();
+
+    // Keep the etags and broken file state of all files below
+    // prefix in memory, so that getETag() and is_broken_file() can
+    // answer for them without a query. Replaces any earlier index.
+    void loadETagIndex(const std::string &prefix);
+    void dropETagIndex();
+    // Switch to and back from the durability set with
+    // MediaStoreOptions::setBulkLoadSynchronous(). SQLite only allows
+    // this outside of transactions.
+    void beginBulkLoad();
+    void endBulkLoad();
     MediaStoreTransaction beginTransaction();
 };
 
@@ -18,6 +18,10 @@
  */
 
 #include "MediaStoreBase.hh"
+#include "Filter.hh"
+#include "MediaFile.hh"
+
+using namespace std;
 
 namespace mediascanner {
 
@@ -27,4 +31,26 @@ MediaStoreBase::MediaStoreBase() {
 MediaStoreBase::~MediaStoreBase() {
 }
 
+AsyncResult<vector<MediaFile>> MediaStoreBase::queryAsync(const string &q, MediaType type, const Filter &filter) const {
+    auto state = make_shared<AsyncQuery>();
+    auto future = async(launch::async, [this, state, q, type, filter]() {
+        if (state->isCancelled()) {
+            throw QueryCancelled();
+        }
+        return query(q, type, filter);
+    });
+    return AsyncResult<vector<MediaFile>>(move(future), state);
+}
+
+AsyncResult<vector<MediaFile>> MediaStoreBase::listSongsAsync(const Filter &filter) const {
+    auto state = make_shared<AsyncQuery>();
+    auto future = async(launch::async, [this, state, filter]() {
+        if (state->isCancelled()) {
+            throw QueryCancelled();
+        }
+        return listSongs(filter);
+    });
+    return AsyncResult<vector<MediaFile>>(move(future), state);
+}
+
 }
@@ -21,6 +21,11 @@
 #define MEDIASTOREBASE_HH_
 
 #include"scannercore.hh"
+#include"AsyncResult.hh"
+#include"BoundingBox.hh"
+#include"Facets.hh"
+#include"MediaChanges.hh"
+#include"Timeline.hh"
 #include<vector>
 #include<string>
 
@@ -50,6 +55,48 @@ public:
     virtual std::vector<std::string>listAlbumArtists(const Filter &filter) const = 0;
     virtual std::vector<std::string>listGenres(const Filter &filter) const = 0;
     virtual bool hasMedia(MediaType type) const = 0;
+
+    // Added in soversion 5. New virtual methods go at the end, so that
+    // the existing ones keep their vtable slots, and need a soversion
+    // bump in get-soversion.sh.
+
+    // The located files of a type within region, sorted and paged as
+    // query() does without a search term.
+    virtual std::vector<MediaFile> queryRegion(const BoundingBox &region, MediaType type, const Filter &filter) const = 0;
+    // The number of files of a type matching the artist, album, album
+    // artist and genre of filter, ignoring its paging. AllMedia counts
+    // files of any type.
+    virtual size_t count(MediaType type, const Filter &filter) const = 0;
+    // Song counts per genre, artist and album artist for the songs
+    // matching filter, as count() does, found in one pass.
+    virtual Facets facets(const Filter &filter) const = 0;
+    // The files of a type dated from start up to but not including end,
+    // in seconds since the epoch, oldest first (newest first if the
+    // filter is reversed). The order of the filter is ignored, its
+    // paging and cursor are not. Dates without a time zone count as
+    // UTC.
+    virtual std::vector<MediaFile> listDateRange(MediaType type, int64_t start, int64_t end, const Filter &filter) const = 0;
+    // The number of files of a type per day, month or year from start
+    // up to end, oldest first, leaving out empty periods.
+    virtual std::vector<DateCount> countByDate(MediaType type, DateBucket bucket, int64_t start, int64_t end) const = 0;
+    // Groups of files of a type with the same fingerprint, and so most
+    // likely the same content, each ordered by filename. Limit and
+    // offset of the filter count groups; its order and cursor are
+    // ignored.
+    virtual std::vector<std::vector<MediaFile>> listDuplicates(MediaType type, const Filter &filter) const = 0;
+    // The files of a type (or any type for AllMedia) added, modified or
+    // removed since sequence, as recorded by the change journal. A
+    // client about to load everything takes the sequence number to
+    // continue from out of changesSince(type, UINT64_MAX) beforehand.
+    virtual MediaChanges changesSince(MediaType type, uint64_t sequence) const = 0;
+
+    // query() and listSongs() run in the background, so they can be
+    // cancelled. The default implementations make the blocking call
+    // on a thread of their own and, when cancelled, only drop its
+    // result. The store must outlive the result; MediaStore instead
+    // cancels its unfinished queries and waits for them when destroyed.
+    virtual AsyncResult<std::vector<MediaFile>> queryAsync(const std::string &q, MediaType type, const Filter &filter) const;
+    virtual AsyncResult<std::vector<MediaFile>> listSongsAsync(const Filter &filter) const;
 };
 
 }
@@ -0,0 +1,163 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "MediaStoreOptions.hh"
+
+#include <stdexcept>
+#include <utility>
+
+namespace mediascanner {
+
+struct MediaStoreOptions::Private {
+    bool wal = false;
+    int read_connections = 0;
+    FullTextBackend fts_backend = FullTextBackend::FTS4;
+    size_t result_cache_size = 0;
+    int64_t mmap_size = 0;
+    int cache_size = 0;
+    int page_size = 0;
+    TempStore temp_store = TempStore::Default;
+    SyncLevel synchronous = SyncLevel::Full;
+    bool bulk_synchronous_set = false;
+    SyncLevel bulk_synchronous = SyncLevel::Full;
+
+    Private() {}
+};
+
+MediaStoreOptions::MediaStoreOptions() : p(new Private) {
+}
+
+MediaStoreOptions::MediaStoreOptions(const MediaStoreOptions &other) : MediaStoreOptions() {
+    *p = *other.p;
+}
+
+MediaStoreOptions::MediaStoreOptions(MediaStoreOptions &&other) : p(nullptr) {
+    *this = std::move(other);
+}
+
+MediaStoreOptions::~MediaStoreOptions() {
+    delete p;
+}
+
+MediaStoreOptions &MediaStoreOptions::operator=(const MediaStoreOptions &other) {
+    *p = *other.p;
+    return *this;
+}
+
+MediaStoreOptions &MediaStoreOptions::operator=(MediaStoreOptions &&other) {
+    if (this != &other) {
+        delete p;
+        p = other.p;
+        other.p = nullptr;
+    }
+    return *this;
+}
+
+void MediaStoreOptions::setWriteAheadLog(bool wal) {
+    p->wal = wal;
+}
+
+bool MediaStoreOptions::getWriteAheadLog() const {
+    return p->wal;
+}
+
+void MediaStoreOptions::setReadConnections(int count) {
+    if (count < 0) {
+        throw std::invalid_argument("Read connection count must not be negative");
+    }
+    p->read_connections = count;
+}
+
+int MediaStoreOptions::getReadConnections() const {
+    return p->read_connections;
+}
+
+void MediaStoreOptions::setFullTextBackend(FullTextBackend backend) {
+    p->fts_backend = backend;
+}
+
+FullTextBackend MediaStoreOptions::getFullTextBackend() const {
+    return p->fts_backend;
+}
+
+void MediaStoreOptions::setResultCacheSize(size_t bytes) {
+    p->result_cache_size = bytes;
+}
+
+size_t MediaStoreOptions::getResultCacheSize() const {
+    return p->result_cache_size;
+}
+
+void MediaStoreOptions::setMmapSize(int64_t bytes) {
+    if (bytes < 0) {
+        throw std::invalid_argument("Mmap size must not be negative");
+    }
+    p->mmap_size = bytes;
+}
+
+int64_t MediaStoreOptions::getMmapSize() const {
+    return p->mmap_size;
+}
+
+void MediaStoreOptions::setCacheSize(int kibibytes) {
+    if (kibibytes < 0) {
+        throw std::invalid_argument("Cache size must not be negative");
+    }
+    p->cache_size = kibibytes;
+}
+
+int MediaStoreOptions::getCacheSize() const {
+    return p->cache_size;
+}
+
+void MediaStoreOptions::setPageSize(int bytes) {
+    // SQLite page sizes are powers of two from 512 to 65536 bytes.
+    if (bytes != 0 && (bytes < 512 || bytes > 65536 || (bytes & (bytes - 1)) != 0)) {
+        throw std::invalid_argument("Page size must be a power of two between 512 and 65536");
+    }
+    p->page_size = bytes;
+}
+
+int MediaStoreOptions::getPageSize() const {
+    return p->page_size;
+}
+
+void MediaStoreOptions::setTempStore(TempStore store) {
+    p->temp_store = store;
+}
+
+TempStore MediaStoreOptions::getTempStore() const {
+    return p->temp_store;
+}
+
+void MediaStoreOptions::setSynchronous(SyncLevel level) {
+    p->synchronous = level;
+}
+
+SyncLevel MediaStoreOptions::getSynchronous() const {
+    return p->synchronous;
+}
+
+void MediaStoreOptions::setBulkLoadSynchronous(SyncLevel level) {
+    p->bulk_synchronous_set = true;
+    p->bulk_synchronous = level;
+}
+
+SyncLevel MediaStoreOptions::getBulkLoadSynchronous() const {
+    return p->bulk_synchronous_set ? p->bulk_synchronous : p->synchronous;
+}
+
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEDIASTOREOPTIONS_HH_
+#define MEDIASTOREOPTIONS_HH_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mediascanner {
+
+// Full text index implementation used for searches.
+enum class FullTextBackend {
+    FTS4,
+    // Prefix indexes for short search terms and bm25 ranking.
+    FTS5,
+};
+
+// How hard SQLite works to make commits durable, see PRAGMA synchronous.
+enum class SyncLevel {
+    Off,
+    Normal,
+    Full,
+};
+
+// Where SQLite keeps temporary tables and indices, see PRAGMA temp_store.
+enum class TempStore {
+    Default,
+    File,
+    Memory,
+};
+
+/**
+ * Tunables that control how a MediaStore opens and uses its
+ * database. The defaults match the behaviour of a MediaStore
+ * constructed without options.
+ */
+class MediaStoreOptions final {
+public:
+    MediaStoreOptions();
+    MediaStoreOptions(const MediaStoreOptions &other);
+    MediaStoreOptions(MediaStoreOptions &&other);
+    ~MediaStoreOptions();
+
+    MediaStoreOptions &operator=(const MediaStoreOptions &other);
+    MediaStoreOptions &operator=(MediaStoreOptions &&other);
+
+    // Put a read-write database into write-ahead log mode, so that
+    // readers see the last committed state without waiting for the
+    // writer. Readers pick up the journal mode from the database file
+    // and ignore this setting.
+    void setWriteAheadLog(bool wal);
+    bool getWriteAheadLog() const;
+
+    // Number of extra read only connections used to run queries in
+    // parallel. Only used by read only stores and by read-write stores
+    // in WAL mode; otherwise all queries share the main connection.
+    void setReadConnections(int count);
+    int getReadConnections() const;
+
+    // Full text index to create along with a new database. Existing
+    // databases keep the index they were created with.
+    void setFullTextBackend(FullTextBackend backend);
+    FullTextBackend getFullTextBackend() const;
+
+    // Memory in bytes for keeping the results of recent queries and
+    // listings, which are returned again until the store changes.
+    // Zero, the default, disables the cache.
+    void setResultCacheSize(size_t bytes);
+    size_t getResultCacheSize() const;
+
+    // Bytes of the database to access through memory mapped I/O. Zero,
+    // the default, reads through the page cache only.
+    void setMmapSize(int64_t bytes);
+    int64_t getMmapSize() const;
+
+    // Page cache size of each connection in KiB. Zero keeps the SQLite
+    // default.
+    void setCacheSize(int kibibytes);
+    int getCacheSize() const;
+
+    // Page size in bytes for a new database. Existing databases keep
+    // theirs. Zero keeps the SQLite default.
+    void setPageSize(int bytes);
+    int getPageSize() const;
+
+    void setTempStore(TempStore store);
+    TempStore getTempStore() const;
+
+    // Durability of commits to a read-write database. Defaults to
+    // SyncLevel::Full.
+    void setSynchronous(SyncLevel level);
+    SyncLevel getSynchronous() const;
+
+    // Durability between MediaStore::beginBulkLoad() and endBulkLoad(),
+    // e.g. during an initial scan that can simply be redone after a
+    // crash. Defaults to the same as setSynchronous(). Note that with
+    // SyncLevel::Off a power loss or system crash can corrupt the
+    // database, not just lose the last commits.
+    void setBulkLoadSynchronous(SyncLevel level);
+    SyncLevel getBulkLoadSynchronous() const;
+
+private:
+    struct Private;
+    Private *p;
+};
+
+}
+
+#endif
@@ -0,0 +1,133 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "internal/ResultCache.hh"
+#include "Album.hh"
+#include "MediaFile.hh"
+#include "internal/MediaFilePrivate.hh"
+
+#include <unordered_set>
+
+using namespace std;
+
+namespace mediascanner {
+
+size_t resultBytes(const vector<MediaFile> &result) {
+    size_t bytes = sizeof(result) + result.size() * (sizeof(MediaFile) + sizeof(MediaFilePrivate));
+    // Strings shared between the files through a StringPool count once.
+    unordered_set<const string*> shared;
+    auto shared_bytes = [&shared](const string &s) -> size_t {
+        if (s.empty() || !shared.insert(&s).second) {
+            return 0;
+        }
+        return sizeof(string) + s.size();
+    };
+    for (const auto &m : result) {
+        bytes += m.getFileName().size() + m.getETag().size() +
+            m.getTitle().size() + m.getDate().size() + m.getFingerprint().size() +
+            shared_bytes(m.getContentType()) + shared_bytes(m.getAuthor()) +
+            shared_bytes(m.getAlbum()) + shared_bytes(m.getAlbumArtist()) +
+            shared_bytes(m.getGenre());
+    }
+    return bytes;
+}
+
+size_t resultBytes(const vector<Album> &result) {
+    // Album keeps five strings and a flag behind its pointer.
+    size_t bytes = sizeof(result) + result.size() * (sizeof(Album) + 5 * sizeof(string) + sizeof(bool));
+    for (const auto &a : result) {
+        bytes += a.getTitle().size() + a.getArtist().size() + a.getDate().size() +
+            a.getGenre().size() + a.getArtFile().size();
+    }
+    return bytes;
+}
+
+size_t resultBytes(const vector<string> &result) {
+    size_t bytes = sizeof(result) + result.size() * sizeof(string);
+    for (const auto &s : result) {
+        bytes += s.size();
+    }
+    return bytes;
+}
+
+shared_ptr<const void> ResultCache::find(const string &key, uint64_t generation) {
+    lock_guard<mutex> lock(mutex_);
+    if (generation > generation_) {
+        reset(generation);
+    }
+    const auto it = entries_.find(key);
+    if (generation < generation_ || it == entries_.end()) {
+        misses_++;
+        return nullptr;
+    }
+    hits_++;
+    lru_.splice(lru_.begin(), lru_, it->second.lru);
+    return it->second.value;
+}
+
+void ResultCache::insert(const string &key, uint64_t generation,
+                         shared_ptr<const void> &&value, size_t bytes) {
+    lock_guard<mutex> lock(mutex_);
+    // Results read before a write are already out of date.
+    if (generation < generation_) {
+        return;
+    }
+    if (generation != generation_) {
+        reset(generation);
+    }
+    if (bytes > capacity_) {
+        return;
+    }
+    const auto it = entries_.find(key);
+    if (it != entries_.end()) {
+        bytes_ -= it->second.bytes;
+        lru_.erase(it->second.lru);
+        entries_.erase(it);
+    }
+    while (bytes_ + bytes > capacity_) {
+        const auto oldest = entries_.find(lru_.back());
+        bytes_ -= oldest->second.bytes;
+        entries_.erase(oldest);
+        lru_.pop_back();
+    }
+    lru_.push_front(key);
+    entries_[key] = Entry{move(value), bytes, lru_.begin()};
+    bytes_ += bytes;
+}
+
+void ResultCache::reset(uint64_t generation) {
+    entries_.clear();
+    lru_.clear();
+    bytes_ = 0;
+    generation_ = generation;
+}
+
+uint64_t ResultCache::hits() const {
+    lock_guard<mutex> lock(mutex_);
+    return hits_;
+}
+
+uint64_t ResultCache::misses() const {
+    lock_guard<mutex> lock(mutex_);
+    return misses_;
+}
+
+size_t ResultCache::memoryUsage() const {
+    lock_guard<mutex> lock(mutex_);
+    return bytes_;
+}
+
+}
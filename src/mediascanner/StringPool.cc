@@ -0,0 +1,40 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "internal/StringPool.hh"
+
+using namespace std;
+
+namespace mediascanner {
+
+const string &SharedString::empty_string() {
+    static const string empty;
+    return empty;
+}
+
+SharedString StringPool::get(const char *value) {
+    if (*value == '\0') {
+        return SharedString();
+    }
+    auto it = strings_.find(value);
+    if (it == strings_.end()) {
+        const string key(value);
+        it = strings_.emplace(key, SharedString(key)).first;
+    }
+    return it->second;
+}
+
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef TIMELINE_HH
+#define TIMELINE_HH
+
+#include <cstddef>
+#include <cstdint>
+
+namespace mediascanner {
+
+// The periods MediaStoreBase::countByDate() counts files in. Periods
+// are calendar days, months and years in UTC.
+enum class DateBucket {
+    Day,
+    Month,
+    Year,
+};
+
+// The number of files dated within the period starting at start, in
+// seconds since the epoch.
+struct DateCount {
+    DateCount() = default;
+    DateCount(int64_t start, size_t count) : start(start), count(count) {}
+
+    int64_t start = 0;
+    size_t count = 0;
+
+    bool operator==(const DateCount &other) const {
+        return start == other.start && count == other.count;
+    }
+    bool operator!=(const DateCount &other) const {
+        return !(*this == other);
+    }
+};
+
+}
+
+#endif
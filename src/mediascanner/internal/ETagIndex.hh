@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ETAGINDEX_HH
+#define ETAGINDEX_HH
+
+#include <string>
+#include <unordered_map>
+
+typedef struct sqlite3 sqlite3;
+
+namespace mediascanner {
+
+/*
+ * In-memory copy of the etag and broken file state of every file
+ * below a directory, so that a rescan can tell which files changed
+ * without a database query per file. Entries are keyed by their path
+ * relative to the prefix to keep the index small.
+ */
+class ETagIndex final {
+public:
+    ETagIndex() = default;
+    ~ETagIndex() = default;
+
+    ETagIndex(const ETagIndex &other) = delete;
+    ETagIndex& operator=(const ETagIndex &other) = delete;
+
+    void load(sqlite3 *db, const std::string &prefix);
+    void clear();
+
+    // Whether the index has authoritative data for filename.
+    bool covers(const std::string &filename) const;
+    size_t size() const { return entries_.size(); }
+
+    std::string getETag(const std::string &filename) const;
+    bool isBroken(const std::string &filename, const std::string &etag) const;
+
+    void setETag(const std::string &filename, const std::string &etag);
+    void setBroken(const std::string &filename, const std::string &etag);
+    void clearBroken(const std::string &filename);
+    void remove(const std::string &filename);
+    void removeSubtree(const std::string &directory);
+
+private:
+    struct Entry {
+        std::string etag;
+        std::string broken_etag;
+    };
+
+    bool loaded_ = false;
+    std::string prefix_;
+    std::unordered_map<std::string, Entry> entries_;
+};
+
+}
+
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FTS5TOKENIZER_HH
+#define FTS5TOKENIZER_HH
+
+#include <string>
+
+typedef struct sqlite3 sqlite3;
+
+namespace mediascanner {
+
+/*
+ * Registers the mozporter tokenizer with the FTS5 module of db, so
+ * that FTS5 tables index text the same way as the FTS4 ones. Throws
+ * if SQLite was built without FTS5.
+ */
+void registerFts5Tokenizer(sqlite3 *db);
+
+/*
+ * Turns a search string into an FTS5 query matching rows that contain
+ * every word, the last one as a prefix. Unlike FTS4, FTS5 rejects
+ * most punctuation outside of quotes, so each word is quoted.
+ */
+std::string fts5Query(const std::string &term);
+
+}
+
+#endif
@@ -23,18 +23,21 @@
 #include <cstdint>
 #include <string>
 
+#include "StringPool.hh"
+
 namespace mediascanner {
 
 struct MediaFilePrivate {
     std::string filename;
-    std::string content_type;
+    // Fields that repeat across a library share their storage.
+    SharedString content_type;
     std::string etag;
     std::string title;
-    std::string date; // ISO date string.  Should this be time since epoch?
-    std::string author;
-    std::string album;
-    std::string album_artist;
-    std::string genre;
+    std::string date; // ISO date string, see dateToEpoch()
+    SharedString author;
+    SharedString album;
+    SharedString album_artist;
+    SharedString genre;
     int disc_number = 0;
     int track_number = 0;
     int duration = 0; // In seconds.
@@ -45,6 +48,7 @@ struct MediaFilePrivate {
     double longitude = 0.0; // In degrees, negative for West
     bool has_thumbnail = false;
     uint64_t modification_time = 0;
+    std::string fingerprint; // See MediaFile::getFingerprint()
 
     MediaType type = UnknownMedia;
 
@@ -0,0 +1,98 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef RESULTCACHE_HH
+#define RESULTCACHE_HH
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace mediascanner {
+
+class Album;
+class MediaFile;
+
+// Approximate heap and object size of a cached result.
+size_t resultBytes(const std::vector<MediaFile> &result);
+size_t resultBytes(const std::vector<Album> &result);
+size_t resultBytes(const std::vector<std::string> &result);
+
+/*
+ * Results of recent queries, kept up to a total size in bytes and
+ * dropped least recently used first. Every entry is stamped with the
+ * write generation of the store it was read at; seeing a newer
+ * generation empties the cache. Callers make sure a key always maps
+ * to the same result type. Safe to use from several threads.
+ */
+class ResultCache final {
+public:
+    explicit ResultCache(size_t capacity) : capacity_(capacity) {}
+    ~ResultCache() = default;
+
+    ResultCache(const ResultCache &other) = delete;
+    ResultCache& operator=(const ResultCache &other) = delete;
+
+    template <typename T>
+    bool get(const std::string &key, uint64_t generation, std::vector<T> &result) {
+        auto value = find(key, generation);
+        if (!value) {
+            return false;
+        }
+        result = *std::static_pointer_cast<const std::vector<T>>(value);
+        return true;
+    }
+
+    template <typename T>
+    void put(const std::string &key, uint64_t generation, const std::vector<T> &result) {
+        insert(key, generation, std::make_shared<const std::vector<T>>(result),
+               key.size() + resultBytes(result));
+    }
+
+    uint64_t hits() const;
+    uint64_t misses() const;
+    size_t memoryUsage() const;
+
+private:
+    struct Entry {
+        std::shared_ptr<const void> value;
+        size_t bytes;
+        std::list<std::string>::iterator lru;
+    };
+
+    std::shared_ptr<const void> find(const std::string &key, uint64_t generation);
+    void insert(const std::string &key, uint64_t generation,
+                std::shared_ptr<const void> &&value, size_t bytes);
+    void reset(uint64_t generation);
+
+    mutable std::mutex mutex_;
+    const size_t capacity_;
+    size_t bytes_ = 0;
+    uint64_t generation_ = 0;
+    uint64_t hits_ = 0;
+    uint64_t misses_ = 0;
+    // Most recently used first.
+    std::list<std::string> lru_;
+    std::unordered_map<std::string, Entry> entries_;
+};
+
+}
+
+#endif
@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License version 3 as
+ * published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef STRINGPOOL_HH
+#define STRINGPOOL_HH
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace mediascanner {
+
+/*
+ * An immutable string that copies share rather than duplicate. Used
+ * for the fields of MediaFile that repeat across a library (artist,
+ * album, genre, content type), so that the files of one query result
+ * hold one copy of each distinct value. The empty string needs no
+ * allocation.
+ */
+class SharedString final {
+public:
+    SharedString() = default;
+    SharedString(const std::string &value) { *this = value; }
+
+    SharedString &operator=(const std::string &value) {
+        value_ = value.empty() ? nullptr : std::make_shared<const std::string>(value);
+        return *this;
+    }
+
+    const std::string &str() const { return value_ ? *value_ : empty_string(); }
+    bool empty() const { return !value_; }
+
+    bool operator==(const SharedString &other) const {
+        return value_ == other.value_ || str() == other.str();
+    }
+
+private:
+    friend class StringPool;
+    static const std::string &empty_string();
+
+    std::shared_ptr<const std::string> value_;
+};
+
+/*
+ * Hands out one SharedString per distinct value.
+ */
+class StringPool final {
+public:
+    StringPool() = default;
+    StringPool(const StringPool &other) = delete;
+    StringPool& operator=(const StringPool &other) = delete;
+
+    SharedString get(const char *value);
+
+private:
+    std::unordered_map<std::string, SharedString> strings_;
+};
+
+}
+
+#endif
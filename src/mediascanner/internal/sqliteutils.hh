@@ -24,18 +24,92 @@
 #include <cstdint>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
+
+#include "utils.hh"
 
 namespace mediascanner {
 
+/**
+ * A cache of prepared statements for a single database connection,
+ * keyed by their SQL text.
+ *
+ * Statements are checked out while in use, so a statement that is
+ * still being stepped through is never handed out a second time.
+ * Returned statements are reset and have their bindings cleared.
+ */
+class StatementCache final {
+public:
+    explicit StatementCache(size_t capacity=64) : capacity(capacity) {}
+    ~StatementCache() {
+        clear();
+    }
+    StatementCache(const StatementCache &other) = delete;
+    StatementCache& operator=(const StatementCache &other) = delete;
+
+    sqlite3_stmt *get(sqlite3 *db, const char *sql) {
+        auto it = statements.find(sql);
+        if (it != statements.end()) {
+            sqlite3_stmt *statement = it->second;
+            statements.erase(it);
+            hits++;
+            return statement;
+        }
+        misses++;
+        sqlite3_stmt *statement = nullptr;
+        int rc = sqlite3_prepare_v2(db, sql, -1, &statement, nullptr);
+        if (rc != SQLITE_OK) {
+            throw std::runtime_error(sqlite3_errmsg(db));
+        }
+        return statement;
+    }
+
+    void put(sqlite3_stmt *statement) {
+        // The return value of sqlite3_reset() reports the error of
+        // the last step, which has already been handled.
+        sqlite3_reset(statement);
+        sqlite3_clear_bindings(statement);
+        if (statements.size() >= capacity ||
+            !statements.emplace(sqlite3_sql(statement), statement).second) {
+            sqlite3_finalize(statement);
+        }
+    }
+
+    void clear() {
+        for (auto &i : statements) {
+            sqlite3_finalize(i.second);
+        }
+        statements.clear();
+    }
+
+    size_t size() const { return statements.size(); }
+    uint64_t getHits() const { return hits; }
+    uint64_t getMisses() const { return misses; }
+
+private:
+    std::unordered_map<std::string, sqlite3_stmt*> statements;
+    size_t capacity;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+};
+
 class Statement {
 public:
-    Statement(sqlite3 *db, const char *sql) {
+    Statement(sqlite3 *db, const char *sql) : cache(nullptr) {
         rc = sqlite3_prepare_v2(db, sql, -1, &statement, nullptr);
         if (rc != SQLITE_OK) {
             throw std::runtime_error(sqlite3_errmsg(db));
         }
     }
 
+    Statement(sqlite3 *db, StatementCache &cache, const char *sql) : cache(&cache) {
+        statement = cache.get(db, sql);
+        rc = SQLITE_OK;
+    }
+
+    Statement(const Statement &other) = delete;
+    Statement& operator=(const Statement &other) = delete;
+
     ~Statement() {
         try {
             finalize();
@@ -71,6 +145,12 @@ public:
             throw std::runtime_error(sqlite3_errstr(rc));
     }
 
+    void bindNull(int pos) {
+        rc = sqlite3_bind_null(statement, pos);
+        if (rc != SQLITE_OK)
+            throw std::runtime_error(sqlite3_errstr(rc));
+    }
+
     void bind(int pos, void *blob, int length) {
         rc = sqlite3_bind_blob(statement, pos, blob, length, SQLITE_STATIC);
         if (rc != SQLITE_OK)
@@ -83,9 +163,10 @@ public:
         // we change queries that may start to happen.
         // https://sqlite.org/c3ref/step.html
         //
-        // The proper fix would probably be to move to a WAL log, but
-        // it seems to require write access to the mediastore dir
-        // even for readers, which is problematic for confined apps.
+        // Stores opened with MediaStoreOptions::setWriteAheadLog()
+        // avoid this: WAL readers never wait for the writer. The
+        // retries are still needed for databases using a rollback
+        // journal.
         int retry_count=0;
         const int max_retries = 100;
         do {
@@ -108,6 +189,21 @@ public:
         return (const char *)sqlite3_column_text(statement, column);
     }
 
+    // Points into SQLite's buffer for the column, which stays valid
+    // until the next step. NULL reads as an empty string.
+    const char *getRawText(int column) {
+        if (rc != SQLITE_ROW)
+            throw std::runtime_error("Statement hasn't been executed, or no more results");
+        const char *text = (const char *)sqlite3_column_text(statement, column);
+        return text ? text : "";
+    }
+
+    bool isNull(int column) {
+        if (rc != SQLITE_ROW)
+            throw std::runtime_error("Statement hasn't been executed, or no more results");
+        return sqlite3_column_type(statement, column) == SQLITE_NULL;
+    }
+
     int getInt(int column) {
         if (rc != SQLITE_ROW)
             throw std::runtime_error("Statement hasn't been executed, or no more results");
@@ -127,7 +223,10 @@ public:
     }
 
     void finalize() {
-        if (statement != nullptr) {
+        if (statement != nullptr && cache != nullptr) {
+            cache->put(statement);
+            statement = nullptr;
+        } else if (statement != nullptr) {
             rc = sqlite3_finalize(statement);
             if (rc != SQLITE_OK) {
                 std::string msg("Could not finalize statement: ");
@@ -140,9 +239,27 @@ public:
 
 private:
     sqlite3_stmt *statement;
+    StatementCache *cache;
     int rc;
 };
 
+
+// Selects the rows whose file name (or, in offline_volumes, prefix)
+// starts with prefix as a range of the index on it. Unlike LIKE, this
+// only visits the matching rows. Bind prefix with bind_prefix().
+inline std::string prefix_range(const std::string &prefix, const char *column = "filename") {
+    const std::string c(column);
+    return prefixEnd(prefix).empty() ? c + " >= ?" : c + " >= ? AND " + c + " < ?";
+}
+
+inline void bind_prefix(Statement &query, const std::string &prefix) {
+    query.bind(1, prefix);
+    const std::string end = prefixEnd(prefix);
+    if (!end.empty()) {
+        query.bind(2, end);
+    }
+}
+
 }
 
 #endif
@@ -20,11 +20,16 @@
 #ifndef SCAN_UTILS_H
 #define SCAN_UTILS_H
 
+#include<cstdint>
 #include<string>
+#include<vector>
 
 namespace mediascanner {
 
 std::string sqlQuote(const std::string &input);
+// The smallest string sorting after every string that starts with
+// prefix, or an empty string if there is none.
+std::string prefixEnd(const std::string &prefix);
 std::string filenameToTitle(const std::string &filename);
 std::string getUri(const std::string &filename);
 bool is_rootlike(const std::string &path);
@@ -34,6 +39,21 @@ bool has_scanblock(const std::string &path);
 std::string make_album_art_uri(const std::string &artist, const std::string &album);
 std::string make_thumbnail_uri(const std::string &uri);
 
+// Filter cursors: a kind character followed by length prefixed fields.
+std::string encodeCursor(char kind, const std::vector<std::string> &fields);
+std::vector<std::string> decodeCursor(const std::string &cursor, char kind, size_t count);
+
+// Seconds since the epoch of an ISO 8601 date, as the extractors write
+// them: a year, a month or a day, optionally followed by a time with
+// or without a time zone. NO_DATE if date is empty or malformed.
+const int64_t NO_DATE = INT64_MIN;
+int64_t dateToEpoch(const std::string &date);
+
+// See MediaFile::getFingerprint(): a SHA-1 digest of the size and the
+// first and last 16 KiB of a file. Empty for an empty file. Throws if
+// the file can't be read.
+std::string fileFingerprint(const std::string &filename);
+
 }
 
 #endif
@@ -30,6 +30,34 @@ enum MediaType {
     AllMedia = 255,
 };
 
+// Fields of a MediaFile, combined into a mask to pick the fields a
+// query fills in. See Filter::setFields().
+enum MediaField : unsigned {
+    FileNameField = 1 << 0,
+    ContentTypeField = 1 << 1,
+    ETagField = 1 << 2,
+    TitleField = 1 << 3,
+    DateField = 1 << 4,
+    AuthorField = 1 << 5,
+    AlbumField = 1 << 6,
+    AlbumArtistField = 1 << 7,
+    GenreField = 1 << 8,
+    DiscNumberField = 1 << 9,
+    TrackNumberField = 1 << 10,
+    DurationField = 1 << 11,
+    WidthField = 1 << 12,
+    HeightField = 1 << 13,
+    LatitudeField = 1 << 14,
+    LongitudeField = 1 << 15,
+    HasThumbnailField = 1 << 16,
+    ModificationTimeField = 1 << 17,
+    TypeField = 1 << 18,
+    FingerprintField = 1 << 19,
+    // What MediaFile::getArtUri() needs.
+    ArtFields = FileNameField | AuthorField | AlbumField | HasThumbnailField | TypeField,
+    AllFields = (1 << 20) - 1,
+};
+
 enum class MediaOrder {
     Default,
     Rank,
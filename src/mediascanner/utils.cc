@@ -25,6 +25,9 @@
 #include<sys/stat.h>
 #include<cstring>
 #include<cerrno>
+#include<algorithm>
+#include<fcntl.h>
+#include<unistd.h>
 
 namespace mediascanner {
 
@@ -44,6 +47,17 @@ std::string sqlQuote(const std::string &input) {
     return std::string(&out[0]);
 }
 
+std::string prefixEnd(const std::string &prefix) {
+    std::string end = prefix;
+    while(!end.empty() && static_cast<unsigned char>(end.back()) == 0xff) {
+        end.pop_back();
+    }
+    if(!end.empty()) {
+        end.back() = static_cast<char>(static_cast<unsigned char>(end.back()) + 1);
+    }
+    return end;
+}
+
 // Convert filename into something that full text search
 // will be able to find. That is, separate words with spaces.
 #include<cstdio>
@@ -152,5 +166,185 @@ std::string make_thumbnail_uri(const std::string &uri) {
     return string("image://thumbnailer/") + uri;
 }
 
+std::string encodeCursor(char kind, const std::vector<std::string> &fields) {
+    string cursor(1, kind);
+    for (const auto &f : fields) {
+        cursor += std::to_string(f.size());
+        cursor += ':';
+        cursor += f;
+    }
+    return cursor;
+}
+
+std::vector<std::string> decodeCursor(const std::string &cursor, char kind, size_t count) {
+    if (cursor.empty() || cursor[0] != kind) {
+        throw std::runtime_error("Cursor does not belong to this kind of query");
+    }
+    std::vector<std::string> fields;
+    string::size_type pos = 1;
+    while (pos < cursor.size()) {
+        const auto colon = cursor.find(':', pos);
+        if (colon == string::npos || colon == pos) {
+            throw std::runtime_error("Malformed cursor");
+        }
+        size_t length = 0;
+        for (auto i = pos; i < colon; i++) {
+            if (cursor[i] < '0' || cursor[i] > '9') {
+                throw std::runtime_error("Malformed cursor");
+            }
+            length = length * 10 + (cursor[i] - '0');
+        }
+        if (length > cursor.size() - colon - 1) {
+            throw std::runtime_error("Malformed cursor");
+        }
+        fields.push_back(cursor.substr(colon + 1, length));
+        pos = colon + 1 + length;
+    }
+    if (fields.size() != count) {
+        throw std::runtime_error("Malformed cursor");
+    }
+    return fields;
+}
+
+// Reads count digits at p, advancing it past them.
+static bool read_digits(const char *&p, int count, int &value) {
+    value = 0;
+    for (int i = 0; i < count; i++, p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    return true;
+}
+
+// Days from 1970-01-01 to a date of the proleptic Gregorian calendar.
+static int64_t days_from_civil(int64_t y, int m, int d) {
+    y -= m <= 2;
+    const int64_t era = (y >= 0 ? y : y - 399) / 400;
+    const int64_t yoe = y - era * 400;
+    const int64_t doy = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    return era * 146097 + doe - 719468;
+}
+
+int64_t dateToEpoch(const std::string &date) {
+    const char *p = date.c_str();
+    int year, month = 1, day = 1, hour = 0, minute = 0, second = 0;
+    if (!read_digits(p, 4, year)) {
+        return NO_DATE;
+    }
+    if (*p == '-') {
+        p++;
+        if (!read_digits(p, 2, month) || month < 1 || month > 12) {
+            return NO_DATE;
+        }
+        if (*p == '-') {
+            p++;
+            if (!read_digits(p, 2, day) || day < 1 || day > 31) {
+                return NO_DATE;
+            }
+        }
+    }
+    int64_t offset = 0;
+    if (*p == 'T' || *p == ' ') {
+        p++;
+        if (!read_digits(p, 2, hour) || *p++ != ':' || !read_digits(p, 2, minute) ||
+            hour > 23 || minute > 59) {
+            return NO_DATE;
+        }
+        if (*p == ':') {
+            p++;
+            if (!read_digits(p, 2, second) || second > 60) {
+                return NO_DATE;
+            }
+            if (*p == '.') {
+                p++;
+                while (*p >= '0' && *p <= '9') {
+                    p++;
+                }
+            }
+        }
+        // Without a time zone, the time is taken as UTC, so that it
+        // stays on the same calendar day.
+        if (*p == 'Z') {
+            p++;
+        } else if (*p == '+' || *p == '-') {
+            const int sign = *p++ == '-' ? -1 : 1;
+            int zone_hours, zone_minutes = 0;
+            if (!read_digits(p, 2, zone_hours)) {
+                return NO_DATE;
+            }
+            if (*p == ':') {
+                p++;
+            }
+            if (*p != '\0' && !read_digits(p, 2, zone_minutes)) {
+                return NO_DATE;
+            }
+            offset = sign * (zone_hours * 3600 + zone_minutes * 60);
+        }
+    }
+    if (*p != '\0') {
+        return NO_DATE;
+    }
+    return days_from_civil(year, month, day) * 86400 +
+        hour * 3600 + minute * 60 + second - offset;
+}
+
+// Bytes read from each end of a file by fileFingerprint().
+static const size_t FINGERPRINT_BLOCK = 16 * 1024;
+
+static bool read_fully(int fd, char *buf, size_t count, off_t offset) {
+    while (count > 0) {
+        ssize_t n = pread(fd, buf, count, offset);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf += n;
+        count -= n;
+        offset += n;
+    }
+    return true;
 }
 
+std::string fileFingerprint(const std::string &filename) {
+    int fd = open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        throw runtime_error("Could not open " + filename + ": " + strerror(errno));
+    }
+    struct stat st;
+    vector<char> data;
+    bool ok = fstat(fd, &st) == 0;
+    if (ok && st.st_size > 0) {
+        const size_t size = st.st_size;
+        const size_t head = std::min(size, FINGERPRINT_BLOCK);
+        const size_t tail = std::min(size - head, FINGERPRINT_BLOCK);
+        data.resize(head + tail);
+        // Files of up to one block have no separate tail.
+        ok = read_fully(fd, data.data(), head, 0) &&
+            (tail == 0 || read_fully(fd, data.data() + head, tail, size - tail));
+    }
+    close(fd);
+    if (!ok) {
+        throw runtime_error("Could not read " + filename);
+    }
+    if (data.empty()) {
+        return "";
+    }
+
+    unsigned char size[8];
+    for (int i = 0; i < 8; i++) {
+        size[i] = (uint64_t)st.st_size >> (8 * i);
+    }
+    GChecksum *checksum = g_checksum_new(G_CHECKSUM_SHA1);
+    g_checksum_update(checksum, size, sizeof(size));
+    g_checksum_update(checksum, (const guchar*)data.data(), data.size());
+    string result(g_checksum_get_string(checksum));
+    g_checksum_free(checksum);
+    return result;
+}
+
+}
@@ -26,7 +26,11 @@
 #include <mediascanner/MediaFile.hh>
 #include <mediascanner/MediaFileBuilder.hh>
 #include <mediascanner/Album.hh>
+#include <mediascanner/BoundingBox.hh>
+#include <mediascanner/Facets.hh>
 #include <mediascanner/Filter.hh>
+#include <mediascanner/MediaChanges.hh>
+#include <mediascanner/Timeline.hh>
 
 using core::dbus::Message;
 using core::dbus::Codec;
@@ -36,7 +40,14 @@ using mediascanner::MediaFileBuilder;
 using mediascanner::MediaOrder;
 using mediascanner::MediaType;
 using mediascanner::Album;
+using mediascanner::BoundingBox;
+using mediascanner::DateCount;
+using mediascanner::FacetCounts;
+using mediascanner::Facets;
 using mediascanner::Filter;
+using mediascanner::ChangeType;
+using mediascanner::MediaChange;
+using mediascanner::MediaChanges;
 using std::string;
 
 void Codec<MediaFile>::encode_argument(Message::Writer &out, const MediaFile &file) {
@@ -60,13 +71,14 @@ void Codec<MediaFile>::encode_argument(Message::Writer &out, const MediaFile &fi
     core::dbus::encode_argument(w, file.getHasThumbnail());
     core::dbus::encode_argument(w, file.getModificationTime());
     core::dbus::encode_argument(w, (int32_t)file.getType());
+    core::dbus::encode_argument(w, file.getFingerprint());
     out.close_structure(std::move(w));
 }
 
 void Codec<MediaFile>::decode_argument(Message::Reader &in, MediaFile &file) {
     auto r = in.pop_structure();
     string filename, content_type, etag, title, author;
-    string album, album_artist, date, genre;
+    string album, album_artist, date, genre, fingerprint;
     int32_t disc_number, track_number, duration, width, height, type;
     double latitude, longitude;
     bool has_thumbnail;
@@ -75,7 +87,7 @@ void Codec<MediaFile>::decode_argument(Message::Reader &in, MediaFile &file) {
       >> album >> album_artist >> date >> genre
       >> disc_number >> track_number >> duration
       >> width >> height >> latitude >> longitude >> has_thumbnail
-      >> mtime >> type;
+      >> mtime >> type >> fingerprint;
     file = MediaFileBuilder(filename)
         .setContentType(content_type)
         .setETag(etag)
@@ -94,7 +106,8 @@ void Codec<MediaFile>::decode_argument(Message::Reader &in, MediaFile &file) {
         .setLongitude(longitude)
         .setHasThumbnail(has_thumbnail)
         .setModificationTime(mtime)
-        .setType((MediaType)type);
+        .setType((MediaType)type)
+        .setFingerprint(fingerprint);
 }
 
 void Codec<Album>::encode_argument(Message::Writer &out, const Album &album) {
@@ -135,6 +148,10 @@ void Codec<Filter>::encode_argument(Message::Writer &out, const Filter &filter)
         w.close_dict_entry(
             w.open_dict_entry() << string("genre") << Variant::encode(filter.getGenre()));
     }
+    if (filter.hasCursor()) {
+        w.close_dict_entry(
+            w.open_dict_entry() << string("cursor") << Variant::encode(filter.getCursor()));
+    }
 
     w.close_dict_entry(
         w.open_dict_entry() << string("offset") << Variant::encode((int32_t)filter.getOffset()));
@@ -144,6 +161,11 @@ void Codec<Filter>::encode_argument(Message::Writer &out, const Filter &filter)
         w.open_dict_entry() << string("order") << Variant::encode(static_cast<int32_t>(filter.getOrder())));
     w.close_dict_entry(
         w.open_dict_entry() << string("reverse") << Variant::encode(filter.getReverse()));
+    // Only sent when restricted, so older services see no change.
+    if (filter.getFields() != mediascanner::AllFields) {
+        w.close_dict_entry(
+            w.open_dict_entry() << string("fields") << Variant::encode(static_cast<uint32_t>(filter.getFields())));
+    }
 
     out.close_array(std::move(w));
 }
@@ -165,6 +187,8 @@ void Codec<Filter>::decode_argument(Message::Reader &in, Filter &filter) {
             filter.setAlbumArtist(value.as<string>());
         } else if (key == "genre") {
             filter.setGenre(value.as<string>());
+        } else if (key == "cursor") {
+            filter.setCursor(value.as<string>());
         } else if (key == "offset") {
             filter.setOffset(value.as<int32_t>());
         } else if (key == "limit") {
@@ -173,6 +197,103 @@ void Codec<Filter>::decode_argument(Message::Reader &in, Filter &filter) {
             filter.setOrder(static_cast<MediaOrder>(value.as<int32_t>()));
         } else if (key == "reverse") {
             filter.setReverse(value.as<bool>());
+        } else if (key == "fields") {
+            filter.setFields(value.as<uint32_t>());
         }
     }
 }
+
+static void encode_facet_counts(Message::Writer &out, const FacetCounts &counts) {
+    auto w = out.open_array(core::dbus::types::Signature("(st)"));
+    for (const auto &c : counts) {
+        auto entry = w.open_structure();
+        core::dbus::encode_argument(entry, c.first);
+        core::dbus::encode_argument(entry, static_cast<uint64_t>(c.second));
+        w.close_structure(std::move(entry));
+    }
+    out.close_array(std::move(w));
+}
+
+static void decode_facet_counts(Message::Reader &in, FacetCounts &counts) {
+    auto r = in.pop_array();
+    counts.clear();
+    while (r.type() != ArgumentType::invalid) {
+        string name;
+        uint64_t count;
+        r.pop_structure() >> name >> count;
+        counts.emplace_back(name, count);
+    }
+}
+
+void Codec<Facets>::encode_argument(Message::Writer &out, const Facets &facets) {
+    auto w = out.open_structure();
+    encode_facet_counts(w, facets.genres);
+    encode_facet_counts(w, facets.artists);
+    encode_facet_counts(w, facets.album_artists);
+    out.close_structure(std::move(w));
+}
+
+void Codec<Facets>::decode_argument(Message::Reader &in, Facets &facets) {
+    auto r = in.pop_structure();
+    decode_facet_counts(r, facets.genres);
+    decode_facet_counts(r, facets.artists);
+    decode_facet_counts(r, facets.album_artists);
+}
+
+void Codec<BoundingBox>::encode_argument(Message::Writer &out, const BoundingBox &box) {
+    auto w = out.open_structure();
+    core::dbus::encode_argument(w, box.south);
+    core::dbus::encode_argument(w, box.west);
+    core::dbus::encode_argument(w, box.north);
+    core::dbus::encode_argument(w, box.east);
+    out.close_structure(std::move(w));
+}
+
+void Codec<BoundingBox>::decode_argument(Message::Reader &in, BoundingBox &box) {
+    in.pop_structure() >> box.south >> box.west >> box.north >> box.east;
+}
+
+void Codec<DateCount>::encode_argument(Message::Writer &out, const DateCount &count) {
+    auto w = out.open_structure();
+    core::dbus::encode_argument(w, count.start);
+    core::dbus::encode_argument(w, static_cast<uint64_t>(count.count));
+    out.close_structure(std::move(w));
+}
+
+void Codec<DateCount>::decode_argument(Message::Reader &in, DateCount &count) {
+    uint64_t value;
+    in.pop_structure() >> count.start >> value;
+    count.count = value;
+}
+
+void Codec<MediaChanges>::encode_argument(Message::Writer &out, const MediaChanges &changes) {
+    auto w = out.open_structure();
+    core::dbus::encode_argument(w, changes.sequence);
+    core::dbus::encode_argument(w, changes.complete);
+    auto array = w.open_array(core::dbus::types::Signature("(tiis)"));
+    for (const auto &c : changes.changes) {
+        auto entry = array.open_structure();
+        core::dbus::encode_argument(entry, c.sequence);
+        core::dbus::encode_argument(entry, static_cast<int32_t>(c.change));
+        core::dbus::encode_argument(entry, static_cast<int32_t>(c.type));
+        core::dbus::encode_argument(entry, c.filename);
+        array.close_structure(std::move(entry));
+    }
+    w.close_array(std::move(array));
+    out.close_structure(std::move(w));
+}
+
+void Codec<MediaChanges>::decode_argument(Message::Reader &in, MediaChanges &changes) {
+    auto r = in.pop_structure();
+    r >> changes.sequence >> changes.complete;
+    auto array = r.pop_array();
+    changes.changes.clear();
+    while (array.type() != ArgumentType::invalid) {
+        MediaChange c;
+        int32_t change, type;
+        array.pop_structure() >> c.sequence >> change >> type >> c.filename;
+        c.change = static_cast<ChangeType>(change);
+        c.type = static_cast<MediaType>(type);
+        changes.changes.push_back(std::move(c));
+    }
+}
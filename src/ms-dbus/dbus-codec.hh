@@ -28,6 +28,10 @@ namespace mediascanner {
 class MediaFile;
 class Album;
 class Filter;
+struct Facets;
+struct BoundingBox;
+struct DateCount;
+struct MediaChanges;
 }
 
 namespace core {
@@ -51,6 +55,30 @@ struct Codec<mediascanner::Filter> {
     static void decode_argument(Message::Reader &in, mediascanner::Filter &filter);
 };
 
+template <>
+struct Codec<mediascanner::Facets> {
+    static void encode_argument(Message::Writer &out, const mediascanner::Facets &facets);
+    static void decode_argument(Message::Reader &in, mediascanner::Facets &facets);
+};
+
+template <>
+struct Codec<mediascanner::BoundingBox> {
+    static void encode_argument(Message::Writer &out, const mediascanner::BoundingBox &box);
+    static void decode_argument(Message::Reader &in, mediascanner::BoundingBox &box);
+};
+
+template <>
+struct Codec<mediascanner::DateCount> {
+    static void encode_argument(Message::Writer &out, const mediascanner::DateCount &count);
+    static void decode_argument(Message::Reader &in, mediascanner::DateCount &count);
+};
+
+template <>
+struct Codec<mediascanner::MediaChanges> {
+    static void encode_argument(Message::Writer &out, const mediascanner::MediaChanges &changes);
+    static void decode_argument(Message::Reader &in, mediascanner::MediaChanges &changes);
+};
+
 namespace helper {
 
 template<>
@@ -65,7 +93,7 @@ struct TypeMapper<mediascanner::MediaFile> {
         return true;
     }
     static const std::string &signature() {
-        static const std::string s = "(sssssssssiiiiiddbti)";
+        static const std::string s = "(sssssssssiiiiiddbtis)";
         return s;
     }
 };
@@ -104,6 +132,74 @@ struct TypeMapper<mediascanner::Filter> {
     }
 };
 
+template<>
+struct TypeMapper<mediascanner::Facets> {
+    constexpr static ArgumentType type_value() {
+        return ArgumentType::structure;
+    }
+    constexpr static bool is_basic_type() {
+        return false;
+    }
+    constexpr static bool requires_signature() {
+        return true;
+    }
+    static const std::string &signature() {
+        static const std::string s = "(a(st)a(st)a(st))";
+        return s;
+    }
+};
+
+template<>
+struct TypeMapper<mediascanner::BoundingBox> {
+    constexpr static ArgumentType type_value() {
+        return ArgumentType::structure;
+    }
+    constexpr static bool is_basic_type() {
+        return false;
+    }
+    constexpr static bool requires_signature() {
+        return true;
+    }
+    static const std::string &signature() {
+        static const std::string s = "(dddd)";
+        return s;
+    }
+};
+
+template<>
+struct TypeMapper<mediascanner::DateCount> {
+    constexpr static ArgumentType type_value() {
+        return ArgumentType::structure;
+    }
+    constexpr static bool is_basic_type() {
+        return false;
+    }
+    constexpr static bool requires_signature() {
+        return true;
+    }
+    static const std::string &signature() {
+        static const std::string s = "(xt)";
+        return s;
+    }
+};
+
+template<>
+struct TypeMapper<mediascanner::MediaChanges> {
+    constexpr static ArgumentType type_value() {
+        return ArgumentType::structure;
+    }
+    constexpr static bool is_basic_type() {
+        return false;
+    }
+    constexpr static bool requires_signature() {
+        return true;
+    }
+    static const std::string &signature() {
+        static const std::string s = "(tba(tiis))";
+        return s;
+    }
+};
+
 }
 
 }
@@ -209,6 +209,97 @@ struct MediaStoreInterface {
             return Interface::default_timeout();
         }
     };
+
+    struct Count {
+        typedef MediaStoreInterface Interface;
+
+        inline static const std::string& name() {
+            static std::string s = "Count";
+            return s;
+        }
+
+        inline static const std::chrono::milliseconds default_timeout() {
+            return Interface::default_timeout();
+        }
+    };
+
+    struct Facets {
+        typedef MediaStoreInterface Interface;
+
+        inline static const std::string& name() {
+            static std::string s = "Facets";
+            return s;
+        }
+
+        inline static const std::chrono::milliseconds default_timeout() {
+            return Interface::default_timeout();
+        }
+    };
+
+    struct QueryRegion {
+        typedef MediaStoreInterface Interface;
+
+        inline static const std::string& name() {
+            static std::string s = "QueryRegion";
+            return s;
+        }
+
+        inline static const std::chrono::milliseconds default_timeout() {
+            return Interface::default_timeout();
+        }
+    };
+
+    struct ListDateRange {
+        typedef MediaStoreInterface Interface;
+
+        inline static const std::string& name() {
+            static std::string s = "ListDateRange";
+            return s;
+        }
+
+        inline static const std::chrono::milliseconds default_timeout() {
+            return Interface::default_timeout();
+        }
+    };
+
+    struct CountByDate {
+        typedef MediaStoreInterface Interface;
+
+        inline static const std::string& name() {
+            static std::string s = "CountByDate";
+            return s;
+        }
+
+        inline static const std::chrono::milliseconds default_timeout() {
+            return Interface::default_timeout();
+        }
+    };
+
+    struct ListDuplicates {
+        typedef MediaStoreInterface Interface;
+
+        inline static const std::string& name() {
+            static std::string s = "ListDuplicates";
+            return s;
+        }
+
+        inline static const std::chrono::milliseconds default_timeout() {
+            return Interface::default_timeout();
+        }
+    };
+
+    struct ChangesSince {
+        typedef MediaStoreInterface Interface;
+
+        inline static const std::string& name() {
+            static std::string s = "ChangesSince";
+            return s;
+        }
+
+        inline static const std::chrono::milliseconds default_timeout() {
+            return Interface::default_timeout();
+        }
+    };
 };
 
 }
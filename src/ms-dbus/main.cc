@@ -18,6 +18,8 @@
  */
 
 #include <memory>
+#include <thread>
+#include <vector>
 #include <core/dbus/bus.h>
 #include <core/dbus/asio/executor.h>
 
@@ -26,13 +28,30 @@
 
 using namespace mediascanner;
 
+// Number of threads dispatching D-Bus calls. Each one gets its own
+// read connection so that queries don't wait for each other.
+static const int DISPATCH_THREADS = 4;
+
 int main(int , char **) {
     auto bus = std::make_shared<core::dbus::Bus>(core::dbus::WellKnownBus::session);
     bus->install_executor(core::dbus::asio::make_executor(bus));
 
-    auto store = std::make_shared<MediaStore>(MS_READ_ONLY);
+    MediaStoreOptions options;
+    options.setReadConnections(DISPATCH_THREADS);
+    // Queries read all over the database, so map it rather than
+    // copying pages into each connection's cache.
+    options.setMmapSize(64 * 1024 * 1024);
+    options.setCacheSize(2048);
+    auto store = std::make_shared<MediaStore>(MS_READ_ONLY, options);
 
     dbus::ServiceSkeleton service(bus, store);
+    std::vector<std::thread> dispatchers;
+    for (int i = 1; i < DISPATCH_THREADS; i++) {
+        dispatchers.emplace_back([&service]() { service.run(); });
+    }
     service.run();
+    for (auto &t : dispatchers) {
+        t.join();
+    }
     return 0;
 }
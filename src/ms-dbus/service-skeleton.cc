@@ -63,6 +63,11 @@ struct ServiceSkeleton::Private {
                 &Private::handle_query,
                 this,
                 std::placeholders::_1));
+        object->install_method_handler<MediaStoreInterface::QueryRegion>(
+            std::bind(
+                &Private::handle_query_region,
+                this,
+                std::placeholders::_1));
         object->install_method_handler<MediaStoreInterface::QueryAlbums>(
             std::bind(
                 &Private::handle_query_albums,
@@ -113,6 +118,36 @@ struct ServiceSkeleton::Private {
                 &Private::handle_has_media,
                 this,
                 std::placeholders::_1));
+        object->install_method_handler<MediaStoreInterface::Count>(
+            std::bind(
+                &Private::handle_count,
+                this,
+                std::placeholders::_1));
+        object->install_method_handler<MediaStoreInterface::Facets>(
+            std::bind(
+                &Private::handle_facets,
+                this,
+                std::placeholders::_1));
+        object->install_method_handler<MediaStoreInterface::ListDateRange>(
+            std::bind(
+                &Private::handle_list_date_range,
+                this,
+                std::placeholders::_1));
+        object->install_method_handler<MediaStoreInterface::CountByDate>(
+            std::bind(
+                &Private::handle_count_by_date,
+                this,
+                std::placeholders::_1));
+        object->install_method_handler<MediaStoreInterface::ListDuplicates>(
+            std::bind(
+                &Private::handle_list_duplicates,
+                this,
+                std::placeholders::_1));
+        object->install_method_handler<MediaStoreInterface::ChangesSince>(
+            std::bind(
+                &Private::handle_changes_since,
+                this,
+                std::placeholders::_1));
     }
 
     std::string get_client_apparmor_context(const Message::Ptr &message) {
@@ -228,6 +263,28 @@ struct ServiceSkeleton::Private {
         impl->access_bus()->send(reply);
     }
 
+    void handle_query_region(const Message::Ptr &message) {
+        BoundingBox region;
+        int32_t type;
+        Filter filter;
+        message->reader() >> region >> type >> filter;
+
+        if (!check_access(message, (MediaType)type))
+            return;
+
+        Message::Ptr reply;
+        try {
+            auto results = store->queryRegion(region, (MediaType)type, filter);
+            reply = Message::make_method_return(message);
+            reply->writer() << results;
+        } catch (const std::exception &e) {
+            reply = Message::make_error(
+                message, MediaStoreInterface::Errors::Error::name(),
+                e.what());
+        }
+        impl->access_bus()->send(reply);
+    }
+
     void handle_query_albums(const Message::Ptr &message) {
         if (!check_access(message, AudioMedia))
             return;
@@ -420,6 +477,126 @@ struct ServiceSkeleton::Private {
         }
         impl->access_bus()->send(reply);
     }
+
+    void handle_count(const Message::Ptr &message) {
+        int32_t type;
+        Filter filter;
+        message->reader() >> type >> filter;
+
+        if (!check_access(message, static_cast<MediaType>(type)))
+            return;
+        Message::Ptr reply;
+        try {
+            uint64_t result = store->count(static_cast<MediaType>(type), filter);
+            reply = Message::make_method_return(message);
+            reply->writer() << result;
+        } catch (const std::exception &e) {
+            reply = Message::make_error(
+                message, MediaStoreInterface::Errors::Error::name(),
+                e.what());
+        }
+        impl->access_bus()->send(reply);
+    }
+
+    void handle_facets(const Message::Ptr &message) {
+        if (!check_access(message, AudioMedia))
+            return;
+
+        Filter filter;
+        message->reader() >> filter;
+        Message::Ptr reply;
+        try {
+            auto facets = store->facets(filter);
+            reply = Message::make_method_return(message);
+            reply->writer() << facets;
+        } catch (const std::exception &e) {
+            reply = Message::make_error(
+                message, MediaStoreInterface::Errors::Error::name(),
+                e.what());
+        }
+        impl->access_bus()->send(reply);
+    }
+
+    void handle_list_date_range(const Message::Ptr &message) {
+        int32_t type;
+        int64_t start, end;
+        Filter filter;
+        message->reader() >> type >> start >> end >> filter;
+
+        if (!check_access(message, static_cast<MediaType>(type)))
+            return;
+        Message::Ptr reply;
+        try {
+            auto results = store->listDateRange(static_cast<MediaType>(type), start, end, filter);
+            reply = Message::make_method_return(message);
+            reply->writer() << results;
+        } catch (const std::exception &e) {
+            reply = Message::make_error(
+                message, MediaStoreInterface::Errors::Error::name(),
+                e.what());
+        }
+        impl->access_bus()->send(reply);
+    }
+
+    void handle_count_by_date(const Message::Ptr &message) {
+        int32_t type, bucket;
+        int64_t start, end;
+        message->reader() >> type >> bucket >> start >> end;
+
+        if (!check_access(message, static_cast<MediaType>(type)))
+            return;
+        Message::Ptr reply;
+        try {
+            auto counts = store->countByDate(static_cast<MediaType>(type), static_cast<DateBucket>(bucket), start, end);
+            reply = Message::make_method_return(message);
+            reply->writer() << counts;
+        } catch (const std::exception &e) {
+            reply = Message::make_error(
+                message, MediaStoreInterface::Errors::Error::name(),
+                e.what());
+        }
+        impl->access_bus()->send(reply);
+    }
+
+    void handle_list_duplicates(const Message::Ptr &message) {
+        int32_t type;
+        Filter filter;
+        message->reader() >> type >> filter;
+
+        if (!check_access(message, static_cast<MediaType>(type)))
+            return;
+        Message::Ptr reply;
+        try {
+            auto groups = store->listDuplicates(static_cast<MediaType>(type), filter);
+            reply = Message::make_method_return(message);
+            reply->writer() << groups;
+        } catch (const std::exception &e) {
+            reply = Message::make_error(
+                message, MediaStoreInterface::Errors::Error::name(),
+                e.what());
+        }
+        impl->access_bus()->send(reply);
+    }
+
+    void handle_changes_since(const Message::Ptr &message) {
+        int32_t type;
+        uint64_t sequence;
+        message->reader() >> type >> sequence;
+
+        if (!check_access(message, static_cast<MediaType>(type)))
+            return;
+        Message::Ptr reply;
+        try {
+            auto changes = store->changesSince(static_cast<MediaType>(type), sequence);
+            reply = Message::make_method_return(message);
+            reply->writer() << changes;
+        } catch (const std::exception &e) {
+            reply = Message::make_error(
+                message, MediaStoreInterface::Errors::Error::name(),
+                e.what());
+        }
+        impl->access_bus()->send(reply);
+    }
 };
 
 ServiceSkeleton::ServiceSkeleton(core::dbus::Bus::Ptr bus,
@@ -19,6 +19,9 @@
 
 #include "service-stub.hh"
 
+#include <exception>
+#include <future>
+#include <mutex>
 #include <stdexcept>
 
 #include <mediascanner/Album.hh>
@@ -37,6 +40,61 @@ struct ServiceStub::Private
     core::dbus::Object::Ptr object;
 };
 
+namespace {
+
+// The reply to an asynchronous call, which either the reply or the
+// cancellation of the call completes, whichever comes first.
+template <typename T>
+class PendingReply {
+public:
+    std::future<T> get_future() {
+        return promise.get_future();
+    }
+
+    void set_value(const T &value) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!done) {
+            promise.set_value(value);
+            done = true;
+        }
+    }
+
+    void set_exception(std::exception_ptr e) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!done) {
+            promise.set_exception(e);
+            done = true;
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::promise<T> promise;
+    bool done = false;
+};
+
+template <typename Method, typename ResultType, typename... Args>
+AsyncResult<ResultType> invoke_cancellable(const core::dbus::Object::Ptr &object, const Args&... args) {
+    auto state = std::make_shared<AsyncQuery>();
+    auto reply = std::make_shared<PendingReply<ResultType>>();
+    auto future = reply->get_future();
+    state->setInterrupt([reply]() {
+        reply->set_exception(std::make_exception_ptr(QueryCancelled()));
+    });
+    object->invoke_method_asynchronously_with_callback<Method, ResultType>(
+        [reply](const core::dbus::Result<ResultType> &result) {
+            if (result.is_error()) {
+                reply->set_exception(std::make_exception_ptr(
+                    std::runtime_error(result.error().print())));
+            } else {
+                reply->set_value(result.value());
+            }
+        }, args...);
+    return AsyncResult<ResultType>(std::move(future), state);
+}
+
+}
+
 ServiceStub::ServiceStub(core::dbus::Bus::Ptr bus)
     : core::dbus::Stub<MediaStoreService>(bus),
       p(new Private{access_service()->object_for_path(
@@ -60,6 +118,13 @@ std::vector<MediaFile> ServiceStub::query(const string &q, MediaType type, const
     return result.value();
 }
 
+std::vector<MediaFile> ServiceStub::queryRegion(const BoundingBox &region, MediaType type, const Filter &filter) const {
+    auto result = p->object->invoke_method_synchronously<MediaStoreInterface::QueryRegion, std::vector<MediaFile>>(region, (int32_t)type, filter);
+    if (result.is_error())
+        throw std::runtime_error(result.error().print());
+    return result.value();
+}
+
 std::vector<Album> ServiceStub::queryAlbums(const string &core_term, const Filter &filter) const {
     auto result = p->object->invoke_method_synchronously<MediaStoreInterface::QueryAlbums, std::vector<Album>>(core_term, filter);
     if (result.is_error())
@@ -129,5 +194,55 @@ bool ServiceStub::hasMedia(MediaType type) const {
     return result.value();
 }
 
+size_t ServiceStub::count(MediaType type, const Filter &filter) const {
+    auto result = p->object->invoke_method_synchronously<MediaStoreInterface::Count, uint64_t>(static_cast<int32_t>(type), filter);
+    if (result.is_error())
+        throw std::runtime_error(result.error().print());
+    return result.value();
+}
+
+Facets ServiceStub::facets(const Filter &filter) const {
+    auto result = p->object->invoke_method_synchronously<MediaStoreInterface::Facets, Facets>(filter);
+    if (result.is_error())
+        throw std::runtime_error(result.error().print());
+    return result.value();
+}
+
+std::vector<MediaFile> ServiceStub::listDateRange(MediaType type, int64_t start, int64_t end, const Filter &filter) const {
+    auto result = p->object->invoke_method_synchronously<MediaStoreInterface::ListDateRange, std::vector<MediaFile>>(static_cast<int32_t>(type), start, end, filter);
+    if (result.is_error())
+        throw std::runtime_error(result.error().print());
+    return result.value();
+}
+
+std::vector<DateCount> ServiceStub::countByDate(MediaType type, DateBucket bucket, int64_t start, int64_t end) const {
+    auto result = p->object->invoke_method_synchronously<MediaStoreInterface::CountByDate, std::vector<DateCount>>(static_cast<int32_t>(type), static_cast<int32_t>(bucket), start, end);
+    if (result.is_error())
+        throw std::runtime_error(result.error().print());
+    return result.value();
+}
+
+std::vector<std::vector<MediaFile>> ServiceStub::listDuplicates(MediaType type, const Filter &filter) const {
+    auto result = p->object->invoke_method_synchronously<MediaStoreInterface::ListDuplicates, std::vector<std::vector<MediaFile>>>(static_cast<int32_t>(type), filter);
+    if (result.is_error())
+        throw std::runtime_error(result.error().print());
+    return result.value();
+}
+
+MediaChanges ServiceStub::changesSince(MediaType type, uint64_t sequence) const {
+    auto result = p->object->invoke_method_synchronously<MediaStoreInterface::ChangesSince, MediaChanges>(static_cast<int32_t>(type), sequence);
+    if (result.is_error())
+        throw std::runtime_error(result.error().print());
+    return result.value();
+}
+
+AsyncResult<std::vector<MediaFile>> ServiceStub::queryAsync(const string &q, MediaType type, const Filter &filter) const {
+    return invoke_cancellable<MediaStoreInterface::Query, std::vector<MediaFile>>(p->object, q, (int32_t)type, filter);
+}
+
+AsyncResult<std::vector<MediaFile>> ServiceStub::listSongsAsync(const Filter &filter) const {
+    return invoke_cancellable<MediaStoreInterface::ListSongs, std::vector<MediaFile>>(p->object, filter);
+}
+
 }
 }
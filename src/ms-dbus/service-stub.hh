@@ -44,6 +44,7 @@ public:
 
     virtual MediaFile lookup(const std::string &filename) const override;
     virtual std::vector<MediaFile> query(const std::string &q, MediaType type, const Filter &filter) const override;
+    virtual std::vector<MediaFile> queryRegion(const BoundingBox &region, MediaType type, const Filter &filter) const override;
     virtual std::vector<Album> queryAlbums(const std::string &core_term, const Filter &filter) const override;
     virtual std::vector<std::string> queryArtists(const std::string &q, const Filter &filter) const override;
     virtual std::vector<MediaFile> getAlbumSongs(const Album& album) const override;
@@ -54,6 +55,16 @@ public:
     virtual std::vector<std::string> listAlbumArtists(const Filter &filter) const override;
     virtual std::vector<std::string> listGenres(const Filter &filter) const override;
     virtual bool hasMedia(MediaType type) const override;
+    virtual size_t count(MediaType type, const Filter &filter) const override;
+    virtual Facets facets(const Filter &filter) const override;
+    virtual std::vector<MediaFile> listDateRange(MediaType type, int64_t start, int64_t end, const Filter &filter) const override;
+    virtual std::vector<DateCount> countByDate(MediaType type, DateBucket bucket, int64_t start, int64_t end) const override;
+    virtual std::vector<std::vector<MediaFile>> listDuplicates(MediaType type, const Filter &filter) const override;
+    virtual MediaChanges changesSince(MediaType type, uint64_t sequence) const override;
+    // Cancelling releases the caller at once. The service still
+    // finishes the call, and its reply is dropped.
+    virtual AsyncResult<std::vector<MediaFile>> queryAsync(const std::string &q, MediaType type, const Filter &filter) const override;
+    virtual AsyncResult<std::vector<MediaFile>> listSongsAsync(const Filter &filter) const override;
 
 private:
     struct Private;
@@ -97,10 +97,11 @@ void AlbumsModel::setLimit(int) {
     qWarning() << "Setting limit on AlbumsModel is deprecated";
 }
 
-std::unique_ptr<StreamingModel::RowData> AlbumsModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset) const {
+std::unique_ptr<StreamingModel::RowData> AlbumsModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset, const std::string &cursor) const {
     auto limit_filter = filter;
-    limit_filter.setLimit(limit);
-    limit_filter.setOffset(offset);
-    return std::unique_ptr<StreamingModel::RowData>(
+    setPage(limit_filter, limit, offset, cursor);
+    std::unique_ptr<StreamingModel::RowData> rows(
         new AlbumRowData(store->listAlbums(limit_filter)));
+    rows->cursor = cursorAfter(static_cast<AlbumRowData*>(rows.get())->rows);
+    return rows;
 }
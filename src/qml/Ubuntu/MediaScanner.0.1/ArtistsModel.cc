@@ -98,18 +98,27 @@ public:
 };
 }
 
-std::unique_ptr<StreamingModel::RowData> ArtistsModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset) const {
+std::unique_ptr<StreamingModel::RowData> ArtistsModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset, const std::string &cursor) const {
     auto limit_filter = filter;
-    limit_filter.setLimit(limit);
-    limit_filter.setOffset(offset);
+    setPage(limit_filter, limit, offset, cursor);
     std::vector<std::string> artists;
     if (album_artists) {
         artists = store->listAlbumArtists(limit_filter);
     } else {
         artists = store->listArtists(limit_filter);
     }
-    return std::unique_ptr<StreamingModel::RowData>(
+    const std::string next = cursorAfter(artists);
+    std::unique_ptr<StreamingModel::RowData> rows(
         new ArtistRowData(std::move(artists)));
+    rows->cursor = next;
+    return rows;
+}
+
+// The artists listed are those with a song matching the filter, which
+// are the ones the song counts break down by.
+int ArtistsModel::retrieveCount(std::shared_ptr<MediaStoreBase> store) const {
+    const Facets facets = store->facets(filter);
+    return album_artists ? facets.album_artists.size() : facets.artists.size();
 }
 
 void ArtistsModel::appendRows(std::unique_ptr<StreamingModel::RowData> &&row_data) {
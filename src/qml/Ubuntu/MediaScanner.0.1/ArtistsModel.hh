@@ -46,7 +46,8 @@ public:
     int rowCount(const QModelIndex &parent=QModelIndex()) const override;
     QVariant data(const QModelIndex &index, int role) const override;
 
-    std::unique_ptr<RowData> retrieveRows(std::shared_ptr<mediascanner::MediaStoreBase> store, int limit, int offset) const override;
+    std::unique_ptr<RowData> retrieveRows(std::shared_ptr<mediascanner::MediaStoreBase> store, int limit, int offset, const std::string &cursor) const override;
+    int retrieveCount(std::shared_ptr<mediascanner::MediaStoreBase> store) const override;
     void appendRows(std::unique_ptr<RowData> &&row_data) override;
     void clearBacking() override;
 
@@ -65,12 +65,19 @@ public:
 };
 }
 
-std::unique_ptr<StreamingModel::RowData> GenresModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset) const {
+std::unique_ptr<StreamingModel::RowData> GenresModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset, const std::string &cursor) const {
     auto limit_filter = filter;
-    limit_filter.setLimit(limit);
-    limit_filter.setOffset(offset);
-    return std::unique_ptr<StreamingModel::RowData>(
-        new GenreRowData(store->listGenres(limit_filter)));
+    setPage(limit_filter, limit, offset, cursor);
+    std::vector<std::string> genres = store->listGenres(limit_filter);
+    const std::string next = cursorAfter(genres);
+    std::unique_ptr<StreamingModel::RowData> rows(
+        new GenreRowData(std::move(genres)));
+    rows->cursor = next;
+    return rows;
+}
+
+int GenresModel::retrieveCount(std::shared_ptr<MediaStoreBase> store) const {
+    return store->facets(filter).genres.size();
 }
 
 void GenresModel::appendRows(std::unique_ptr<StreamingModel::RowData> &&row_data) {
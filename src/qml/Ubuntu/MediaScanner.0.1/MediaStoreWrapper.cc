@@ -32,6 +32,10 @@
 
 using namespace mediascanner::qml;
 
+// Models fetch their rows on worker threads, so let a few of them
+// query the database at the same time.
+static const int READ_CONNECTIONS = 4;
+
 static core::dbus::Bus::Ptr the_session_bus() {
     static core::dbus::Bus::Ptr bus = std::make_shared<core::dbus::Bus>(
         core::dbus::WellKnownBus::session);
@@ -50,7 +54,10 @@ MediaStoreWrapper::MediaStoreWrapper(QObject *parent)
         if (use_dbus != nullptr && !strcmp(use_dbus, "1")) {
             store.reset(new mediascanner::dbus::ServiceStub(the_session_bus()));
         } else {
-            store.reset(new mediascanner::MediaStore(MS_READ_ONLY));
+            mediascanner::MediaStoreOptions options;
+            options.setReadConnections(READ_CONNECTIONS);
+            options.setMmapSize(32 * 1024 * 1024);
+            store.reset(new mediascanner::MediaStore(MS_READ_ONLY, options));
         }
     } catch (const std::exception &e) {
         qWarning() << "Could not initialise media store:" << e.what();
@@ -118,10 +118,17 @@ void SongsModel::setLimit(int) {
     qWarning() << "Setting limit on SongsModel is deprecated";
 }
 
-std::unique_ptr<StreamingModel::RowData> SongsModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset) const {
+std::unique_ptr<StreamingModel::RowData> SongsModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset, const std::string &cursor) const {
     auto limit_filter = filter;
-    limit_filter.setLimit(limit);
-    limit_filter.setOffset(offset);
-    return std::unique_ptr<StreamingModel::RowData>(
-        new MediaFileRowData(store->listSongs(limit_filter)));
+    setPage(limit_filter, limit, offset, cursor);
+    std::vector<mediascanner::MediaFile> songs = waitForResult(store->listSongsAsync(limit_filter));
+    const std::string next = cursorAfter(songs);
+    std::unique_ptr<StreamingModel::RowData> rows(
+        new MediaFileRowData(std::move(songs)));
+    rows->cursor = next;
+    return rows;
+}
+
+int SongsModel::retrieveCount(std::shared_ptr<MediaStoreBase> store) const {
+    return store->count(mediascanner::AudioMedia, filter);
 }
@@ -39,7 +39,8 @@ class SongsModel : public MediaFileModelBase {
 public:
     explicit SongsModel(QObject *parent=0);
 
-    std::unique_ptr<RowData> retrieveRows(std::shared_ptr<mediascanner::MediaStoreBase> store, int limit, int offset) const override;
+    std::unique_ptr<RowData> retrieveRows(std::shared_ptr<mediascanner::MediaStoreBase> store, int limit, int offset, const std::string &cursor) const override;
+    int retrieveCount(std::shared_ptr<mediascanner::MediaStoreBase> store) const override;
 
 protected:
     QVariant getArtist();
@@ -38,11 +38,14 @@ void SongsSearchModel::setQuery(const QString query) {
     }
 }
 
-std::unique_ptr<StreamingModel::RowData> SongsSearchModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset) const {
-    std::vector<mediascanner::MediaFile> songs;
+std::unique_ptr<StreamingModel::RowData> SongsSearchModel::retrieveRows(std::shared_ptr<MediaStoreBase> store, int limit, int offset, const std::string &) const {
+    // Search results are ordered by rank, which can only be paged by offset.
     mediascanner::Filter limit_filter;
     limit_filter.setLimit(limit);
     limit_filter.setOffset(offset);
+    // A new search term cancels the query for the old one.
+    std::vector<mediascanner::MediaFile> songs = waitForResult(
+        store->queryAsync(query.toStdString(), mediascanner::AudioMedia, limit_filter));
     return std::unique_ptr<StreamingModel::RowData>(
-        new MediaFileRowData(store->query(query.toStdString(), mediascanner::AudioMedia, limit_filter)));
+        new MediaFileRowData(std::move(songs)));
 }
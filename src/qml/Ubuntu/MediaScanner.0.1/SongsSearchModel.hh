@@ -34,7 +34,7 @@ class SongsSearchModel : public MediaFileModelBase {
 public:
     explicit SongsSearchModel(QObject *parent=0);
 
-    std::unique_ptr<RowData> retrieveRows(std::shared_ptr<mediascanner::MediaStoreBase> store, int limit, int offset) const override;
+    std::unique_ptr<RowData> retrieveRows(std::shared_ptr<mediascanner::MediaStoreBase> store, int limit, int offset, const std::string &cursor) const override;
 
 protected:
     QString getQuery();
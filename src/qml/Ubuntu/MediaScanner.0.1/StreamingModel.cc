@@ -61,11 +61,41 @@ public:
     }
 };
 
+class CountEvent : public QEvent {
+private:
+    int count;
+    int generation;
+
+public:
+    CountEvent(int generation, int count) :
+        QEvent(CountEvent::countEventType()), count(count), generation(generation) {
+    }
+
+    int getCount() const { return count; }
+    int getGeneration() const { return generation; }
+
+    static QEvent::Type countEventType()
+    {
+        static QEvent::Type type = static_cast<QEvent::Type>(QEvent::registerEventType());
+        return type;
+    }
+};
+
 void runQuery(int generation, StreamingModel *model, std::shared_ptr<mediascanner::MediaStoreBase> store) {
     if (!store) {
         return;
     }
+    try {
+        const int count = model->retrieveCount(store);
+        if (count >= 0 && !model->shouldWorkerStop()) {
+            QCoreApplication::instance()->postEvent(model, new CountEvent(generation, count));
+        }
+    } catch (const std::exception &exc) {
+        // The rows may still be available.
+        qWarning() << "Failed to retrieve count:" << exc.what();
+    }
     int offset = 0;
+    std::string cursor;
     int cursize;
     do {
         if(model->shouldWorkerStop()) {
@@ -73,13 +103,16 @@ void runQuery(int generation, StreamingModel *model, std::shared_ptr<mediascanne
         }
         QScopedPointer<AdditionEvent> e(new AdditionEvent(generation));
         try {
-            e->setRows(model->retrieveRows(store, BATCH_SIZE, offset));
+            e->setRows(model->retrieveRows(store, BATCH_SIZE, offset, cursor));
+        } catch (const mediascanner::QueryCancelled &) {
+            return;
         } catch (const std::exception &exc) {
             qWarning() << "Failed to retrieve rows:" << exc.what();
             e->setError(true);
             return;
         }
         cursize = e->getRows()->size();
+        cursor = e->getRows()->cursor;
         if (model->shouldWorkerStop()) {
             return;
         }
@@ -91,11 +124,12 @@ void runQuery(int generation, StreamingModel *model, std::shared_ptr<mediascanne
 }
 
 StreamingModel::StreamingModel(QObject *parent) :
-    QAbstractListModel(parent), generation(0), status(Ready) {
+    QAbstractListModel(parent), generation(0), status(Ready), total_count(-1) {
 }
 
 StreamingModel::~StreamingModel() {
     setWorkerStop(true);
+    cancelRunningQuery();
     try {
         query_future.waitForFinished();
     } catch(...) {
@@ -119,6 +153,15 @@ QVariant StreamingModel::get(int row, int role) const {
 }
 
 bool StreamingModel::event(QEvent *e) {
+    if (e->type() == CountEvent::countEventType()) {
+        CountEvent *ce = dynamic_cast<CountEvent*>(e);
+        assert(ce);
+        if (ce->getGeneration() == generation) {
+            total_count = ce->getCount();
+            Q_EMIT totalCountChanged();
+        }
+        return true;
+    }
     if (e->type() != AdditionEvent::additionEventType()) {
         return QObject::event(e);
     }
@@ -148,6 +191,35 @@ bool StreamingModel::event(QEvent *e) {
     return true;
 }
 
+void StreamingModel::setRunningQuery(const std::shared_ptr<mediascanner::AsyncQuery> &query) const {
+    std::lock_guard<std::mutex> lock(running_mutex);
+    running_query = query;
+    // Stopped before the query was registered.
+    if (running_query && shouldWorkerStop()) {
+        running_query->cancel();
+    }
+}
+
+void StreamingModel::cancelRunningQuery() {
+    std::lock_guard<std::mutex> lock(running_mutex);
+    if (running_query) {
+        running_query->cancel();
+    }
+}
+
+int StreamingModel::retrieveCount(std::shared_ptr<mediascanner::MediaStoreBase>) const {
+    return -1;
+}
+
+void StreamingModel::setPage(mediascanner::Filter &filter, int limit, int offset, const std::string &cursor) {
+    filter.setLimit(limit);
+    if (cursor.empty()) {
+        filter.setOffset(offset);
+    } else {
+        filter.setCursor(cursor);
+    }
+}
+
 MediaStoreWrapper *StreamingModel::getStore() const {
     return store.data();
 }
@@ -167,6 +239,10 @@ void StreamingModel::setStore(MediaStoreWrapper *store) {
     }
 }
 
+int StreamingModel::getTotalCount() const {
+    return total_count;
+}
+
 StreamingModel::ModelStatus StreamingModel::getStatus() const {
     return status;
 }
@@ -182,10 +258,15 @@ void StreamingModel::setStatus(StreamingModel::ModelStatus status) {
 
 void StreamingModel::invalidate() {
     setWorkerStop(true);
+    cancelRunningQuery();
     query_future.waitForFinished();
     beginResetModel();
     clearBacking();
     endResetModel();
     Q_EMIT countChanged();
+    if (total_count != -1) {
+        total_count = -1;
+        Q_EMIT totalCountChanged();
+    }
     updateModel();
 }
@@ -22,11 +22,17 @@
 
 #include <atomic>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
 
 #include <QAbstractListModel>
 #include <QFuture>
 #include <QPointer>
 
+#include <mediascanner/AsyncResult.hh>
+#include <mediascanner/Filter.hh>
+
 #include "MediaStoreWrapper.hh"
 
 namespace mediascanner {
@@ -38,6 +44,11 @@ class StreamingModel : public QAbstractListModel {
     Q_PROPERTY(mediascanner::qml::MediaStoreWrapper* store READ getStore WRITE setStore)
     Q_PROPERTY(int count READ rowCount NOTIFY countChanged)
     Q_PROPERTY(int rowCount READ rowCount NOTIFY countChanged)
+    // The number of rows the model will hold once filled, known
+    // before the rows themselves arrive, or -1 if not known. It is
+    // always -1 for AlbumsModel and SongsSearchModel, as the store
+    // cannot count albums or search results without listing them.
+    Q_PROPERTY(int totalCount READ getTotalCount NOTIFY totalCountChanged)
     Q_PROPERTY(ModelStatus status READ getStatus NOTIFY statusChanged)
 public:
     enum ModelStatus {
@@ -59,30 +70,72 @@ public:
     public:
         virtual ~RowData() {}
         virtual size_t size() const = 0;
+        // Filter cursor for the rows following these ones. If left
+        // empty, the next batch is fetched by offset instead.
+        std::string cursor;
     };
-    virtual std::unique_ptr<RowData> retrieveRows(std::shared_ptr<mediascanner::MediaStoreBase> store, int limit, int offset) const = 0;
+    virtual std::unique_ptr<RowData> retrieveRows(std::shared_ptr<mediascanner::MediaStoreBase> store, int limit, int offset, const std::string &cursor) const = 0;
+    // Optionally, the number of rows retrieveRows() will return in
+    // total, or -1 if there is no cheap way to tell. Models with a
+    // count should override this, see the totalCount property.
+    virtual int retrieveCount(std::shared_ptr<mediascanner::MediaStoreBase> store) const;
     virtual void appendRows(std::unique_ptr<RowData> &&row_data) = 0;
     virtual void clearBacking() = 0;
 
 protected:
+    // Page through a query, resuming from the cursor when there is one.
+    static void setPage(mediascanner::Filter &filter, int limit, int offset, const std::string &cursor);
+    // Waits for a query started by retrieveRows(). Unlike a blocking
+    // call, invalidate() cancels it rather than waiting for it to end.
+    template <typename T>
+    T waitForResult(mediascanner::AsyncResult<T> &&result) const {
+        setRunningQuery(result.getQuery());
+        try {
+            T value = result.get();
+            setRunningQuery(nullptr);
+            return value;
+        } catch (...) {
+            setRunningQuery(nullptr);
+            throw;
+        }
+    }
+    template <typename T>
+    static std::string cursorAfter(const std::vector<T> &rows) {
+        if (rows.empty()) {
+            return std::string();
+        }
+        mediascanner::Filter filter;
+        filter.setCursorAfter(rows.back());
+        return filter.getCursor();
+    }
+
     MediaStoreWrapper *getStore() const;
     void setStore(MediaStoreWrapper *store);
 
     ModelStatus getStatus() const;
     void setStatus(ModelStatus status);
 
+    int getTotalCount() const;
+
 private:
     void updateModel();
     void setWorkerStop(bool new_stop_status) noexcept { stopflag.store(new_stop_status, std::memory_order_release); }
+    void setRunningQuery(const std::shared_ptr<mediascanner::AsyncQuery> &query) const;
+    void cancelRunningQuery();
 
     QPointer<MediaStoreWrapper> store;
     QFuture<void> query_future;
     int generation;
     std::atomic<bool> stopflag;
+    // The query the worker is waiting for, if any.
+    mutable std::mutex running_mutex;
+    mutable std::shared_ptr<mediascanner::AsyncQuery> running_query;
     ModelStatus status;
+    int total_count;
 
 Q_SIGNALS:
     void countChanged();
+    void totalCountChanged();
     void statusChanged();
     // This next signal is here for backwards compatibility
     void filled();
@@ -0,0 +1,115 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of version 3 of the GNU General Public License as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mediascanner/Filter.hh"
+#include "mediascanner/MediaFile.hh"
+#include "mediascanner/MediaFileBuilder.hh"
+#include "mediascanner/MediaStore.hh"
+#include "mediascanner/MediaStoreOptions.hh"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<sys/stat.h>
+#include<chrono>
+#include<random>
+#include<string>
+#include<vector>
+
+using namespace std;
+using namespace mediascanner;
+
+// Search terms from one letter prefixes, which match a large part
+// of the vocabulary, up to complete words.
+static const char *TERMS[] = {"a", "st", "lov", "night", "the sto", "black night"};
+
+static const char *WORDS[] = {
+    "love", "night", "black", "story", "dance", "heart", "street", "river",
+    "summer", "light", "stone", "dream", "fire", "angel", "blue", "storm",
+    "ocean", "silver", "golden", "shadow", "morning", "star", "rain", "city",
+    "road", "home", "wild", "song", "ghost", "train", "winter", "moon",
+};
+
+static string words(mt19937 &rng, int count) {
+    uniform_int_distribution<size_t> pick(0, sizeof(WORDS) / sizeof(WORDS[0]) - 1);
+    string result;
+    for(int i = 0; i < count; i++) {
+        if(i != 0) {
+            result += ' ';
+        }
+        result += WORDS[pick(rng)];
+    }
+    return result;
+}
+
+static void bench(const string &dir, FullTextBackend backend, const char *name,
+                  int songs, int iterations) {
+    const string dbfile = dir + "/" + name + ".db";
+    MediaStoreOptions options;
+    options.setFullTextBackend(backend);
+    MediaStore store(dbfile, MS_READ_WRITE, options);
+
+    mt19937 rng(42);
+    vector<MediaFile> files;
+    for(int i = 0; i < songs; i++) {
+        files.emplace_back(MediaFileBuilder("/music/song" + to_string(i) + ".ogg")
+                           .setType(AudioMedia)
+                           .setTitle(words(rng, 3))
+                           .setAuthor(words(rng, 2))
+                           .setAlbum(words(rng, 2)));
+    }
+    auto start = chrono::steady_clock::now();
+    MediaStoreTransaction txn = store.beginTransaction();
+    store.insertBatch(move(files));
+    txn.commit();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    struct stat st;
+    stat(dbfile.c_str(), &st);
+    printf("%s: indexed %d songs in %.3f s, database is %ld kB\n",
+           name, songs, elapsed.count(), (long)st.st_size / 1024);
+
+    // Ranked results, and results in title order, which need no
+    // ranking and so mostly measure the term lookup.
+    for(MediaOrder order : {MediaOrder::Rank, MediaOrder::Title}) {
+        Filter filter;
+        filter.setLimit(50);
+        filter.setOrder(order);
+        printf("  %s order:\n", order == MediaOrder::Rank ? "rank" : "title");
+        for(const char *term : TERMS) {
+            size_t matches = 0;
+            start = chrono::steady_clock::now();
+            for(int i = 0; i < iterations; i++) {
+                matches = store.query(term, AudioMedia, filter).size();
+            }
+            elapsed = chrono::steady_clock::now() - start;
+            printf("    %-12s %7.3f ms/query (%zu results)\n", term,
+                   elapsed.count() * 1000 / iterations, matches);
+        }
+    }
+}
+
+int main(int argc, char **argv) {
+    const int songs = argc > 1 ? atoi(argv[1]) : 10000;
+    const int iterations = argc > 2 ? atoi(argv[2]) : 20;
+    char dir[] = "/tmp/ftsbench.XXXXXX";
+    if(mkdtemp(dir) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    bench(dir, FullTextBackend::FTS4, "fts4", songs, iterations);
+    bench(dir, FullTextBackend::FTS5, "fts5", songs, iterations);
+    string cmd = string("rm -rf ") + dir;
+    return system(cmd.c_str());
+}
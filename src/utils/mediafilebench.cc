@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of version 3 of the GNU General Public License as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mediascanner/Filter.hh"
+#include "mediascanner/MediaFile.hh"
+#include "mediascanner/MediaFileBuilder.hh"
+#include "mediascanner/MediaFileView.hh"
+#include "mediascanner/MediaStore.hh"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<chrono>
+#include<new>
+#include<string>
+#include<vector>
+
+using namespace std;
+using namespace mediascanner;
+
+// Every allocation of the process goes through here, so the counts
+// cover the library as well as this file.
+static size_t allocations = 0;
+static size_t allocated_bytes = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    allocated_bytes += size;
+    void *ptr = malloc(size ? size : 1);
+    if(ptr == nullptr) {
+        throw bad_alloc();
+    }
+    return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+    free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+    free(ptr);
+}
+
+struct Measurement {
+    size_t allocations = 0;
+    size_t bytes = 0;
+    double seconds = 0;
+};
+
+template <typename F>
+static Measurement measure(F f) {
+    const size_t start_allocations = allocations;
+    const size_t start_bytes = allocated_bytes;
+    auto start = chrono::steady_clock::now();
+    f();
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    Measurement m;
+    m.allocations = allocations - start_allocations;
+    m.bytes = allocated_bytes - start_bytes;
+    m.seconds = elapsed.count();
+    return m;
+}
+
+static void report(const char *name, int songs, const Measurement &m) {
+    printf("  %-10s %8.3f ms %9zu allocations %10zu kB (%.1f allocations, %zu bytes per song)\n",
+           name, m.seconds * 1000, m.allocations, m.bytes / 1024,
+           (double)m.allocations / songs, m.bytes / songs);
+}
+
+int main(int argc, char **argv) {
+    const int songs = argc > 1 ? atoi(argv[1]) : 20000;
+    char dir[] = "/tmp/mediafilebench.XXXXXX";
+    if(mkdtemp(dir) == nullptr) {
+        perror("mkdtemp");
+        return 1;
+    }
+    {
+        MediaStore store(string(dir) + "/mediastore.db", MS_READ_WRITE);
+        // A library of a typical shape: a few hundred artists with ten
+        // songs to an album and a handful of genres.
+        vector<MediaFile> files;
+        for(int i = 0; i < songs; i++) {
+            const string artist = "Some Artist Name " + to_string(i / 50);
+            files.emplace_back(MediaFileBuilder("/music/" + artist + "/song" + to_string(i) + ".ogg")
+                               .setType(AudioMedia)
+                               .setContentType("audio/ogg")
+                               .setTitle("Song Title Number " + to_string(i))
+                               .setAuthor(artist)
+                               .setAlbum("An Album Called " + to_string(i / 10))
+                               .setGenre("Genre " + to_string(i % 12))
+                               .setDate("2016-01-01")
+                               .setTrackNumber(i % 10 + 1)
+                               .setDuration(200));
+        }
+        MediaStoreTransaction txn = store.beginTransaction();
+        store.insertBatch(move(files));
+        txn.commit();
+
+        Filter filter;
+        filter.setLimit(-1);
+        printf("Listing %d songs:\n", songs);
+        vector<MediaFile> result;
+        // Each file with strings of its own, as results used to be.
+        report("separate", songs, measure([&] {
+            result.clear();
+            result.shrink_to_fit();
+            store.forEachSong(filter, [&result](const MediaFileView &m) {
+                result.push_back(m.toMediaFile());
+                return true;
+            });
+        }));
+        // The files of the result share repeating strings.
+        report("pooled", songs, measure([&] {
+            result.clear();
+            result.shrink_to_fit();
+            result = store.listSongs(filter);
+        }));
+        // Only what a song list shows.
+        Filter projected = filter;
+        projected.setFields(TitleField | ArtFields);
+        report("projected", songs, measure([&] {
+            result.clear();
+            result.shrink_to_fit();
+            result = store.listSongs(projected);
+        }));
+        // Reading the rows without keeping them.
+        size_t total_duration = 0;
+        report("visited", songs, measure([&] {
+            store.forEachSong(filter, [&total_duration](const MediaFileView &m) {
+                total_duration += m.getDuration();
+                return true;
+            });
+        }));
+        if(result.size() != (size_t)songs || total_duration != (size_t)songs * 200) {
+            fprintf(stderr, "Unexpected results.\n");
+            return 1;
+        }
+    }
+    string cmd = string("rm -rf ") + dir;
+    return system(cmd.c_str());
+}
@@ -0,0 +1,81 @@
+/*
+ * Copyright (C) 2016 Canonical, Ltd.
+ *
+ * This library is free software; you can redistribute it and/or modify it under
+ * the terms of version 3 of the GNU General Public License as published
+ * by the Free Software Foundation.
+ *
+ * This library is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+ * FOR A PARTICULAR PURPOSE. See the GNU General Public License for more
+ * details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "mediascanner/Album.hh"
+#include "mediascanner/Filter.hh"
+#include "mediascanner/MediaFile.hh"
+#include "mediascanner/MediaStore.hh"
+#include "mediascanner/MediaStoreOptions.hh"
+
+#include<stdio.h>
+#include<stdlib.h>
+#include<atomic>
+#include<chrono>
+#include<string>
+#include<thread>
+#include<vector>
+
+using namespace std;
+using namespace mediascanner;
+
+static const int THREAD_COUNTS[] = {1, 2, 4, 8};
+
+// Run a mix of the queries the music scope and QML models issue.
+static void runQueries(const MediaStore &store, const string &term, int iterations,
+                       atomic<long> &count) {
+    Filter filter;
+    filter.setLimit(50);
+    for(int i = 0; i < iterations; i++) {
+        store.query(term, AudioMedia, filter);
+        store.queryAlbums(term, filter);
+        store.listSongs(filter);
+        store.listArtists(filter);
+        count += 4;
+    }
+}
+
+static void bench(const string &dbfile, const string &term, int threads, int iterations) {
+    MediaStoreOptions options;
+    options.setReadConnections(threads);
+    MediaStore store(dbfile, MS_READ_ONLY, options);
+
+    atomic<long> count(0);
+    auto start = chrono::steady_clock::now();
+    vector<thread> workers;
+    for(int i = 0; i < threads; i++) {
+        workers.emplace_back(runQueries, cref(store), cref(term), iterations, ref(count));
+    }
+    for(auto &t : workers) {
+        t.join();
+    }
+    chrono::duration<double> elapsed = chrono::steady_clock::now() - start;
+    printf("%d threads: %ld queries in %.3f s, %.1f queries/s\n",
+           threads, count.load(), elapsed.count(), count / elapsed.count());
+}
+
+int main(int argc, char **argv) {
+    if(argc < 3) {
+        printf("%s <db file> <term> [iterations]\n", argv[0]);
+        return 1;
+    }
+    const string dbfile(argv[1]);
+    const string term(argv[2]);
+    const int iterations = argc > 3 ? atoi(argv[3]) : 100;
+    for(int threads : THREAD_COUNTS) {
+        bench(dbfile, term, threads, iterations);
+    }
+    return 0;
+}
@@ -44,6 +44,7 @@ Item {
             compare(model.album, undefined);
 
             compare(model.count, 7);
+            compare(model.totalCount, 7);
             compare(model.get(0, SongsModel.RoleTitle), "Buy Me a Pony")
             compare(model.get(0, SongsModel.RoleAlbum), "Ivy and the Big Apples");
             compare(model.get(0, SongsModel.RoleAuthor), "Spiderbait");
@@ -68,6 +69,7 @@ Item {
             model.artist = "The John Butler Trio";
             waitForReady();
             compare(model.count, 4);
+            compare(model.totalCount, 4);
 
             compare(model.get(0, SongsModel.RoleTitle), "Revolution");
             compare(model.get(0, SongsModel.RoleAuthor), "The John Butler Trio");
@@ -81,6 +83,7 @@ Item {
             model.albumArtist = "The John Butler Trio";
             waitForReady();
             compare(model.count, 4);
+            compare(model.totalCount, 4);
 
             compare(model.get(0, SongsModel.RoleTitle), "Revolution");
             compare(model.get(0, SongsModel.RoleAuthor), "The John Butler Trio");
@@ -4,9 +4,13 @@
 #include <core/dbus/types/object_path.h>
 
 #include <mediascanner/Album.hh>
+#include <mediascanner/BoundingBox.hh>
+#include <mediascanner/Facets.hh>
+#include <mediascanner/MediaChanges.hh>
 #include <mediascanner/MediaFile.hh>
 #include <mediascanner/MediaFileBuilder.hh>
 #include <mediascanner/Filter.hh>
+#include <mediascanner/Timeline.hh>
 #include <ms-dbus/dbus-codec.hh>
 
 class MediaStoreDBusTests : public ::testing::Test {
@@ -41,10 +45,11 @@ TEST_F(MediaStoreDBusTests, mediafile_codec) {
         .setLatitude(20.42)
         .setLongitude(-30.67)
         .setModificationTime(4200)
-        .setType(mediascanner::AudioMedia);
+        .setType(mediascanner::AudioMedia)
+        .setFingerprint("0123456789abcdef0123456789abcdef01234567");
     message->writer() << media;
 
-    EXPECT_EQ("(sssssssssiiiiiddbti)", message->signature());
+    EXPECT_EQ("(sssssssssiiiiiddbtis)", message->signature());
     EXPECT_EQ(core::dbus::helper::TypeMapper<mediascanner::MediaFile>::signature(), message->signature());
 
     mediascanner::MediaFile media2;
@@ -78,6 +83,8 @@ TEST_F(MediaStoreDBusTests, filter_codec) {
     filter.setGenre("Genre");
     filter.setOffset(42);
     filter.setLimit(100);
+    filter.setCursorAfter(std::string("Artist0"));
+    filter.setFields(mediascanner::TitleField | mediascanner::ArtFields);
     message->writer() << filter;
 
     EXPECT_EQ("a{sv}", message->signature());
@@ -99,6 +106,63 @@ TEST_F(MediaStoreDBusTests, filter_codec_empty) {
     EXPECT_EQ(empty, other);
 }
 
+TEST_F(MediaStoreDBusTests, facets_codec) {
+    mediascanner::Facets facets;
+    facets.genres = {{"Pop", 1}, {"Rock", 3}};
+    facets.artists = {{"Artist1", 4}};
+    message->writer() << facets;
+
+    EXPECT_EQ("(a(st)a(st)a(st))", message->signature());
+    EXPECT_EQ(core::dbus::helper::TypeMapper<mediascanner::Facets>::signature(), message->signature());
+
+    mediascanner::Facets other;
+    message->reader() >> other;
+    EXPECT_EQ(facets, other);
+}
+
+TEST_F(MediaStoreDBusTests, bounding_box_codec) {
+    mediascanner::BoundingBox box(59.5, 24.5, 60.5, -179.25);
+    message->writer() << box;
+
+    EXPECT_EQ("(dddd)", message->signature());
+    EXPECT_EQ(core::dbus::helper::TypeMapper<mediascanner::BoundingBox>::signature(), message->signature());
+
+    mediascanner::BoundingBox other;
+    message->reader() >> other;
+    EXPECT_EQ(box, other);
+}
+
+TEST_F(MediaStoreDBusTests, date_counts_codec) {
+    std::vector<mediascanner::DateCount> counts{{-86400, 2}, {1451606400, 5}};
+    message->writer() << counts;
+
+    EXPECT_EQ("a(xt)", message->signature());
+
+    std::vector<mediascanner::DateCount> other;
+    message->reader() >> other;
+    EXPECT_EQ(counts, other);
+}
+
+TEST_F(MediaStoreDBusTests, changes_codec) {
+    mediascanner::MediaChanges changes;
+    changes.sequence = 42;
+    mediascanner::MediaChange change;
+    change.sequence = 41;
+    change.change = mediascanner::ChangeType::Removed;
+    change.type = mediascanner::VideoMedia;
+    change.filename = "/path/foo.mp4";
+    changes.changes.push_back(change);
+    message->writer() << changes;
+
+    EXPECT_EQ("(tba(tiis))", message->signature());
+    EXPECT_EQ(core::dbus::helper::TypeMapper<mediascanner::MediaChanges>::signature(), message->signature());
+
+    mediascanner::MediaChanges other;
+    other.complete = false;
+    message->reader() >> other;
+    EXPECT_EQ(changes, other);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
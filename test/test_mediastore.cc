@@ -22,12 +22,22 @@
 #include <mediascanner/Album.hh>
 #include <mediascanner/Filter.hh>
 #include <mediascanner/MediaStore.hh>
+#include <mediascanner/MediaStoreOptions.hh>
 #include <mediascanner/internal/utils.hh>
+#include "test_config.h"
 
 #include <algorithm>
 #include <stdexcept>
 #include <cstdio>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <string>
+#include <thread>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <sqlite3.h>
 #include <gtest/gtest.h>
 
 using namespace std;
@@ -1349,7 +1359,1764 @@ TEST_F(MediaStoreTest, transaction) {
     EXPECT_THROW(store.lookup("/four.mp3"), std::runtime_error);
 }
 
+TEST_F(MediaStoreTest, statementCache) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    store.insert(MediaFileBuilder("/one.mp3").setType(AudioMedia));
+    uint64_t misses = store.statementCacheMisses();
+    uint64_t hits = store.statementCacheHits();
+
+    store.insert(MediaFileBuilder("/two.mp3").setType(AudioMedia));
+    EXPECT_EQ(misses, store.statementCacheMisses());
+    EXPECT_LT(hits, store.statementCacheHits());
+
+    // Filters of the same shape share a statement.
+    Filter filter;
+    filter.setArtist("foo");
+    store.listSongs(filter);
+    misses = store.statementCacheMisses();
+    filter.setArtist("bar");
+    store.listSongs(filter);
+    EXPECT_EQ(misses, store.statementCacheMisses());
+    filter.setGenre("baz");
+    store.listSongs(filter);
+    EXPECT_EQ(misses + 1, store.statementCacheMisses());
+}
+
+TEST_F(MediaStoreTest, writeAheadLog) {
+    string tmpdir = TEST_DIR "/wal-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStoreOptions options;
+        options.setWriteAheadLog(true);
+        MediaStore writer(dbfile, MS_READ_WRITE, options);
+        writer.insert(MediaFileBuilder("/one.mp3").setType(AudioMedia));
+        EXPECT_EQ(0, access((dbfile + "-wal").c_str(), F_OK));
+
+        MediaStore reader(dbfile, MS_READ_ONLY);
+        EXPECT_TRUE(reader.hasMedia(AudioMedia));
+
+        // Readers see the last committed state while the writer
+        // holds a transaction open.
+        MediaStoreTransaction txn = writer.beginTransaction();
+        writer.insert(MediaFileBuilder("/two.mp3").setType(AudioMedia));
+        EXPECT_EQ(1, reader.listSongs(Filter()).size());
+        EXPECT_EQ(2, writer.size());
+        txn.commit();
+        EXPECT_EQ(2, reader.listSongs(Filter()).size());
+    }
+    // The WAL files outlive the writer, so readers can open the
+    // database without write access to its directory.
+    EXPECT_EQ(0, access((dbfile + "-shm").c_str(), F_OK));
+    {
+        MediaStore reader(dbfile, MS_READ_ONLY);
+        EXPECT_EQ(2, reader.listSongs(Filter()).size());
+    }
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, cursorPaging) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    for (int i = 0; i < 25; i++) {
+        const std::string n = std::to_string(i);
+        store.insert(MediaFile(MediaFileBuilder("/path/song" + n + ".ogg")
+                               .setType(AudioMedia)
+                               .setTitle(i % 3 == 0 ? "Same Title" : "Title " + n)
+                               .setAuthor("Artist " + std::to_string(i % 7))
+                               .setAlbum("Album " + std::to_string(i % 5))
+                               .setAlbumArtist("Artist " + std::to_string(i % 2))
+                               .setGenre("Genre " + std::to_string(i % 4))
+                               .setTrackNumber(i % 3)
+                               .setModificationTime(i % 4)));
+    }
+
+    // Paging with a cursor returns the same items as one big query.
+    Filter filter;
+    const auto all_songs = store.listSongs(filter);
+    ASSERT_EQ(25, all_songs.size());
+    std::vector<MediaFile> songs;
+    filter.setLimit(4);
+    while (true) {
+        auto page = store.listSongs(filter);
+        if (page.empty()) {
+            break;
+        }
+        songs.insert(songs.end(), page.begin(), page.end());
+        filter.setCursorAfter(page.back());
+    }
+    EXPECT_EQ(all_songs, songs);
+
+    filter.clear();
+    const auto all_albums = store.listAlbums(filter);
+    std::vector<Album> albums;
+    filter.setLimit(3);
+    for (auto page = store.listAlbums(filter); !page.empty(); page = store.listAlbums(filter)) {
+        albums.insert(albums.end(), page.begin(), page.end());
+        filter.setCursorAfter(page.back());
+    }
+    EXPECT_EQ(all_albums, albums);
+
+    filter.clear();
+    const auto all_artists = store.listArtists(filter);
+    std::vector<std::string> artists;
+    filter.setLimit(2);
+    for (auto page = store.listArtists(filter); !page.empty(); page = store.listArtists(filter)) {
+        artists.insert(artists.end(), page.begin(), page.end());
+        filter.setCursorAfter(page.back());
+    }
+    EXPECT_EQ(all_artists, artists);
+
+    for (const auto order : {MediaOrder::Title, MediaOrder::Modified}) {
+        for (const bool reverse : {false, true}) {
+            filter.clear();
+            filter.setOrder(order);
+            filter.setReverse(reverse);
+            const auto all_results = store.query("", AudioMedia, filter);
+            std::vector<MediaFile> results;
+            filter.setLimit(4);
+            for (auto page = store.query("", AudioMedia, filter); !page.empty();
+                 page = store.query("", AudioMedia, filter)) {
+                results.insert(results.end(), page.begin(), page.end());
+                filter.setCursorAfter(page.back());
+            }
+            EXPECT_EQ(all_results, results);
+        }
+    }
+
+    filter.clear();
+    filter.setCursorAfter(all_songs[0]);
+    EXPECT_THROW(store.query("title", AudioMedia, filter), std::runtime_error);
+    EXPECT_THROW(store.listAlbums(filter), std::runtime_error);
+    filter.setCursor("garbage");
+    EXPECT_THROW(store.listSongs(filter), std::runtime_error);
+}
+
+TEST_F(MediaStoreTest, albumsTable) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    store.insert(MediaFile(MediaFileBuilder("/path/b.ogg").setType(AudioMedia)
+                           .setAlbum("Album").setAlbumArtist("Artist").setGenre("Rock")));
+    store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia)
+                           .setAlbum("Album").setAlbumArtist("Artist").setGenre("Pop")));
+    store.insert(MediaFile(MediaFileBuilder("/path/c.ogg").setType(AudioMedia)
+                           .setAlbum("Other").setAlbumArtist("Artist")));
+    store.insert(MediaFile(MediaFileBuilder("/path/v.mp4").setType(VideoMedia)
+                           .setAlbum("Video")));
+
+    vector<Album> albums = store.listAlbums(Filter());
+    ASSERT_EQ(2, albums.size());
+    EXPECT_EQ("Album", albums[0].getTitle());
+    EXPECT_EQ("/path/a.ogg", albums[0].getArtFile());
+    EXPECT_EQ("Pop", albums[0].getGenre());
+
+    // Removing the song the album details come from picks the next one.
+    store.remove("/path/a.ogg");
+    albums = store.listAlbums(Filter());
+    ASSERT_EQ(2, albums.size());
+    EXPECT_EQ("/path/b.ogg", albums[0].getArtFile());
+    EXPECT_EQ("Rock", albums[0].getGenre());
+
+    // Replacing a song moves it to its new album.
+    store.insert(MediaFile(MediaFileBuilder("/path/b.ogg").setType(AudioMedia)
+                           .setAlbum("Other").setAlbumArtist("Artist")));
+    albums = store.listAlbums(Filter());
+    ASSERT_EQ(1, albums.size());
+    EXPECT_EQ("Other", albums[0].getTitle());
+    EXPECT_EQ("/path/b.ogg", albums[0].getArtFile());
+    EXPECT_EQ(1, store.queryAlbums("other", Filter()).size());
+
+    store.archiveItems("/path");
+    EXPECT_EQ(0, store.listAlbums(Filter()).size());
+    store.restoreItems("/path");
+    EXPECT_EQ(1, store.listAlbums(Filter()).size());
+}
+
+// Turns a database of the current schema into a schema version 12 one,
+// with artists and genres stored as text only.
+static void downgrade_to_v12(sqlite3 *db) {
+    // Dropping columns checks the triggers, which fails on the full
+    // text index without the custom tokenizer. Set them aside.
+    vector<string> triggers;
+    sqlite3_stmt *stmt;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT sql FROM sqlite_master WHERE type = 'trigger' AND tbl_name = 'media' AND name NOT LIKE 'media_changes_%' AND name NOT LIKE 'media_location_%'", -1, &stmt, nullptr));
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        triggers.push_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+    }
+    sqlite3_finalize(stmt);
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, R"(
+DROP TRIGGER media_bu;
+DROP TRIGGER media_au;
+DROP TRIGGER media_bd;
+DROP TRIGGER media_ai;
+DROP TRIGGER albums_ai;
+DROP TRIGGER albums_ad;
+DROP TRIGGER albums_au_old;
+DROP TRIGGER albums_au_new;
+DROP TRIGGER media_changes_ai;
+DROP TRIGGER media_changes_au;
+DROP TRIGGER media_changes_ad;
+DROP TABLE media_changes;
+DROP TABLE media_changes_pruned;
+DROP TRIGGER media_location_ai;
+DROP TRIGGER media_location_au;
+DROP TRIGGER media_location_ad;
+DROP TABLE media_location;
+DROP INDEX media_artist_idx;
+DROP INDEX media_album_artist_idx;
+DROP INDEX media_genre_idx;
+DROP INDEX media_date_idx;
+DROP INDEX media_fingerprint_idx;
+ALTER TABLE media DROP COLUMN date_epoch;
+ALTER TABLE media DROP COLUMN fingerprint;
+ALTER TABLE media DROP COLUMN artist_id;
+ALTER TABLE media DROP COLUMN album_artist_id;
+ALTER TABLE media DROP COLUMN genre_id;
+ALTER TABLE media_attic RENAME TO media_attic_new;
+CREATE TABLE media_attic (
+    filename TEXT UNIQUE NOT NULL, content_type TEXT, etag TEXT, title TEXT,
+    date TEXT, artist TEXT, album TEXT, album_artist TEXT, genre TEXT,
+    disc_number INTEGER, track_number INTEGER, duration INTEGER,
+    width INTEGER, height INTEGER, latitude DOUBLE, longitude DOUBLE,
+    has_thumbnail INTEGER, mtime INTEGER, type INTEGER);
+INSERT INTO media_attic
+  SELECT filename, content_type, etag, title, date,
+      (SELECT name FROM artists WHERE id = artist_id), album,
+      (SELECT name FROM artists WHERE id = album_artist_id),
+      (SELECT name FROM genres WHERE id = genre_id),
+      disc_number, track_number, duration, width, height, latitude, longitude,
+      has_thumbnail, mtime, type
+    FROM media_attic_new;
+DROP TABLE media_attic_new;
+DROP TABLE artists;
+DROP TABLE genres;
+DROP TABLE offline_volumes;
+CREATE INDEX media_artist_idx ON media(type, artist) WHERE type = 1;
+CREATE INDEX media_genre_idx ON media(type, genre) WHERE type = 1;
+UPDATE schemaVersion SET version = 12;
+)", nullptr, nullptr, nullptr));
+    for (const auto &sql : triggers) {
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
+    }
+}
+
+TEST_F(MediaStoreTest, upgradeAlbumsTable) {
+    string tmpdir = TEST_DIR "/upgrade-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia)
+                               .setAlbum("Album").setAlbumArtist("Artist")));
+        store.insert(MediaFile(MediaFileBuilder("/path/b.ogg").setType(AudioMedia)
+                               .setAlbum("Album").setAlbumArtist("Artist")));
+    }
+    // Turn the database into a schema version 11 one.
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    downgrade_to_v12(db);
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, R"(
+DROP TRIGGER albums_ai;
+DROP TRIGGER albums_ad;
+DROP TRIGGER albums_au_old;
+DROP TRIGGER albums_au_new;
+DROP TABLE albums;
+UPDATE schemaVersion SET version = 11;
+)", nullptr, nullptr, nullptr));
+    sqlite3_close(db);
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        // The songs survive and the albums table gets filled in.
+        EXPECT_EQ(2, store.size());
+        vector<Album> albums = store.listAlbums(Filter());
+        ASSERT_EQ(1, albums.size());
+        EXPECT_EQ("/path/a.ogg", albums[0].getArtFile());
+    }
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, upgradeFromVersion10) {
+    string tmpdir = TEST_DIR "/upgrade-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia)
+                               .setTitle("Yellow Submarine").setAlbum("Album").setAlbumArtist("Artist")));
+        store.insert(MediaFile(MediaFileBuilder("/path/b.mp4").setType(VideoMedia)
+                               .setTitle("Yellow River")));
+        store.insert_broken_file("/path/c.ogg", "c");
+    }
+    // Turn the database into one of schema version 10, the last before
+    // the migrations, with full text triggers that always run.
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    downgrade_to_v12(db);
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, R"(
+DROP TRIGGER albums_ai;
+DROP TRIGGER albums_ad;
+DROP TRIGGER albums_au_old;
+DROP TRIGGER albums_au_new;
+DROP TABLE albums;
+DROP TRIGGER media_bu;
+DROP TRIGGER media_au;
+DROP TRIGGER media_bd;
+DROP TRIGGER media_ai;
+CREATE TRIGGER media_bu BEFORE UPDATE ON media BEGIN
+  DELETE FROM media_fts WHERE docid=old.id;
+END;
+CREATE TRIGGER media_au AFTER UPDATE ON media BEGIN
+  INSERT INTO media_fts(docid, title, artist, album) VALUES (new.id, new.title, new.artist, new.album);
+END;
+CREATE TRIGGER media_bd BEFORE DELETE ON media BEGIN
+  DELETE FROM media_fts WHERE docid=old.id;
+END;
+CREATE TRIGGER media_ai AFTER INSERT ON media BEGIN
+  INSERT INTO media_fts(docid, title, artist, album) VALUES (new.id, new.title, new.artist, new.album);
+END;
+UPDATE schemaVersion SET version = 10;
+)", nullptr, nullptr, nullptr));
+    sqlite3_close(db);
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        // Upgraded in place rather than rebuilt.
+        EXPECT_EQ(2, store.size());
+        EXPECT_EQ(1, store.query("yellow", AudioMedia, Filter()).size());
+        EXPECT_EQ(1, store.query("yellow", VideoMedia, Filter()).size());
+        EXPECT_TRUE(store.is_broken_file("/path/c.ogg", "c"));
+        EXPECT_EQ(1, store.listAlbums(Filter()).size());
+        // The full text triggers can be deferred again.
+        store.insertBatch({MediaFile(MediaFileBuilder("/path/d.ogg").setType(AudioMedia).setTitle("Yellow Moon"))});
+        EXPECT_EQ(2, store.query("yellow", AudioMedia, Filter()).size());
+    }
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    sqlite3_stmt *stmt;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT count(*) FROM sqlite_master WHERE type = 'trigger' AND name IN ('media_bu', 'media_au', 'media_bd', 'media_ai') AND sql LIKE '%WHEN NOT fts_deferred()%'", -1, &stmt, nullptr));
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_EQ(4, sqlite3_column_int(stmt, 0));
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, dictionaryTables) {
+    string tmpdir = TEST_DIR "/dictionary-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia)
+                               .setAuthor("Artist").setAlbumArtist("Various").setGenre("Rock")));
+        store.insert(MediaFile(MediaFileBuilder("/path/b.ogg").setType(AudioMedia)
+                               .setAuthor("Various").setAlbumArtist("Various").setGenre("Rock")));
+        store.insert(MediaFile(MediaFileBuilder("/other/c.ogg").setType(AudioMedia)
+                               .setAuthor("Solo").setAlbumArtist("Solo").setGenre("Jazz")));
+        store.insert(MediaFile(MediaFileBuilder("/other/d.mp4").setType(VideoMedia)
+                               .setAuthor("Director")));
+
+        // Videos don't count as artists.
+        EXPECT_EQ(vector<string>({"Artist", "Solo", "Various"}), store.listArtists(Filter()));
+        EXPECT_EQ(vector<string>({"Solo", "Various"}), store.listAlbumArtists(Filter()));
+        EXPECT_EQ(vector<string>({"Jazz", "Rock"}), store.listGenres(Filter()));
+        Filter filter;
+        filter.setGenre("Rock");
+        EXPECT_EQ(vector<string>({"Artist", "Various"}), store.listArtists(filter));
+        EXPECT_EQ(vector<string>({"Various"}), store.listAlbumArtists(filter));
+        filter.setArtist("Artist");
+        ASSERT_EQ(1, store.listSongs(filter).size());
+        EXPECT_EQ("/path/a.ogg", store.listSongs(filter)[0].getFileName());
+
+        // Names kept alive by offline files survive pruning and come
+        // back with the files.
+        store.archiveItems("/path");
+        store.removeSubtree("/other");
+        EXPECT_EQ(0, store.listArtists(Filter()).size());
+        store.restoreItems("/path");
+        EXPECT_EQ(vector<string>({"Artist", "Various"}), store.listArtists(Filter()));
+        MediaFile restored = store.lookup("/path/a.ogg");
+        EXPECT_EQ("Artist", restored.getAuthor());
+        EXPECT_EQ("Various", restored.getAlbumArtist());
+        EXPECT_EQ("Rock", restored.getGenre());
+    }
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    sqlite3_stmt *stmt;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT name FROM artists ORDER BY name", -1, &stmt, nullptr));
+    vector<string> names;
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        names.push_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    EXPECT_EQ(vector<string>({"Artist", "Various"}), names);
+
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, upgradeDictionaryTables) {
+    string tmpdir = TEST_DIR "/upgrade-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia)
+                               .setAuthor("Artist").setGenre("Rock")));
+    }
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    downgrade_to_v12(db);
+    // A file archived by an older version.
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, R"(
+INSERT INTO media_attic (filename, content_type, etag, title, date, artist, album, album_artist, genre, type)
+  VALUES ('/media/b.ogg', '', '', 'b', '', 'Other', '', 'Other', 'Jazz', 1);
+)", nullptr, nullptr, nullptr));
+    sqlite3_close(db);
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        EXPECT_EQ(1, store.size());
+        EXPECT_EQ(vector<string>({"Artist"}), store.listArtists(Filter()));
+        EXPECT_EQ(vector<string>({"Rock"}), store.listGenres(Filter()));
+        store.restoreItems("/media");
+        EXPECT_EQ(vector<string>({"Artist", "Other"}), store.listArtists(Filter()));
+        EXPECT_EQ(vector<string>({"Jazz", "Rock"}), store.listGenres(Filter()));
+        EXPECT_EQ(1, store.query("other", AudioMedia, Filter()).size());
+    }
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, failedUpgradeRebuilds) {
+    string tmpdir = TEST_DIR "/upgrade-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia).setAuthor("Artist")));
+    }
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    downgrade_to_v12(db);
+    // Makes the step to version 13 fail half way through.
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "CREATE TABLE genres (x)", nullptr, nullptr, nullptr));
+    sqlite3_close(db);
+    {
+        // Nothing of the partial upgrade remains, the tables are
+        // recreated instead.
+        MediaStore store(dbfile, MS_READ_WRITE);
+        EXPECT_EQ(0, store.size());
+        store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia).setAuthor("Artist")));
+        EXPECT_EQ(vector<string>({"Artist"}), store.listArtists(Filter()));
+    }
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, insertBatch) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    store.insert(MediaFile(MediaFileBuilder("/path/old.mp3").setType(AudioMedia).setTitle("Old Title")));
+    store.insert_broken_file("/path/file0.mp3", "etag");
+
+    std::vector<MediaFile> files;
+    for (int i = 0; i < 70; i++) {
+        files.emplace_back(MediaFileBuilder("/path/file" + std::to_string(i) + ".mp3")
+                           .setType(AudioMedia)
+                           .setTitle("Batch Song " + std::to_string(i)));
+    }
+    files.emplace_back(MediaFileBuilder("/path/old.mp3").setType(AudioMedia).setTitle("New Title"));
+    // A file repeated within the batch keeps its last version.
+    files.emplace_back(MediaFileBuilder("/path/file1.mp3").setType(AudioMedia).setTitle("Renamed"));
+    store.insertBatch(std::move(files));
+    EXPECT_TRUE(files.empty());
+
+    EXPECT_EQ(71, store.size());
+    EXPECT_FALSE(store.is_broken_file("/path/file0.mp3", "etag"));
+    EXPECT_EQ(69, store.query("batch", AudioMedia, Filter()).size());
+    EXPECT_EQ(1, store.query("renamed", AudioMedia, Filter()).size());
+    EXPECT_EQ(0, store.query("old", AudioMedia, Filter()).size());
+    EXPECT_EQ(1, store.query("new", AudioMedia, Filter()).size());
+
+    // The triggers keep the index up to date again after the batch.
+    store.remove("/path/file2.mp3");
+    EXPECT_EQ(68, store.query("batch", AudioMedia, Filter()).size());
+    store.insert(MediaFile(MediaFileBuilder("/path/single.mp3").setType(AudioMedia).setTitle("Batch Single")));
+    EXPECT_EQ(69, store.query("batch", AudioMedia, Filter()).size());
+
+    // A bad file fails the whole batch, leaving the files to be
+    // inserted one at a time.
+    store.insert_broken_file("/path/good.mp3", "etag");
+    store.insert_broken_file("relative.mp3", "etag");
+    files.clear();
+    files.emplace_back(MediaFileBuilder("/path/good.mp3").setType(AudioMedia).setTitle("Good"));
+    files.emplace_back(MediaFileBuilder("relative.mp3").setType(AudioMedia).setTitle("Bad"));
+    EXPECT_THROW(store.insertBatch(std::move(files)), std::runtime_error);
+    ASSERT_EQ(2, files.size());
+    EXPECT_EQ(0, store.query("good", AudioMedia, Filter()).size());
+    EXPECT_TRUE(store.is_broken_file("/path/good.mp3", "etag"));
+    store.insert(files[0]);
+    EXPECT_THROW(store.insert(files[1]), std::runtime_error);
+    EXPECT_EQ(1, store.query("good", AudioMedia, Filter()).size());
+    EXPECT_FALSE(store.is_broken_file("/path/good.mp3", "etag"));
+    EXPECT_TRUE(store.is_broken_file("relative.mp3", "etag"));
+}
+
+TEST_F(MediaStoreTest, etagIndex) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    store.insert(MediaFile(MediaFileBuilder("/music/a.mp3").setETag("a1").setType(AudioMedia)));
+    store.insert(MediaFile(MediaFileBuilder("/music/sub/b.mp3").setETag("b1").setType(AudioMedia)));
+    store.insert(MediaFile(MediaFileBuilder("/video/c.mp4").setETag("c1").setType(VideoMedia)));
+    store.insert_broken_file("/music/broken.mp3", "x1");
+
+    store.loadETagIndex("/music");
+    EXPECT_EQ("a1", store.getETag("/music/a.mp3"));
+    EXPECT_EQ("b1", store.getETag("/music/sub/b.mp3"));
+    EXPECT_EQ("c1", store.getETag("/video/c.mp4"));
+    EXPECT_EQ("", store.getETag("/music/missing.mp3"));
+    EXPECT_TRUE(store.is_broken_file("/music/broken.mp3", "x1"));
+    EXPECT_FALSE(store.is_broken_file("/music/broken.mp3", "x2"));
+
+    // Writes keep the index up to date.
+    store.insert(MediaFile(MediaFileBuilder("/music/a.mp3").setETag("a2").setType(AudioMedia)));
+    EXPECT_EQ("a2", store.getETag("/music/a.mp3"));
+    store.insertBatch({MediaFile(MediaFileBuilder("/music/broken.mp3").setETag("x1").setType(AudioMedia))});
+    EXPECT_EQ("x1", store.getETag("/music/broken.mp3"));
+    EXPECT_FALSE(store.is_broken_file("/music/broken.mp3", "x1"));
+    store.insert_broken_file("/music/d.mp3", "d1");
+    EXPECT_TRUE(store.is_broken_file("/music/d.mp3", "d1"));
+    store.remove("/music/a.mp3");
+    EXPECT_EQ("", store.getETag("/music/a.mp3"));
+    store.removeSubtree("/music/sub");
+    EXPECT_EQ("", store.getETag("/music/sub/b.mp3"));
+    // Broken files are not media, so removing them keeps their state.
+    store.removeSubtree("/");
+    EXPECT_EQ("", store.getETag("/music/broken.mp3"));
+    EXPECT_TRUE(store.is_broken_file("/music/d.mp3", "d1"));
+    store.insert(MediaFile(MediaFileBuilder("/music/broken.mp3").setETag("x1").setType(AudioMedia)));
+
+    // A rolled back transaction drops the index.
+    {
+        MediaStoreTransaction txn = store.beginTransaction();
+        store.insert(MediaFile(MediaFileBuilder("/music/e.mp3").setETag("e1").setType(AudioMedia)));
+        EXPECT_EQ("e1", store.getETag("/music/e.mp3"));
+    }
+    EXPECT_EQ("", store.getETag("/music/e.mp3"));
+
+    store.loadETagIndex("/music");
+    store.dropETagIndex();
+    EXPECT_EQ("x1", store.getETag("/music/broken.mp3"));
+}
+
+TEST_F(MediaStoreTest, etagIndexAfterCommit) {
+    string tmpdir = TEST_DIR "/etag-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    MediaStore store(dbfile, MS_READ_WRITE);
+    store.loadETagIndex("/music");
+    {
+        MediaStoreTransaction txn = store.beginTransaction();
+        store.insert_broken_file("/music/a.mp3", "a1");
+        txn.commit();
+    }
+    // Change the table behind the store's back: the index still
+    // answers, as ending the committed transaction undid nothing.
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "DELETE FROM broken_files", nullptr, nullptr, nullptr));
+    sqlite3_close(db);
+    EXPECT_TRUE(store.is_broken_file("/music/a.mp3", "a1"));
+    store.dropETagIndex();
+    EXPECT_FALSE(store.is_broken_file("/music/a.mp3", "a1"));
+
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, readConnections) {
+    string tmpdir = TEST_DIR "/pool-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStoreOptions options;
+        options.setWriteAheadLog(true);
+        options.setReadConnections(2);
+        MediaStore writer(dbfile, MS_READ_WRITE, options);
+        writer.insert(MediaFileBuilder("/one.mp3").setType(AudioMedia).setTitle("Bee Song"));
+
+        // Queries within a transaction see its uncommitted changes.
+        MediaStoreTransaction txn = writer.beginTransaction();
+        writer.insert(MediaFileBuilder("/two.mp3").setType(AudioMedia).setTitle("Bee Song"));
+        EXPECT_EQ(2, writer.size());
+        EXPECT_EQ(2, writer.query("bee", AudioMedia, Filter()).size());
+        txn.commit();
+    }
+    {
+        MediaStoreOptions options;
+        options.setReadConnections(2);
+        MediaStore reader(dbfile, MS_READ_ONLY, options);
+        std::vector<std::thread> threads;
+        std::vector<size_t> results(8);
+        for (size_t i = 0; i < results.size(); i++) {
+            threads.emplace_back([&reader, &results, i]() {
+                    for (int j = 0; j < 20; j++) {
+                        results[i] += reader.query("bee", AudioMedia, Filter()).size();
+                    }
+                });
+        }
+        for (auto &t : threads) {
+            t.join();
+        }
+        for (const auto count : results) {
+            EXPECT_EQ(40, count);
+        }
+    }
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
 }
+
+TEST_F(MediaStoreTest, fts5Search) {
+    MediaStoreOptions options;
+    options.setFullTextBackend(FullTextBackend::FTS5);
+    MediaStore store(":memory:", MS_READ_WRITE, options);
+    MediaFile audio1 = MediaFileBuilder("/path/foo1.ogg")
+        .setType(AudioMedia).setTitle("title aaa").setAuthor("artist")
+        .setAlbum("album").setAlbumArtist("albumartist");
+    MediaFile audio2 = MediaFileBuilder("/path/foo2.ogg")
+        .setType(AudioMedia).setTitle("title").setAuthor("artist aaa")
+        .setAlbum("album").setAlbumArtist("albumartist");
+    MediaFile audio3 = MediaFileBuilder("/path/foo3.ogg")
+        .setType(AudioMedia).setTitle("title").setAuthor("artist")
+        .setAlbum("album aaa").setAlbumArtist("albumartist");
+    MediaFile audio4 = MediaFileBuilder("/path/foo4.ogg")
+        .setType(AudioMedia).setTitle("Don't stop xyz").setAuthor("AC/DC")
+        .setAlbum("other").setAlbumArtist("AC/DC");
+    store.insert(audio1);
+    store.insert(audio2);
+    store.insert(audio3);
+    store.insert(audio4);
+
+    // Same weights as the FTS4 ranking: title, then album, then artist.
+    vector<MediaFile> result = store.query("aaa", AudioMedia, Filter());
+    ASSERT_EQ(3, result.size());
+    EXPECT_EQ(audio1, result[0]);
+    EXPECT_EQ(audio3, result[1]);
+    EXPECT_EQ(audio2, result[2]);
+
+    // Short prefixes and punctuation that is FTS5 query syntax.
+    EXPECT_EQ(1, store.query("x", AudioMedia, Filter()).size());
+    EXPECT_EQ(1, store.query("xy", AudioMedia, Filter()).size());
+    EXPECT_EQ(1, store.query("don't st", AudioMedia, Filter()).size());
+    EXPECT_EQ(1, store.query("stop/xyz", AudioMedia, Filter()).size());
+    EXPECT_EQ(3, store.query("\"title", AudioMedia, Filter()).size());
+    EXPECT_EQ(0, store.query("title xyz aaa", AudioMedia, Filter()).size());
+    EXPECT_EQ(1, store.queryAlbums("oth", Filter()).size());
+    EXPECT_EQ(vector<string>({"artist", "artist aaa"}), store.queryArtists("aaa", Filter()));
+
+    // The triggers and batch inserts keep the index in step.
+    store.insert(MediaFile(MediaFileBuilder("/path/foo1.ogg").setType(AudioMedia).setTitle("renamed")));
+    store.remove("/path/foo2.ogg");
+    EXPECT_EQ(1, store.query("aaa", AudioMedia, Filter()).size());
+    EXPECT_EQ(1, store.query("renamed", AudioMedia, Filter()).size());
+    std::vector<MediaFile> files;
+    files.emplace_back(MediaFileBuilder("/path/foo3.ogg").setType(AudioMedia).setTitle("batch"));
+    files.emplace_back(MediaFileBuilder("/path/foo5.ogg").setType(AudioMedia).setTitle("batch"));
+    store.insertBatch(std::move(files));
+    EXPECT_EQ(0, store.query("aaa", AudioMedia, Filter()).size());
+    EXPECT_EQ(2, store.query("batch", AudioMedia, Filter()).size());
+}
+
+TEST_F(MediaStoreTest, fts5KeptOnReopen) {
+    string tmpdir = TEST_DIR "/fts5-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStoreOptions options;
+        options.setFullTextBackend(FullTextBackend::FTS5);
+        MediaStore store(dbfile, MS_READ_WRITE, options);
+        store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia).setTitle("Bee Song")));
+    }
+    {
+        // Default options don't turn the index back into FTS4.
+        MediaStoreOptions options;
+        options.setWriteAheadLog(true);
+        options.setReadConnections(2);
+        MediaStore store(dbfile, MS_READ_WRITE, options);
+        store.insert(MediaFile(MediaFileBuilder("/path/b.ogg").setType(AudioMedia).setTitle("Bee Dance")));
+        EXPECT_EQ(2, store.query("be", AudioMedia, Filter()).size());
+    }
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    sqlite3_stmt *stmt;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT sql FROM sqlite_master WHERE name = 'media_fts'", -1, &stmt, nullptr));
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_NE(nullptr, strstr(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)), "fts5"));
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    {
+        MediaStore store(dbfile, MS_READ_ONLY);
+        EXPECT_EQ(1, store.query("dance", AudioMedia, Filter()).size());
+    }
+
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, pruneDeleted) {
+    string tmpdir = TEST_DIR "/prune-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    ASSERT_EQ(0, mkdir((tmpdir + "/music").c_str(), 0755));
+    ASSERT_EQ(0, mkdir((tmpdir + "/blocked").c_str(), 0755));
+    ASSERT_EQ(0, mkdir((tmpdir + "/blocked/sub").c_str(), 0755));
+    for (const char *name : {"/music/kept.ogg", "/blocked/.nomedia", "/blocked/sub/song.ogg"}) {
+        FILE *f = fopen((tmpdir + name).c_str(), "w");
+        ASSERT_NE(nullptr, f);
+        fclose(f);
+    }
+
+    MediaStore store(":memory:", MS_READ_WRITE);
+    for (const char *name : {"/music/kept.ogg", "/music/gone.ogg",
+                             "/missing/song.ogg", "/blocked/sub/song.ogg"}) {
+        store.insert(MediaFileBuilder(tmpdir + name)
+                     .setType(AudioMedia)
+                     .setAuthor(string("Artist ") + name));
+    }
+    EXPECT_EQ(4, store.size());
+    store.pruneDeleted();
+    EXPECT_EQ(1, store.size());
+    EXPECT_NO_THROW(store.lookup(tmpdir + "/music/kept.ogg"));
+    EXPECT_THROW(store.lookup(tmpdir + "/music/gone.ogg"), std::runtime_error);
+    EXPECT_EQ("", store.getETag(tmpdir + "/blocked/sub/song.ogg"));
+
+    vector<string> artists = store.listArtists(Filter());
+    ASSERT_EQ(1, artists.size());
+    EXPECT_EQ("Artist /music/kept.ogg", artists[0]);
+
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, prefixRanges) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    // Characters special to LIKE, and case differences, must not
+    // widen the match.
+    for (const char *name : {"/media/a_b/one.ogg", "/media/axb/two.ogg",
+                             "/media/A_B/three.ogg", "/media/a_b%/four.ogg"}) {
+        store.insert(MediaFileBuilder(name).setType(AudioMedia));
+    }
+    store.archiveItems("/media/a_b/");
+    EXPECT_EQ(3, store.size());
+    EXPECT_THROW(store.lookup("/media/a_b/one.ogg"), std::runtime_error);
+
+    store.removeSubtree("/media/a_b%");
+    EXPECT_EQ(2, store.size());
+    EXPECT_NO_THROW(store.lookup("/media/axb/two.ogg"));
+    EXPECT_NO_THROW(store.lookup("/media/A_B/three.ogg"));
+
+    store.restoreItems("/media/a_b/");
+    EXPECT_EQ(3, store.size());
+    EXPECT_NO_THROW(store.lookup("/media/a_b/one.ogg"));
+
+    // Restoring again finds nothing left in the attic.
+    store.restoreItems("/media/a_b/");
+    EXPECT_EQ(3, store.size());
+}
+
+TEST_F(MediaStoreTest, offlineVolumes) {
+    string tmpdir = TEST_DIR "/offline-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    const string home_file = tmpdir + "/a.ogg";
+    FILE *f = fopen(home_file.c_str(), "w");
+    ASSERT_NE(nullptr, f);
+    fclose(f);
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.insert(MediaFileBuilder(home_file).setType(AudioMedia)
+                     .setTitle("song").setAuthor("Home").setAlbum("Here"));
+        store.insert(MediaFileBuilder("/media/card/b.ogg").setType(AudioMedia)
+                     .setTitle("song").setAuthor("Card").setAlbum("There"));
+        store.insert(MediaFileBuilder("/media/card/c.ogv").setType(VideoMedia));
+
+        store.archiveItems("/media/card/");
+        EXPECT_EQ(1, store.size());
+        EXPECT_FALSE(store.hasMedia(VideoMedia));
+        EXPECT_THROW(store.lookup("/media/card/b.ogg"), std::runtime_error);
+        EXPECT_EQ("", store.getETag("/media/card/b.ogg"));
+        EXPECT_EQ(1, store.query("song", AudioMedia, Filter()).size());
+        EXPECT_EQ(1, store.listSongs(Filter()).size());
+        EXPECT_EQ(vector<string>({"Home"}), store.listArtists(Filter()));
+        ASSERT_EQ(1, store.listAlbums(Filter()).size());
+        EXPECT_EQ("Here", store.listAlbums(Filter())[0].getTitle());
+        ASSERT_EQ(1, store.queryAlbums("", Filter()).size());
+        EXPECT_EQ(0, store.queryAlbums("there", Filter()).size());
+        EXPECT_EQ(0, store.getAlbumSongs(Album("There", "Card")).size());
+
+        // Offline files are not on disk, but must survive pruning.
+        store.pruneDeleted();
+    }
+    // The rows never left the media table.
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    sqlite3_stmt *stmt;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT count(*) FROM media", -1, &stmt, nullptr));
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_EQ(3, sqlite3_column_int(stmt, 0));
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.restoreItems("/media/card/");
+        EXPECT_EQ(3, store.size());
+        EXPECT_TRUE(store.hasMedia(VideoMedia));
+        EXPECT_EQ(2, store.query("song", AudioMedia, Filter()).size());
+        EXPECT_EQ(vector<string>({"Card", "Home"}), store.listArtists(Filter()));
+        EXPECT_EQ(1, store.getAlbumSongs(Album("There", "Card")).size());
+    }
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, restoreBelowOfflineVolume) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    store.insert(MediaFile(MediaFileBuilder("/home/a.ogg").setType(AudioMedia).setETag("a")));
+    store.insert(MediaFile(MediaFileBuilder("/media/user/card/b.ogg").setType(AudioMedia).setETag("b")));
+    store.insert(MediaFile(MediaFileBuilder("/media/user/card2/c.ogg").setType(AudioMedia).setETag("c")));
+    store.insert(MediaFile(MediaFileBuilder("/media/user/stick/d.ogg").setType(AudioMedia).setETag("d")));
+    store.insert(MediaFile(MediaFileBuilder("/media/zzz/e.ogg").setType(AudioMedia).setETag("e")));
+    EXPECT_EQ(5, store.size());
+
+    // As the daemon does at startup, before adding the mounted volumes.
+    store.archiveItems("/media/");
+    EXPECT_EQ(1, store.size());
+    const uint64_t seen = store.changesSince(AllMedia, UINT64_MAX).sequence;
+    store.restoreItems("/media/user/card/");
+    EXPECT_EQ(2, store.size());
+    EXPECT_EQ("b", store.getETag("/media/user/card/b.ogg"));
+    EXPECT_EQ("", store.getETag("/media/user/card2/c.ogg"));
+    EXPECT_EQ("", store.getETag("/media/zzz/e.ogg"));
+    MediaChanges changes = store.changesSince(AllMedia, seen);
+    ASSERT_EQ(1, changes.changes.size());
+    EXPECT_EQ("/media/user/card/b.ogg", changes.changes[0].filename);
+    EXPECT_EQ(ChangeType::Added, changes.changes[0].change);
+
+    // Splitting again, and unmounting the volume, leave the rest alone.
+    store.restoreItems("/media/user/stick/");
+    EXPECT_EQ(3, store.size());
+    store.archiveItems("/media/user/card/");
+    EXPECT_EQ(2, store.size());
+    EXPECT_EQ("d", store.getETag("/media/user/stick/d.ogg"));
+    store.archiveItems("/media/user/");
+    store.restoreItems("/media/user/card/");
+    EXPECT_EQ(2, store.size());
+    EXPECT_EQ("", store.getETag("/media/zzz/e.ogg"));
+
+    store.restoreItems("/media/");
+    EXPECT_EQ(5, store.size());
+}
+
+TEST_F(MediaStoreTest, offlineVolumesSeenByReaders) {
+    string tmpdir = TEST_DIR "/offline-readers-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    MediaStoreOptions pooled;
+    pooled.setReadConnections(2);
+    MediaStore store(dbfile, MS_READ_WRITE, pooled);
+    store.insert(MediaFile(MediaFileBuilder("/home/a.ogg").setType(AudioMedia)));
+    store.insert(MediaFile(MediaFileBuilder("/media/card/b.ogg").setType(AudioMedia)));
+    MediaStore reader(dbfile, MS_READ_ONLY);
+    MediaStore pooled_reader(dbfile, MS_READ_ONLY, pooled);
+    auto sizes = [&]() {
+        return vector<size_t>({store.size(), reader.size(), pooled_reader.size()});
+    };
+    EXPECT_EQ(vector<size_t>({2, 2, 2}), sizes());
+
+    // Each store notices the volume going away and coming back.
+    store.archiveItems("/media/card");
+    EXPECT_EQ(vector<size_t>({1, 1, 1}), sizes());
+    EXPECT_EQ("", reader.getETag("/media/card/b.ogg"));
+    store.restoreItems("/media/card");
+    EXPECT_EQ(vector<size_t>({2, 2, 2}), sizes());
+
+    // Also within a transaction, and after rolling it back.
+    {
+        MediaStoreTransaction txn = store.beginTransaction();
+        store.archiveItems("/media/card");
+        EXPECT_EQ(1, store.size());
+        EXPECT_EQ(2, reader.size());
+    }
+    EXPECT_EQ(vector<size_t>({2, 2, 2}), sizes());
+
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, resultCache) {
+    MediaStoreOptions options;
+    options.setResultCacheSize(1 << 20);
+    MediaStore store(":memory:", MS_READ_WRITE, options);
+    store.insert(MediaFileBuilder("/path/a.ogg").setType(AudioMedia)
+                 .setAuthor("Artist").setGenre("Rock"));
+
+    EXPECT_EQ(vector<string>({"Artist"}), store.listArtists(Filter()));
+    EXPECT_EQ(0, store.resultCacheHits());
+    EXPECT_EQ(1, store.resultCacheMisses());
+    EXPECT_GT(store.resultCacheMemory(), 0);
+    EXPECT_EQ(vector<string>({"Artist"}), store.listArtists(Filter()));
+    EXPECT_EQ(1, store.resultCacheHits());
+
+    // Other methods and filters are cached separately.
+    EXPECT_EQ(vector<string>({"Artist"}), store.listAlbumArtists(Filter()));
+    Filter rock;
+    rock.setGenre("Rock");
+    EXPECT_EQ(vector<string>({"Artist"}), store.listArtists(rock));
+    EXPECT_EQ(1, store.resultCacheHits());
+    EXPECT_EQ(3, store.resultCacheMisses());
+
+    // Writes invalidate the results.
+    store.insert(MediaFileBuilder("/path/b.ogg").setType(AudioMedia)
+                 .setAuthor("Other").setGenre("Rock"));
+    EXPECT_EQ(vector<string>({"Artist", "Other"}), store.listArtists(rock));
+    store.removeSubtree("/path");
+    EXPECT_EQ(0, store.listArtists(Filter()).size());
+    EXPECT_EQ(1, store.resultCacheHits());
+
+    {
+        MediaStoreTransaction txn = store.beginTransaction();
+        store.insert(MediaFileBuilder("/path/c.ogg").setType(AudioMedia).setTitle("song"));
+        EXPECT_EQ(1, store.query("song", AudioMedia, Filter()).size());
+    }
+    // Rolled back.
+    EXPECT_EQ(0, store.query("song", AudioMedia, Filter()).size());
+}
+
+TEST_F(MediaStoreTest, resultCacheSeesOtherWriters) {
+    string tmpdir = TEST_DIR "/cache-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStore writer(dbfile, MS_READ_WRITE);
+        writer.insert(MediaFileBuilder("/path/a.ogg").setType(AudioMedia).setGenre("Rock"));
+
+        MediaStoreOptions options;
+        options.setResultCacheSize(1 << 20);
+        MediaStore reader(dbfile, MS_READ_ONLY, options);
+        EXPECT_EQ(vector<string>({"Rock"}), reader.listGenres(Filter()));
+        EXPECT_EQ(vector<string>({"Rock"}), reader.listGenres(Filter()));
+        EXPECT_EQ(1, reader.resultCacheHits());
+
+        writer.insert(MediaFileBuilder("/path/b.ogg").setType(AudioMedia).setGenre("Jazz"));
+        EXPECT_EQ(vector<string>({"Jazz", "Rock"}), reader.listGenres(Filter()));
+        EXPECT_EQ(1, reader.resultCacheHits());
+    }
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, resultCacheBounded) {
+    MediaStoreOptions options;
+    options.setResultCacheSize(2048);
+    MediaStore store(":memory:", MS_READ_WRITE, options);
+    for (int i = 0; i < 10; i++) {
+        store.insert(MediaFileBuilder("/path/" + std::to_string(i) + ".ogg")
+                     .setType(AudioMedia).setTitle("song"));
+    }
+    for (int i = 0; i < 10; i++) {
+        Filter filter;
+        filter.setLimit(1);
+        filter.setOffset(i);
+        EXPECT_EQ(1, store.listSongs(filter).size());
+        EXPECT_LE(store.resultCacheMemory(), 2048);
+    }
+}
+
+TEST_F(MediaStoreTest, storageOptions) {
+    MediaStoreOptions options;
+    EXPECT_THROW(options.setMmapSize(-1), std::invalid_argument);
+    EXPECT_THROW(options.setCacheSize(-1), std::invalid_argument);
+    EXPECT_THROW(options.setPageSize(1000), std::invalid_argument);
+    EXPECT_THROW(options.setPageSize(256), std::invalid_argument);
+    EXPECT_EQ(SyncLevel::Full, options.getBulkLoadSynchronous());
+    options.setSynchronous(SyncLevel::Normal);
+    EXPECT_EQ(SyncLevel::Normal, options.getBulkLoadSynchronous());
+    options.setBulkLoadSynchronous(SyncLevel::Off);
+    options.setPageSize(8192);
+    options.setMmapSize(1 << 20);
+    options.setCacheSize(1024);
+    options.setTempStore(TempStore::Memory);
+    options.setWriteAheadLog(true);
+    options.setReadConnections(2);
+
+    string tmpdir = TEST_DIR "/options-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    {
+        MediaStore store(dbfile, MS_READ_WRITE, options);
+        store.beginBulkLoad();
+        {
+            MediaStoreTransaction txn = store.beginTransaction();
+            store.insert(MediaFileBuilder("/path/a.ogg").setType(AudioMedia));
+            // SQLite refuses to change durability within a transaction.
+            EXPECT_THROW(store.endBulkLoad(), std::runtime_error);
+            txn.commit();
+        }
+        store.endBulkLoad();
+
+        MediaStore reader(dbfile, MS_READ_ONLY, options);
+        EXPECT_EQ(1, reader.size());
+    }
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    sqlite3_stmt *stmt;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "PRAGMA page_size", -1, &stmt, nullptr));
+    ASSERT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+    EXPECT_EQ(8192, sqlite3_column_int(stmt, 0));
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, forEachSong) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    for (int i = 0; i < 5; i++) {
+        store.insert(MediaFileBuilder("/path/song" + std::to_string(i) + ".ogg")
+                     .setType(AudioMedia).setTitle("song").setAuthor("Artist")
+                     .setAlbum("Album").setTrackNumber(i + 1).setDuration(60));
+    }
+    store.insert(MediaFileBuilder("/path/video.ogv").setType(VideoMedia).setTitle("song"));
+
+    vector<string> names;
+    store.forEachSong(Filter(), [&names](const MediaFileView &m) {
+        EXPECT_EQ(AudioMedia, m.getType());
+        EXPECT_STREQ("Artist", m.getAuthor());
+        EXPECT_EQ(60, m.getDuration());
+        names.push_back(m.getFileName());
+        return true;
+    });
+    ASSERT_EQ(5, names.size());
+    EXPECT_EQ("/path/song0.ogg", names[0]);
+    EXPECT_EQ("/path/song4.ogg", names[4]);
+
+    // Views turn into the same files listSongs returns.
+    vector<MediaFile> files;
+    store.forEachSong(Filter(), [&files](const MediaFileView &m) {
+        files.push_back(m.toMediaFile());
+        return files.size() < 2;
+    });
+    ASSERT_EQ(2, files.size());
+    vector<MediaFile> listed = store.listSongs(Filter());
+    EXPECT_EQ(listed[0], files[0]);
+    EXPECT_EQ(listed[1], files[1]);
+
+    int videos = 0;
+    store.forEachMedia("song", VideoMedia, Filter(), [&videos](const MediaFileView &m) {
+        EXPECT_STREQ("/path/video.ogv", m.getFileName());
+        videos++;
+        return true;
+    });
+    EXPECT_EQ(1, videos);
+
+    // Stopping early leaves the store usable.
+    int seen = 0;
+    store.forEachMedia("song", AudioMedia, Filter(), [&seen](const MediaFileView &) {
+        seen++;
+        return false;
+    });
+    EXPECT_EQ(1, seen);
+    store.insert(MediaFileBuilder("/path/more.ogg").setType(AudioMedia));
+    EXPECT_EQ(7, store.size());
+}
+
+TEST_F(MediaStoreTest, sharedStrings) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    for (int i = 0; i < 4; i++) {
+        store.insert(MediaFileBuilder("/path/song" + std::to_string(i) + ".ogg")
+                     .setType(AudioMedia).setContentType("audio/ogg")
+                     .setTitle("song" + std::to_string(i))
+                     .setAuthor(i < 2 ? "Artist One" : "Artist Two")
+                     .setAlbum("Album").setGenre("Rock"));
+    }
+
+    vector<MediaFile> songs = store.listSongs(Filter());
+    ASSERT_EQ(4, songs.size());
+    // Repeating values are one string within a result.
+    EXPECT_EQ(&songs[0].getAuthor(), &songs[1].getAuthor());
+    EXPECT_NE(&songs[1].getAuthor(), &songs[2].getAuthor());
+    EXPECT_EQ(&songs[0].getAlbum(), &songs[3].getAlbum());
+    EXPECT_EQ(&songs[0].getGenre(), &songs[3].getGenre());
+    EXPECT_EQ(&songs[0].getContentType(), &songs[3].getContentType());
+    EXPECT_EQ(&songs[0].getAuthor(), &songs[0].getAlbumArtist());
+    EXPECT_EQ("Artist Two", songs[2].getAuthor());
+    EXPECT_EQ("Artist Two", songs[2].getAlbumArtist());
+
+    // Sharing makes no difference to the values.
+    MediaFile copy = MediaFileBuilder(songs[2]).setGenre("Pop");
+    EXPECT_EQ("Pop", copy.getGenre());
+    EXPECT_EQ("Rock", songs[3].getGenre());
+    EXPECT_EQ(songs[0], store.lookup("/path/song0.ogg"));
+    EXPECT_EQ(songs[2], MediaFile(MediaFileBuilder("/path/song2.ogg")
+                                  .setType(AudioMedia).setContentType("audio/ogg")
+                                  .setTitle("song2").setAuthor("Artist Two")
+                                  .setAlbum("Album").setGenre("Rock")));
+
+    vector<MediaFile> found = store.query("song", AudioMedia, Filter());
+    ASSERT_EQ(4, found.size());
+    EXPECT_EQ(&found[0].getAlbum(), &found[1].getAlbum());
+}
+
+TEST_F(MediaStoreTest, fieldMask) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    for (int i = 0; i < 3; i++) {
+        store.insert(MediaFileBuilder("/path/song" + std::to_string(i) + ".ogg")
+                     .setType(AudioMedia).setContentType("audio/ogg")
+                     .setETag("etag").setTitle("song" + std::to_string(i))
+                     .setAuthor("Artist").setAlbum("Album").setGenre("Rock")
+                     .setDate("2016").setTrackNumber(i + 1).setDuration(60)
+                     .setModificationTime(i));
+    }
+
+    Filter filter;
+    EXPECT_EQ(AllFields, filter.getFields());
+    filter.setFields(AuthorField | DurationField);
+    EXPECT_NE(Filter(), filter);
+
+    vector<MediaFile> songs = store.query("song", AudioMedia, filter);
+    ASSERT_EQ(3, songs.size());
+    EXPECT_EQ("Artist", songs[0].getAuthor());
+    EXPECT_EQ(60, songs[0].getDuration());
+    EXPECT_EQ(AudioMedia, songs[0].getType());
+    EXPECT_EQ("", songs[0].getGenre());
+    EXPECT_EQ("", songs[0].getContentType());
+    EXPECT_EQ("", songs[0].getETag());
+    EXPECT_EQ(0, songs[0].getTrackNumber());
+
+    // The fields results are ordered by are always there for cursors.
+    filter.setOrder(MediaOrder::Modified);
+    filter.setLimit(2);
+    songs = store.query("song", AudioMedia, filter);
+    ASSERT_EQ(2, songs.size());
+    EXPECT_EQ(1, songs[1].getModificationTime());
+    EXPECT_EQ("", songs[1].getDate());
+    filter.setCursorAfter(songs[1]);
+    songs = store.query("song", AudioMedia, filter);
+    ASSERT_EQ(1, songs.size());
+    EXPECT_EQ("/path/song2.ogg", songs[0].getFileName());
+
+    Filter list_filter;
+    list_filter.setFields(GenreField);
+    list_filter.setLimit(2);
+    songs = store.listSongs(list_filter);
+    ASSERT_EQ(2, songs.size());
+    EXPECT_EQ("Rock", songs[0].getGenre());
+    EXPECT_EQ("Album", songs[0].getAlbum());
+    EXPECT_EQ(2, songs[1].getTrackNumber());
+    EXPECT_EQ(0, songs[1].getDuration());
+    list_filter.setCursorAfter(songs[1]);
+    songs = store.listSongs(list_filter);
+    ASSERT_EQ(1, songs.size());
+    EXPECT_EQ(3, songs[0].getTrackNumber());
+
+    // Full results are unaffected.
+    songs = store.listSongs(Filter());
+    ASSERT_EQ(3, songs.size());
+    EXPECT_EQ("etag", songs[0].getETag());
+    EXPECT_EQ(60, songs[0].getDuration());
+}
+
+TEST_F(MediaStoreTest, countAndFacets) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    struct {
+        const char *author, *album_artist, *genre;
+    } songs[] = {
+        {"Artist1", "Artist1", "Rock"},
+        {"Artist1", "Various", "Rock"},
+        {"Artist2", "Various", "Pop"},
+        {"Artist2", "Artist2", "Rock"},
+    };
+    int i = 0;
+    for (const auto &song : songs) {
+        store.insert(MediaFileBuilder("/path/song" + std::to_string(i++) + ".ogg")
+                     .setType(AudioMedia).setTitle("song").setAuthor(song.author)
+                     .setAlbumArtist(song.album_artist).setGenre(song.genre));
+    }
+    store.insert(MediaFileBuilder("/path/video.ogv").setType(VideoMedia));
+
+    Filter filter;
+    EXPECT_EQ(4, store.count(AudioMedia, filter));
+    EXPECT_EQ(1, store.count(VideoMedia, filter));
+    EXPECT_EQ(0, store.count(ImageMedia, filter));
+    EXPECT_EQ(5, store.count(AllMedia, filter));
+    // Paging makes no difference.
+    filter.setLimit(1);
+    filter.setOffset(2);
+    EXPECT_EQ(4, store.count(AudioMedia, filter));
+
+    Facets facets = store.facets(Filter());
+    EXPECT_EQ((FacetCounts{{"Pop", 1}, {"Rock", 3}}), facets.genres);
+    EXPECT_EQ((FacetCounts{{"Artist1", 2}, {"Artist2", 2}}), facets.artists);
+    EXPECT_EQ((FacetCounts{{"Artist1", 1}, {"Artist2", 1}, {"Various", 2}}), facets.album_artists);
+
+    filter.clear();
+    filter.setGenre("Rock");
+    EXPECT_EQ(3, store.count(AudioMedia, filter));
+    facets = store.facets(filter);
+    EXPECT_EQ((FacetCounts{{"Rock", 3}}), facets.genres);
+    EXPECT_EQ((FacetCounts{{"Artist1", 2}, {"Artist2", 1}}), facets.artists);
+
+    filter.setAlbumArtist("Various");
+    EXPECT_EQ(1, store.count(AudioMedia, filter));
+    filter.setArtist("Artist2");
+    EXPECT_EQ(0, store.count(AudioMedia, filter));
+    EXPECT_EQ(Facets(), store.facets(filter));
+
+    // Offline volumes are not counted.
+    store.archiveItems("/path/song1");
+    EXPECT_EQ(3, store.count(AudioMedia, Filter()));
+    EXPECT_EQ((FacetCounts{{"Artist1", 1}, {"Artist2", 2}}), store.facets(Filter()).artists);
+}
+
+TEST_F(MediaStoreTest, asyncQueries) {
+    string tmpdir = TEST_DIR "/async-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    MediaStoreOptions options;
+    options.setWriteAheadLog(true);
+    std::unique_ptr<MediaStore> owner(new MediaStore(tmpdir + "/mediastore.db", MS_READ_WRITE, options));
+    MediaStore &store = *owner;
+    std::vector<MediaFile> files;
+    for (int i = 0; i < 20000; i++) {
+        files.emplace_back(MediaFileBuilder("/path/song" + std::to_string(i) + ".ogg")
+                           .setType(AudioMedia).setTitle("title " + std::to_string(i))
+                           .setAuthor("artist " + std::to_string(i % 100))
+                           .setAlbum("album " + std::to_string(i % 1000)));
+    }
+    {
+        MediaStoreTransaction txn = store.beginTransaction();
+        store.insertBatch(std::move(files));
+        txn.commit();
+    }
+
+    Filter filter;
+    filter.setLimit(10);
+    auto songs = store.listSongsAsync(filter);
+    EXPECT_EQ(10, songs.get().size());
+    auto found = store.queryAsync("title", AudioMedia, filter);
+    EXPECT_EQ(10, found.get().size());
+
+    // A cancelled query never returns a result.
+    auto cancelled = store.listSongsAsync(filter);
+    cancelled.cancel();
+    EXPECT_THROW(cancelled.get(), QueryCancelled);
+
+    // A slow query, ranking every song, stops soon after being
+    // cancelled.
+    filter.setLimit(-1);
+    auto start = std::chrono::steady_clock::now();
+    EXPECT_EQ(20000, store.query("t", AudioMedia, filter).size());
+    const auto full_time = std::chrono::steady_clock::now() - start;
+    for (int i = 0; i < 3; i++) {
+        start = std::chrono::steady_clock::now();
+        auto slow = store.queryAsync("t", AudioMedia, filter);
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        slow.cancel();
+        EXPECT_THROW(slow.get(), QueryCancelled);
+        EXPECT_LT(std::chrono::steady_clock::now() - start, full_time / 2);
+    }
+
+    // The interrupted connections are still good.
+    EXPECT_EQ(20000, store.query("title", AudioMedia, filter).size());
+    filter.setLimit(5);
+    EXPECT_EQ(5, store.listSongsAsync(filter).get().size());
+
+    // A result may outlive the store, which stops the query first.
+    filter.setLimit(-1);
+    auto orphan = store.queryAsync("t", AudioMedia, filter);
+    owner.reset();
+    EXPECT_TRUE(orphan.waitFor(std::chrono::seconds(5)));
+    EXPECT_THROW(orphan.get(), QueryCancelled);
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, changeJournal) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    MediaChanges start = store.changesSince(AllMedia, UINT64_MAX);
+    EXPECT_FALSE(start.complete);
+    EXPECT_TRUE(start.changes.empty());
+    EXPECT_EQ(0, start.sequence);
+
+    store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia).setTitle("a")));
+    store.insert(MediaFile(MediaFileBuilder("/path/b.mp4").setType(VideoMedia)));
+    store.insert(MediaFile(MediaFileBuilder("/other/c.ogg").setType(AudioMedia)));
+    MediaChanges changes = store.changesSince(AllMedia, start.sequence);
+    EXPECT_TRUE(changes.complete);
+    ASSERT_EQ(3, changes.changes.size());
+    EXPECT_EQ("/path/a.ogg", changes.changes[0].filename);
+    EXPECT_EQ(ChangeType::Added, changes.changes[0].change);
+    EXPECT_EQ(AudioMedia, changes.changes[0].type);
+    EXPECT_EQ(changes.changes[2].sequence, changes.sequence);
+
+    // Replacing a file modifies it, and only its latest change is kept.
+    const uint64_t seen = changes.sequence;
+    store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia).setTitle("new a")));
+    store.remove("/path/b.mp4");
+    changes = store.changesSince(AllMedia, seen);
+    ASSERT_EQ(2, changes.changes.size());
+    EXPECT_EQ("/path/a.ogg", changes.changes[0].filename);
+    EXPECT_EQ(ChangeType::Modified, changes.changes[0].change);
+    EXPECT_EQ("/path/b.mp4", changes.changes[1].filename);
+    EXPECT_EQ(ChangeType::Removed, changes.changes[1].change);
+    EXPECT_EQ(VideoMedia, changes.changes[1].type);
+    EXPECT_EQ(3, store.changesSince(AllMedia, 0).changes.size());
+    EXPECT_EQ(2, store.changesSince(AudioMedia, 0).changes.size());
+    EXPECT_TRUE(store.changesSince(AllMedia, changes.sequence).changes.empty());
+
+    // Unmounted and remounted volumes count as removed and added.
+    store.archiveItems("/other");
+    changes = store.changesSince(AllMedia, changes.sequence);
+    ASSERT_EQ(1, changes.changes.size());
+    EXPECT_EQ("/other/c.ogg", changes.changes[0].filename);
+    EXPECT_EQ(ChangeType::Removed, changes.changes[0].change);
+    store.restoreItems("/other");
+    changes = store.changesSince(AllMedia, changes.sequence);
+    ASSERT_EQ(1, changes.changes.size());
+    EXPECT_EQ(ChangeType::Added, changes.changes[0].change);
+    // Restoring a mounted volume changes nothing.
+    store.restoreItems("/other");
+    EXPECT_TRUE(store.changesSince(AllMedia, changes.sequence).changes.empty());
+}
+
+TEST_F(MediaStoreTest, changeJournalPruning) {
+    string tmpdir = TEST_DIR "/changes-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    uint64_t removed;
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia)));
+        store.remove("/path/a.ogg");
+        removed = store.changesSince(AllMedia, 0).sequence;
+    }
+    // Pretend a lot has happened since.
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "UPDATE sqlite_sequence SET seq = seq + 1000000 WHERE name = 'media_changes'", nullptr, nullptr, nullptr));
+    sqlite3_close(db);
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        EXPECT_TRUE(store.changesSince(AllMedia, removed - 1).complete);
+        store.pruneDeleted();
+        MediaChanges changes = store.changesSince(AllMedia, removed - 1);
+        EXPECT_FALSE(changes.complete);
+        EXPECT_TRUE(changes.changes.empty());
+        EXPECT_TRUE(store.changesSince(AllMedia, removed).complete);
+    }
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, upgradeKeepsChangeJournal) {
+    string tmpdir = TEST_DIR "/upgrade-changes-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    uint64_t seen;
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.insert(MediaFile(MediaFileBuilder("/path/a.ogg").setType(AudioMedia).setDate("2016-01-02")));
+        store.insert(MediaFile(MediaFileBuilder("/path/b.ogg").setType(AudioMedia)));
+        seen = store.changesSince(AllMedia, 0).sequence;
+    }
+    // Turn the database into a schema version 16 one, setting the full
+    // text index triggers aside as in downgrade_to_v12().
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    vector<string> triggers;
+    sqlite3_stmt *stmt;
+    ASSERT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, "SELECT name, sql FROM sqlite_master WHERE type = 'trigger' AND tbl_name = 'media' AND name NOT LIKE 'media_changes_%' AND name NOT LIKE 'media_location_%'", -1, &stmt, nullptr));
+    while (sqlite3_step(stmt) == SQLITE_ROW) {
+        const string name = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, ("DROP TRIGGER " + name).c_str(), nullptr, nullptr, nullptr));
+        triggers.push_back(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
+    }
+    sqlite3_finalize(stmt);
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, R"(
+DROP INDEX media_date_idx;
+DROP INDEX media_fingerprint_idx;
+ALTER TABLE media DROP COLUMN date_epoch;
+ALTER TABLE media DROP COLUMN fingerprint;
+UPDATE schemaVersion SET version = 16;
+)", nullptr, nullptr, nullptr));
+    for (const auto &sql : triggers) {
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
+    }
+    sqlite3_close(db);
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        // Filling in the new columns is not a change to the files.
+        EXPECT_EQ(1, store.listDateRange(AudioMedia, INT64_MIN, INT64_MAX, Filter()).size());
+        MediaChanges changes = store.changesSince(AllMedia, seen);
+        EXPECT_TRUE(changes.complete);
+        EXPECT_TRUE(changes.changes.empty());
+        // The journal keeps going afterwards.
+        store.remove("/path/b.ogg");
+        changes = store.changesSince(AllMedia, seen);
+        ASSERT_EQ(1, changes.changes.size());
+        EXPECT_EQ(ChangeType::Removed, changes.changes[0].change);
+    }
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, queryRegion) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    auto photo = [](const string &name, double latitude, double longitude) {
+        return MediaFile(MediaFileBuilder("/photos/" + name + ".jpg").setType(ImageMedia)
+                         .setTitle(name).setLatitude(latitude).setLongitude(longitude));
+    };
+    store.insert(photo("helsinki", 60.1699, 24.9384));
+    store.insert(photo("tallinn", 59.4370, 24.7536));
+    store.insert(photo("london", 51.5074, -0.1278));
+    store.insert(photo("fiji", -17.7134, 178.0650));
+    store.insert(photo("samoa", -13.7590, -172.1046));
+    store.insert(photo("nowhere", 0, 0));
+    store.insert(MediaFile(MediaFileBuilder("/videos/helsinki.mp4").setType(VideoMedia)
+                           .setLatitude(60.17).setLongitude(24.94)));
+
+    auto titles = [](const vector<MediaFile> &files) {
+        vector<string> result;
+        for (const auto &f : files) {
+            result.push_back(f.getTitle());
+        }
+        return result;
+    };
+    Filter filter;
+    filter.setOrder(MediaOrder::Title);
+    EXPECT_EQ(vector<string>({"helsinki", "tallinn"}),
+              titles(store.queryRegion(BoundingBox(59, 20, 61, 30), ImageMedia, filter)));
+    EXPECT_EQ(1, store.queryRegion(BoundingBox(59, 20, 61, 30), VideoMedia, filter).size());
+    // Edges are included, exactly.
+    EXPECT_EQ(vector<string>({"tallinn"}),
+              titles(store.queryRegion(BoundingBox(59.4370, 24.7536, 59.4370, 24.7536), ImageMedia, filter)));
+    EXPECT_EQ(0, store.queryRegion(BoundingBox(59.43701, 24.7536, 60, 24.7536), ImageMedia, filter).size());
+    // Crossing the 180th meridian.
+    EXPECT_EQ(vector<string>({"fiji", "samoa"}),
+              titles(store.queryRegion(BoundingBox(-20, 170, -10, -170), ImageMedia, filter)));
+    // Files without a location are left out.
+    EXPECT_EQ(5, store.queryRegion(BoundingBox(-90, -180, 90, 180), ImageMedia, filter).size());
+    EXPECT_THROW(store.queryRegion(BoundingBox(10, 0, -10, 0), ImageMedia, filter), runtime_error);
+
+    // Paged like other queries.
+    filter.setLimit(2);
+    EXPECT_EQ(vector<string>({"fiji", "helsinki"}),
+              titles(store.queryRegion(BoundingBox(-90, -180, 90, 180), ImageMedia, filter)));
+    filter.setOffset(2);
+    EXPECT_EQ(vector<string>({"london", "samoa"}),
+              titles(store.queryRegion(BoundingBox(-90, -180, 90, 180), ImageMedia, filter)));
+
+    // Kept up to date as files are replaced and removed.
+    store.insert(photo("helsinki", 0, 0));
+    store.remove("/photos/tallinn.jpg");
+    filter = Filter();
+    EXPECT_EQ(0, store.queryRegion(BoundingBox(59, 20, 61, 30), ImageMedia, filter).size());
+    store.insert(photo("tallinn", 59.4370, 24.7536));
+    EXPECT_EQ(1, store.queryRegion(BoundingBox(59, 20, 61, 30), ImageMedia, filter).size());
+}
+
+TEST_F(MediaStoreTest, queryRegionWithoutIndex) {
+    string tmpdir = TEST_DIR "/region-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    const string dbfile = tmpdir + "/mediastore.db";
+    auto photo = [](const string &name, double latitude, double longitude) {
+        return MediaFile(MediaFileBuilder("/photos/" + name + ".jpg").setType(ImageMedia)
+                         .setTitle(name).setLatitude(latitude).setLongitude(longitude));
+    };
+    {
+        MediaStore store(dbfile, MS_READ_WRITE);
+        store.insert(photo("helsinki", 60.1699, 24.9384));
+        store.insert(photo("fiji", -17.7134, 178.0650));
+        store.insert(photo("samoa", -13.7590, -172.1046));
+        store.insert(photo("nowhere", 0, 0));
+    }
+    // As created by an SQLite without the R*Tree module.
+    sqlite3 *db;
+    ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+    ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, R"(
+DROP TRIGGER media_location_ai;
+DROP TRIGGER media_location_au;
+DROP TRIGGER media_location_ad;
+DROP TABLE media_location;
+)", nullptr, nullptr, nullptr));
+    sqlite3_close(db);
+
+    MediaStore store(dbfile, MS_READ_WRITE);
+    store.insert(photo("tallinn", 59.4370, 24.7536));
+    Filter filter;
+    filter.setOrder(MediaOrder::Title);
+    auto found = store.queryRegion(BoundingBox(59, 20, 61, 30), ImageMedia, filter);
+    ASSERT_EQ(2, found.size());
+    EXPECT_EQ("helsinki", found[0].getTitle());
+    EXPECT_EQ("tallinn", found[1].getTitle());
+    found = store.queryRegion(BoundingBox(-20, 170, -10, -170), ImageMedia, filter);
+    ASSERT_EQ(2, found.size());
+    EXPECT_EQ("fiji", found[0].getTitle());
+    EXPECT_EQ("samoa", found[1].getTitle());
+    EXPECT_EQ(4, store.queryRegion(BoundingBox(-90, -180, 90, 180), ImageMedia, filter).size());
+
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, dateToEpoch) {
+    EXPECT_EQ(0, dateToEpoch("1970-01-01"));
+    EXPECT_EQ(1451606400, dateToEpoch("2016"));
+    EXPECT_EQ(1454284800, dateToEpoch("2016-02"));
+    EXPECT_EQ(1456704000, dateToEpoch("2016-02-29"));
+    EXPECT_EQ(1456747445, dateToEpoch("2016-02-29T12:04:05"));
+    EXPECT_EQ(1456747445, dateToEpoch("2016-02-29 12:04:05.25"));
+    EXPECT_EQ(1456747440, dateToEpoch("2016-02-29T12:04Z"));
+    EXPECT_EQ(1456747445 - 7200, dateToEpoch("2016-02-29T12:04:05+0200"));
+    EXPECT_EQ(1456747445 + 19800, dateToEpoch("2016-02-29T12:04:05-05:30"));
+    EXPECT_EQ(-86400, dateToEpoch("1969-12-31"));
+    EXPECT_EQ(NO_DATE, dateToEpoch(""));
+    EXPECT_EQ(NO_DATE, dateToEpoch("16-02-29"));
+    EXPECT_EQ(NO_DATE, dateToEpoch("2016-13-01"));
+    EXPECT_EQ(NO_DATE, dateToEpoch("2016-02-29T25:00"));
+    EXPECT_EQ(NO_DATE, dateToEpoch("2016-02-29 and then some"));
+}
+
+TEST_F(MediaStoreTest, timeline) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    auto photo = [](const string &name, const string &date) {
+        return MediaFile(MediaFileBuilder("/photos/" + name + ".jpg").setType(ImageMedia)
+                         .setTitle(name).setDate(date));
+    };
+    store.insert(photo("a", "2015-12-31T23:30:00"));
+    store.insert(photo("b", "2016-01-01T00:30:00+02:00"));
+    store.insert(photo("c", "2016-01-01"));
+    store.insert(photo("d", "2016-01-15T10:00:00"));
+    store.insert(photo("e", "2016-03-02T08:00:00Z"));
+    store.insert(photo("undated", ""));
+    store.insert(MediaFile(MediaFileBuilder("/videos/v.mp4").setType(VideoMedia).setDate("2016-01-02")));
+
+    auto titles = [](const vector<MediaFile> &files) {
+        vector<string> result;
+        for (const auto &f : files) {
+            result.push_back(f.getTitle());
+        }
+        return result;
+    };
+    const int64_t y2016 = dateToEpoch("2016");
+    const int64_t y2017 = dateToEpoch("2017");
+    Filter filter;
+    // b is 2015-12-31 in UTC.
+    EXPECT_EQ(vector<string>({"c", "d", "e"}),
+              titles(store.listDateRange(ImageMedia, y2016, y2017, filter)));
+    EXPECT_EQ(vector<string>({"b", "a", "c", "d", "e"}),
+              titles(store.listDateRange(ImageMedia, INT64_MIN, INT64_MAX, filter)));
+    filter.setReverse(true);
+    filter.setLimit(2);
+    vector<MediaFile> page = store.listDateRange(ImageMedia, y2016, y2017, filter);
+    EXPECT_EQ(vector<string>({"e", "d"}), titles(page));
+    filter.setCursorAfter(page.back());
+    EXPECT_EQ(vector<string>({"c"}), titles(store.listDateRange(ImageMedia, y2016, y2017, filter)));
+
+    EXPECT_EQ((vector<DateCount>{{dateToEpoch("2015-12"), 2}, {dateToEpoch("2016-01"), 2}, {dateToEpoch("2016-03"), 1}}),
+              store.countByDate(ImageMedia, DateBucket::Month, INT64_MIN, INT64_MAX));
+    EXPECT_EQ((vector<DateCount>{{dateToEpoch("2016-01-01"), 1}, {dateToEpoch("2016-01-15"), 1}, {dateToEpoch("2016-03-02"), 1}}),
+              store.countByDate(ImageMedia, DateBucket::Day, y2016, y2017));
+    EXPECT_EQ((vector<DateCount>{{y2016, 1}}), store.countByDate(VideoMedia, DateBucket::Year, INT64_MIN, INT64_MAX));
+
+    // Ordering by date goes by the time, whatever the format, where
+    // the text of the dates would put a before b.
+    filter = Filter();
+    filter.setOrder(MediaOrder::Date);
+    EXPECT_EQ(vector<string>({"undated", "b", "a", "c", "d", "e"}),
+              titles(store.query("", ImageMedia, filter)));
+    filter.setLimit(3);
+    page = store.query("", ImageMedia, filter);
+    filter.setCursorAfter(page.back());
+    EXPECT_EQ(vector<string>({"c", "d", "e"}), titles(store.query("", ImageMedia, filter)));
+}
+
+TEST_F(MediaStoreTest, fileFingerprint) {
+    string tmpdir = TEST_DIR "/fingerprint-test.XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+    auto write = [&tmpdir](const string &name, const string &content) {
+        const string path = tmpdir + "/" + name;
+        FILE *f = fopen(path.c_str(), "wb");
+        fwrite(content.data(), 1, content.size(), f);
+        fclose(f);
+        return path;
+    };
+    const string big(100000, 'x');
+    string middle = big;
+    middle[50000] = 'y';
+    string end = big;
+    end[99999] = 'y';
+
+    const string fp = fileFingerprint(write("original", big));
+    EXPECT_FALSE(fp.empty());
+    EXPECT_EQ(fp, fileFingerprint(write("copy", big)));
+    // Only the ends and the size are read.
+    EXPECT_EQ(fp, fileFingerprint(write("middle", middle)));
+    EXPECT_NE(fp, fileFingerprint(write("end", end)));
+    EXPECT_NE(fp, fileFingerprint(write("longer", big + "x")));
+    EXPECT_NE(fileFingerprint(write("short", "abc")), fileFingerprint(write("shorter", "ab")));
+    // Around the size of the blocks read from either end.
+    EXPECT_NE(fileFingerprint(write("block", string(16 * 1024, 'x'))),
+              fileFingerprint(write("block+1", string(16 * 1024 + 1, 'x'))));
+    EXPECT_EQ("", fileFingerprint(write("empty", "")));
+    EXPECT_THROW(fileFingerprint(tmpdir + "/missing"), runtime_error);
+
+    string cmd = "rm -rf " + tmpdir;
+    ASSERT_EQ(0, system(cmd.c_str()));
+}
+
+TEST_F(MediaStoreTest, duplicates) {
+    MediaStore store(":memory:", MS_READ_WRITE);
+    auto song = [](const string &filename, const string &fingerprint) {
+        return MediaFile(MediaFileBuilder(filename).setType(AudioMedia)
+                         .setTitle("Song").setFingerprint(fingerprint));
+    };
+    store.insert(song("/home/user/Music/a.ogg", "aaaa"));
+    store.insert(song("/home/user/Downloads/a.ogg", "aaaa"));
+    store.insert(song("/media/user/card/a.ogg", "aaaa"));
+    store.insert(song("/home/user/Music/b.ogg", "bbbb"));
+    store.insert(song("/media/user/card/b.ogg", "bbbb"));
+    store.insert(song("/home/user/Music/c.ogg", "cccc"));
+    store.insert(song("/home/user/Music/unknown.ogg", ""));
+    store.insert(song("/home/user/Music/unknown2.ogg", ""));
+
+    EXPECT_EQ("aaaa", store.lookup("/home/user/Music/a.ogg").getFingerprint());
+    EXPECT_EQ("", store.lookup("/home/user/Music/unknown.ogg").getFingerprint());
+
+    auto names = [](const vector<vector<MediaFile>> &groups) {
+        vector<vector<string>> result;
+        for (const auto &group : groups) {
+            result.emplace_back();
+            for (const auto &f : group) {
+                result.back().push_back(f.getFileName());
+            }
+        }
+        return result;
+    };
+    Filter filter;
+    EXPECT_EQ((vector<vector<string>>{
+                {"/home/user/Downloads/a.ogg", "/home/user/Music/a.ogg", "/media/user/card/a.ogg"},
+                {"/home/user/Music/b.ogg", "/media/user/card/b.ogg"}}),
+              names(store.listDuplicates(AudioMedia, filter)));
+    EXPECT_TRUE(store.listDuplicates(VideoMedia, filter).empty());
+    filter.setOffset(1);
+    filter.setLimit(1);
+    EXPECT_EQ((vector<vector<string>>{{"/home/user/Music/b.ogg", "/media/user/card/b.ogg"}}),
+              names(store.listDuplicates(AudioMedia, filter)));
+
+    // Files on a volume that is not mounted are no duplicates, but
+    // their metadata still serves copies of them.
+    store.archiveItems("/media/user/card");
+    EXPECT_EQ((vector<vector<string>>{{"/home/user/Downloads/a.ogg", "/home/user/Music/a.ogg"}}),
+              names(store.listDuplicates(AudioMedia, Filter())));
+    vector<MediaFile> copies = store.lookupFingerprint("bbbb");
+    ASSERT_EQ(2, copies.size());
+    EXPECT_EQ("/home/user/Music/b.ogg", copies[0].getFileName());
+    EXPECT_EQ("/media/user/card/b.ogg", copies[1].getFileName());
+    EXPECT_TRUE(store.lookupFingerprint("").empty());
+    EXPECT_TRUE(store.lookupFingerprint("dddd").empty());
+
+    // Replacing a file drops its old fingerprint.
+    store.insert(song("/home/user/Downloads/a.ogg", "dddd"));
+    EXPECT_TRUE(store.listDuplicates(AudioMedia, Filter()).empty());
+}
+
+TEST_F(MediaStoreTest, maintenance) {
+    for (auto backend : {FullTextBackend::FTS4, FullTextBackend::FTS5}) {
+        string tmpdir = TEST_DIR "/maintenance-test.XXXXXX";
+        ASSERT_NE(nullptr, mkdtemp(&tmpdir[0]));
+        const string dbfile = tmpdir + "/mediastore.db";
+        auto pragma = [&dbfile](const string &name) -> int64_t {
+            sqlite3 *db;
+            sqlite3_stmt *stmt;
+            EXPECT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+            EXPECT_EQ(SQLITE_OK, sqlite3_prepare_v2(db, ("PRAGMA " + name).c_str(), -1, &stmt, nullptr));
+            EXPECT_EQ(SQLITE_ROW, sqlite3_step(stmt));
+            const int64_t value = sqlite3_column_int64(stmt, 0);
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+            return value;
+        };
+        auto file_size = [&dbfile]() -> off_t {
+            struct stat st;
+            EXPECT_EQ(0, stat(dbfile.c_str(), &st));
+            return st.st_size;
+        };
+        MediaStoreOptions options;
+        options.setFullTextBackend(backend);
+        {
+            MediaStore store(dbfile, MS_READ_WRITE, options);
+            // Small batches leave the full text index in many segments.
+            for (int i = 0; i < 50; i++) {
+                vector<MediaFile> batch;
+                for (int j = 0; j < 20; j++) {
+                    batch.push_back(MediaFileBuilder("/path/" + to_string(i) + "/" + to_string(j) + ".ogg")
+                                    .setType(AudioMedia)
+                                    .setTitle("Song " + string(100, 'a' + j)));
+                }
+                store.insertBatch(std::move(batch));
+            }
+            store.insert(MediaFileBuilder("/keep/zebra.ogg").setType(AudioMedia).setTitle("Zebra"));
+            store.removeSubtree("/path");
+        }
+        EXPECT_EQ(2, pragma("auto_vacuum")); // INCREMENTAL
+        EXPECT_GT(pragma("freelist_count"), 0);
+        const off_t before = file_size();
+        {
+            MediaStore store(dbfile, MS_READ_WRITE, options);
+            int slices = 0;
+            while (store.runMaintenance(5)) {
+                ASSERT_LT(++slices, 1000);
+            }
+            EXPECT_FALSE(store.runMaintenance(5));
+            EXPECT_EQ(1, store.size());
+            EXPECT_EQ(1, store.query("zebra", AudioMedia, Filter()).size());
+            EXPECT_TRUE(store.query("song", AudioMedia, Filter()).empty());
+        }
+        EXPECT_EQ(0, pragma("freelist_count"));
+        EXPECT_LT(file_size(), before);
+
+        // Databases made without incremental vacuum are only rebuilt
+        // on request, and when there is enough to reclaim.
+        sqlite3 *db;
+        ASSERT_EQ(SQLITE_OK, sqlite3_open(dbfile.c_str(), &db));
+        ASSERT_EQ(SQLITE_OK, sqlite3_exec(db, "PRAGMA auto_vacuum = NONE; VACUUM", nullptr, nullptr, nullptr));
+        sqlite3_close(db);
+        EXPECT_EQ(0, pragma("auto_vacuum"));
+        {
+            MediaStore store(dbfile, MS_READ_WRITE, options);
+            int slices = 0;
+            while (store.runMaintenance(5)) {
+                ASSERT_LT(++slices, 1000);
+            }
+            EXPECT_FALSE(store.enableIncrementalVacuum());
+            vector<MediaFile> batch;
+            for (int j = 0; j < 500; j++) {
+                batch.push_back(MediaFileBuilder("/path/" + to_string(j) + ".ogg")
+                                .setType(AudioMedia)
+                                .setTitle("Song " + string(200, 'a' + j % 26)));
+            }
+            store.insertBatch(std::move(batch));
+            store.removeSubtree("/path");
+            EXPECT_TRUE(store.enableIncrementalVacuum());
+            EXPECT_FALSE(store.enableIncrementalVacuum());
+            EXPECT_EQ(1, store.query("zebra", AudioMedia, Filter()).size());
+        }
+        EXPECT_EQ(2, pragma("auto_vacuum"));
+        EXPECT_EQ(0, pragma("freelist_count"));
+
+        string cmd = "rm -rf " + tmpdir;
+        ASSERT_EQ(0, system(cmd.c_str()));
+    }
+}
@@ -101,6 +101,45 @@ TEST_F(SqliteTest, Insert) {
     select.finalize();
 }
 
+TEST_F(SqliteTest, StatementCache) {
+    StatementCache cache;
+    {
+        Statement stmt(db, cache, "SELECT ?");
+        stmt.bind(1, 42);
+        EXPECT_EQ(true, stmt.step());
+        EXPECT_EQ(42, stmt.getInt(0));
+    }
+    EXPECT_EQ(0, cache.getHits());
+    EXPECT_EQ(1, cache.getMisses());
+    EXPECT_EQ(1, cache.size());
+
+    {
+        Statement stmt(db, cache, "SELECT ?");
+        // While checked out, the same SQL gets a separate statement.
+        Statement nested(db, cache, "SELECT ?");
+        stmt.bind(1, 1);
+        nested.bind(1, 2);
+        EXPECT_EQ(true, stmt.step());
+        EXPECT_EQ(true, nested.step());
+        EXPECT_EQ(1, stmt.getInt(0));
+        EXPECT_EQ(2, nested.getInt(0));
+    }
+    EXPECT_EQ(1, cache.getHits());
+    EXPECT_EQ(2, cache.getMisses());
+    EXPECT_EQ(1, cache.size());
+
+    {
+        // Bindings are cleared when a statement is returned.
+        Statement stmt(db, cache, "SELECT ?");
+        EXPECT_EQ(true, stmt.step());
+        EXPECT_EQ(0, stmt.getInt(0));
+        stmt.finalize();
+    }
+    EXPECT_EQ(2, cache.getHits());
+    cache.clear();
+    EXPECT_EQ(0, cache.size());
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
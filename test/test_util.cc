@@ -54,6 +54,25 @@ TEST_F(UtilTest, scanblock) {
     ASSERT_FALSE(has_scanblock(noblock_root));
 }
 
+TEST_F(UtilTest, cursor) {
+    const std::vector<std::string> fields {"", "a:b", "12", "\xc3\xa9t\xc3\xa9"};
+    std::string cursor = encodeCursor('m', fields);
+    EXPECT_EQ(fields, decodeCursor(cursor, 'm', fields.size()));
+    EXPECT_THROW(decodeCursor(cursor, 's', fields.size()), std::runtime_error);
+    EXPECT_THROW(decodeCursor(cursor, 'm', 2), std::runtime_error);
+    EXPECT_THROW(decodeCursor("m5:abc", 'm', 1), std::runtime_error);
+    EXPECT_THROW(decodeCursor("mx:abc", 'm', 1), std::runtime_error);
+    EXPECT_THROW(decodeCursor("", 'm', 0), std::runtime_error);
+}
+
+TEST_F(UtilTest, prefixEnd) {
+    EXPECT_EQ("/media/user0", prefixEnd("/media/user/"));
+    EXPECT_EQ("ac", prefixEnd("ab"));
+    EXPECT_EQ("b", prefixEnd("a\xff\xff"));
+    EXPECT_EQ("", prefixEnd("\xff"));
+    EXPECT_EQ("", prefixEnd(""));
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();